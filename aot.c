@@ -0,0 +1,193 @@
+#include "./tokenizer.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./primitive.h"
+#include "./interpreter.h"
+#include "./vm.h"
+#include "./aot.h"
+#include "./fasl.h"
+#include <stdio.h>
+
+LispContext * aot_global_ctx = NULL;
+
+// The pending tail call: a compiled function, or a value to call when that is NULL.
+static CompiledFunPtr tail_function = NULL;
+static LispValue * tail_callee = NULL;
+static LispValue * tail_args[AOT_MAX_TAIL_CALL_ARGS];
+static size_t tail_argc = 0;
+
+// Sets up the runtime the way main does, taking the same options.
+void aot_init(int argc, char ** argv) {
+    GCAllocator allocator = kGCPoolAllocator;
+    for ( int arg_index = 1 ; arg_index < argc ; arg_index++ ) {
+        if ( strcmp(argv[arg_index], "--alloc=pool") == 0 ) {
+            allocator = kGCPoolAllocator;
+        } else if ( strcmp(argv[arg_index], "--alloc=malloc") == 0 ) {
+            allocator = kGCMallocAllocator;
+        } else if ( strcmp(argv[arg_index], "--vm") == 0 ) {
+            vm_enabled = true;
+        } else if ( strcmp(argv[arg_index], "--no-fasl") == 0 ) {
+            fasl_enabled = false;
+        } else {
+            printf("Unknown option: %s\n", argv[arg_index]);
+            exit_message("Usage: [--alloc=pool|--alloc=malloc] [--vm] [--no-fasl]", -1);
+        }
+    }
+    gc_init(allocator);
+    if ( vm_enabled )
+        vm_init();
+    init_global_symbol_table(200);
+    gc_register_root(&tail_callee);
+    gc_register_root_array((void **)tail_args, &tail_argc);
+    gc_register_root(&aot_global_ctx);
+    aot_global_ctx = new_context();
+    init_primitive_defs(aot_global_ctx);
+}
+
+static LispCell * read_source(char * source) {
+    TokenList * tokens = tokenize(source);
+    LispCell * forms = construct_ast(tokens, NULL);
+    free_token_list(tokens);
+    return forms;
+}
+
+// Reads the quoted data compiled code refers to. The array stays a root for good.
+void aot_read_constants(LispValue ** constants, char ** sources, size_t * count) {
+    gc_register_root_array((void **)constants, count);
+    for ( size_t i = 0 ; i < *count ; i++ )
+        constants[i] = read_source(sources[i])->head;
+}
+
+void aot_intern_globals(SymbolTableEntry ** globals, char ** names, size_t count) {
+    for ( size_t i = 0 ; i < count ; i++ )
+        globals[i] = symbol_entry_of(new_interned_symbol(names[i])->value);
+}
+
+// Defines a compiled function as a native, which holds the function it stands for, so
+// that calls through the global can go to it directly.
+LispValue * aot_define_compiled(SymbolTableEntry * global, NativeFunPtr native, CompiledFunPtr function, size_t arity) {
+    LispNative * lisp_native = new_lisp_native(native, global->name, -1);
+    lisp_native->compiled = function;
+    lisp_native->compiled_arity = arity;
+    define_context_value(aot_global_ctx, global->name, lisp_native);
+    return NULL;
+}
+
+static CompiledFunPtr compiled_function_of(LispValue * callee, size_t argc) {
+    if ( value_type(callee) != kNativeValue || ((LispNative *)callee)->compiled_arity != argc )
+        return NULL;
+    return ((LispNative *)callee)->compiled;
+}
+
+// Evaluates top-level forms the compiler left to the interpreter.
+LispValue * aot_eval_source(char * source) {
+    size_t roots = gc_save_roots();
+    LispCell * forms = read_source(source);
+    gc_protect(forms);
+    LispValue * result = eval_seq(forms, aot_global_ctx);
+    gc_restore_roots(roots);
+    return result;
+}
+
+void aot_print_result(LispValue * result) {
+    printf("=> ");
+    print_value(result);
+    printf("\n");
+}
+
+void aot_protect(LispValue ** slots, size_t count) {
+    for ( size_t i = 0 ; i < count ; i++ )
+        gc_protect(slots[i]);
+}
+
+LispValue ** aot_pad_args(LispValue ** argv, size_t argc, LispValue ** padded, size_t arity) {
+    if ( argc > arity )
+        exit_message("Too many arguments passed to lambda.", -1);
+    if ( argc == arity )
+        return argv;
+    for ( size_t i = 0 ; i < arity ; i++ )
+        padded[i] = i < argc ? argv[i] : NULL;
+    return padded;
+}
+
+// The arguments must be protected by the caller. A primitive that isn't a native is
+// passed them as constants, so that evaluating them gives back the values.
+LispValue * aot_call(LispValue * callee, size_t argc, LispValue ** argv) {
+    CompiledFunPtr function = compiled_function_of(callee, argc);
+    if ( function )
+        return aot_finish(function(argv));
+    if ( value_type(callee) == kNativeValue )
+        return call_native(callee, argv, argc);
+    if ( value_type(callee) == kLambdaValue )
+        return call_lambda(callee, argv, argc);
+    size_t roots = gc_save_roots();
+    LispCell * args = NULL;
+    gc_protect(callee);
+    gc_protect(args);
+    for ( size_t i = argc ; i > 0 ; i-- ) {
+        LispValue * arg = argv[i - 1];
+        args = new_lisp_cell(new_lisp_constant(arg), args);
+    }
+    LispValue * result = NULL;
+    if ( value_type(callee) == kPrimitiveValue ) {
+        PrimitiveFunPtr prim_ptr = callee->value;
+        result = (*prim_ptr)(args, aot_global_ctx);
+        if ( result == TAIL_CALL )
+            result = run_pending_tail_call();
+    } else {
+        exit_message("Encountered value other than lambda, macro, or primitive at head of list.", -1);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+static void save_tail_args(size_t argc, LispValue ** argv) {
+    if ( argc > AOT_MAX_TAIL_CALL_ARGS )
+        exit_message("Too many arguments in compiled tail call.", -1);
+    for ( size_t i = 0 ; i < argc ; i++ )
+        tail_args[i] = argv[i];
+    tail_argc = argc;
+}
+
+LispValue * aot_tail_call(CompiledFunPtr function, size_t argc, LispValue ** argv) {
+    save_tail_args(argc, argv);
+    tail_function = function;
+    return AOT_TAIL_CALL;
+}
+
+LispValue * aot_tail_call_value(LispValue * callee, size_t argc, LispValue ** argv) {
+    save_tail_args(argc, argv);
+    tail_function = NULL;
+    tail_callee = callee;
+    return AOT_TAIL_CALL;
+}
+
+// Makes pending tail calls until one returns a value.
+LispValue * aot_finish(LispValue * result) {
+    while ( result == AOT_TAIL_CALL ) {
+        CompiledFunPtr function = tail_function;
+        if ( !function )
+            function = compiled_function_of(tail_callee, tail_argc);
+        if ( function ) {
+            tail_function = NULL;
+            tail_callee = NULL;
+            result = function(tail_args);
+            continue;
+        }
+        // The arguments are moved out of the pending call, which the callee may reuse.
+        size_t roots = gc_save_roots();
+        LispValue * callee = tail_callee;
+        size_t argc = tail_argc;
+        LispValue * argv[AOT_MAX_TAIL_CALL_ARGS];
+        gc_protect(callee);
+        for ( size_t i = 0 ; i < argc ; i++ ) {
+            argv[i] = tail_args[i];
+            gc_protect(argv[i]);
+        }
+        tail_callee = NULL;
+        tail_argc = 0;
+        result = aot_call(callee, argc, argv);
+        gc_restore_roots(roots);
+    }
+    return result;
+}
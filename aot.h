@@ -0,0 +1,102 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "./helper.h"
+#include "./constructor.h"
+#include "./context.h"
+
+// Runtime support for programs compiled to C by psxlisp --compile. A compiled
+// program links against the same runtime as the interpreter: its compiled
+// functions are defined as natives in the global context, and the top-level
+// forms the compiler left alone are read and evaluated when their turn comes.
+
+extern LispContext * aot_global_ctx;
+
+// A compiled function takes its arguments in an array it copies from on entry, before
+// anything can allocate.
+typedef LispValue *(*CompiledFunPtr)(LispValue ** argv);
+
+void aot_init(int argc, char ** argv);
+void aot_read_constants(LispValue ** constants, char ** sources, size_t * count);
+void aot_intern_globals(SymbolTableEntry ** globals, char ** names, size_t count);
+LispValue * aot_define_compiled(SymbolTableEntry * global, NativeFunPtr native, CompiledFunPtr function, size_t arity);
+LispValue * aot_eval_source(char * source);
+void aot_print_result(LispValue * result);
+
+// Protects the slots of a compiled function. Its caller restores the roots.
+void aot_protect(LispValue ** slots, size_t count);
+
+// Returns the arguments a compiled function was called with as a native, padded with
+// nulls to its arity in the given array if there are too few, as when a lambda is called.
+LispValue ** aot_pad_args(LispValue ** argv, size_t argc, LispValue ** padded, size_t arity);
+
+// Calls a lambda or primitive with evaluated arguments.
+LispValue * aot_call(LispValue * callee, size_t argc, LispValue ** argv);
+
+// A compiled function returns AOT_TAIL_CALL for a call in tail position, once the
+// arguments are copied aside, and whoever called it makes the call with aot_finish.
+// Chains of tail calls between compiled functions therefore run in constant C stack.
+#define AOT_TAIL_CALL ((LispValue *)0xa)
+#define AOT_MAX_TAIL_CALL_ARGS 64
+
+LispValue * aot_tail_call(CompiledFunPtr function, size_t argc, LispValue ** argv);
+LispValue * aot_tail_call_value(LispValue * callee, size_t argc, LispValue ** argv);
+LispValue * aot_finish(LispValue * result);
+
+static inline LispValue * aot_global(SymbolTableEntry * global) {
+    if ( !global->bound ) {
+        printf("UNFOUND: %s\n", global->name);
+        exit_message("Undefined symbol.", -1);
+    }
+    return global->value;
+}
+
+static inline void aot_set_global(SymbolTableEntry * global, LispValue * value) {
+    if ( !global->bound )
+        exit_message("Cannot set the value of variable that has not been defined.", -1);
+    set_global_value(global, value);
+}
+
+static inline int aot_int(LispValue * value, char * message) {
+    if ( value_type(value) != kNumberValue )
+        exit_message(message, -1);
+    return fixnum_value(value);
+}
+
+static inline LispValue * aot_car(LispCell * cell) {
+    if ( value_type(cell) != kCellValue )
+        exit_message("Non-list value passed to CAR.", -1);
+    return cell->head;
+}
+
+static inline LispValue * aot_cdr(LispCell * cell) {
+    if ( value_type(cell) != kCellValue )
+        exit_message("Non-list value passed to CDR.", -1);
+    return cell->tail;
+}
+
+static inline LispValue * aot_vector_ref(LispVector * vec, LispValue * idx) {
+    if ( value_type(vec) != kVectorValue )
+        exit_message("Non-vector value passed to VECTOR-REF.", -1);
+    if ( value_type(idx) != kNumberValue )
+        exit_message("Non-number index passed to VECTOR-REF.", -1);
+    if ( fixnum_value(idx) >= vec->length || fixnum_value(idx) < 0 )
+        exit_message("Index out of range passed to VECTOR-REF.", -1);
+    return vec->value[fixnum_value(idx)];
+}
+
+static inline LispValue * aot_vector_length(LispVector * vec) {
+    if ( value_type(vec) != kVectorValue )
+        exit_message("Non-vector value passed to VECTOR-LENGTH.", -1);
+    return new_lisp_number(vec->length);
+}
+
+// Returns from a compiled function, releasing the roots it protected.
+#define AOT_RETURN(value) \
+    do { \
+        LispValue * aot_result = (value); \
+        gc_restore_roots(roots); \
+        return aot_result; \
+    } while ( 0 )
+
+#endif // AOT_H
@@ -0,0 +1,989 @@
+#include "./tokenizer.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./primitive.h"
+#include "./interpreter.h"
+#include "./aot.h"
+#include "./compiler.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+// A growable list of strings: names and sources the generated program refers to by index.
+typedef struct StringList {
+    char ** items;
+    size_t count;
+    size_t capacity;
+} StringList;
+
+// A top-level function definition with a fixed parameter list. Calls of it from
+// compiled code call its C function directly, so it must be defined only once and
+// never set!.
+typedef struct Function {
+    char * name;
+    LispCell * params;
+    LispCell * body;
+    LispValue * form;
+    int arity;
+    int global;
+    char * c_name;
+    char * code;
+    bool compiled;
+    bool called;
+} Function;
+
+// Where the value of the form being compiled goes: returned from the function, or
+// stored in one of its slots.
+typedef struct Exit {
+    bool returns;
+    int target;
+} Exit;
+
+// A variable of the function being compiled, kept in one of its slots, or the name
+// of a named let whose body is compiled as a loop over the slots of its variables.
+// The loop can only be re-entered from its body's tail position, whose exit it keeps.
+typedef struct Binding {
+    char * name;
+    int slot;
+    int loop;
+    int count;
+    Exit * exit;
+    struct Binding * next;
+} Binding;
+
+typedef struct Compiler {
+    FILE * out;
+    Function * function;
+    Exit * function_exit;
+    Binding * scope;
+    int slot_count;
+    int max_slots;
+    int label_count;
+    int indent;
+    bool uses_start;
+    bool has_set;
+    bool failed;
+} Compiler;
+
+static LispContext * compile_ctx = NULL;
+static LispCell * program = NULL;
+static LispCell * expansions = NULL;
+static StringList globals;
+static StringList constants;
+static StringList defined_names;
+static StringList assigned_names;
+static StringList macro_names;
+static Function * functions = NULL;
+static size_t function_count = 0;
+
+static char * const special_forms[] = {
+    "quote", "if", "begin", "let", "set!", "lambda", "define", "defun", "defmacro",
+    "quasiquote", "include", "eval", NULL
+};
+
+// Operators on two numbers, with the C operator each compiles to.
+static char * const arithmetic_operators[][2] = {
+    { "-", "-" }, { "/", "/" }, { "%", "%" }, { "|", "|" }, { "&", "&" }, { "^", "^" }, { NULL, NULL }
+};
+
+static char * const comparison_operators[][2] = {
+    { "<", "<" }, { ">", ">" }, { "=", "==" }, { "!=", "!=" }, { ">=", ">=" }, { "<=", "<=" }, { NULL, NULL }
+};
+
+// Also catches special forms under another name, such as L for lambda.
+static bool is_special_form(LispValue * value) {
+    if ( value_type(value) != kPrimitiveValue )
+        return false;
+    PrimitiveFunPtr prim = value->value;
+    return prim == lisp_quote || prim == lisp_quasiquote || prim == lisp_if || prim == lisp_lambda_func ||
+        prim == lisp_define || prim == lisp_set || prim == lisp_defun || prim == lisp_defmacro ||
+        prim == lisp_let || prim == lisp_begin || prim == lisp_eval || prim == lisp_include_file;
+}
+
+static char * format_string(char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char * string = malloc(length + 1);
+    if ( !string )
+        exit_message("Error while allocating memory for compiler output.", -1);
+    va_start(args, format);
+    vsnprintf(string, length + 1, format, args);
+    va_end(args);
+    return string;
+}
+
+static int push_string(StringList * list, char * string) {
+    if ( list->count == list->capacity ) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, sizeof(char *) * list->capacity);
+        if ( !list->items )
+            exit_message("Error while allocating memory for compiler output.", -1);
+    }
+    list->items[list->count] = string;
+    return list->count++;
+}
+
+static bool contains_string(StringList * list, char * string) {
+    for ( size_t i = 0 ; i < list->count ; i++ )
+        if ( strcmp(list->items[i], string) == 0 )
+            return true;
+    return false;
+}
+
+static size_t count_string(StringList * list, char * string) {
+    size_t count = 0;
+    for ( size_t i = 0 ; i < list->count ; i++ )
+        if ( strcmp(list->items[i], string) == 0 )
+            count++;
+    return count;
+}
+
+static bool is_symbol_named(LispValue * value, char * name) {
+    return value_type(value) == kSymbolValue && strcmp(value->value, name) == 0;
+}
+
+static bool is_form(LispValue * form, char * name) {
+    return value_type(form) == kCellValue && is_symbol_named(((LispCell *)form)->head, name);
+}
+
+// Returns the number of elements of a proper list, or -1 for anything else.
+static int list_length(LispCell * list) {
+    int length = 0;
+    for ( ; list ; list = list->tail, length++ )
+        if ( value_type(list) != kCellValue )
+            return -1;
+    return length;
+}
+
+static bool contains_symbol(LispValue * value, char * name) {
+    if ( value_type(value) != kCellValue )
+        return is_symbol_named(value, name);
+    for ( ; value_type(value) == kCellValue ; value = ((LispCell *)value)->tail )
+        if ( contains_symbol(((LispCell *)value)->head, name) )
+            return true;
+    return value && contains_symbol(value, name);
+}
+
+// Writes a value as source the reader gives back an equal value for. Returns false
+// for values that have no source, such as lambdas.
+static bool write_datum(FILE * out, LispValue * value) {
+    if ( !value ) {
+        fprintf(out, "()");
+        return true;
+    }
+    switch ( value_type(value) ) {
+        case kNumberValue:
+            fprintf(out, "%d", fixnum_value(value));
+            return true;
+        case kStringValue:
+            fprintf(out, "\"%s\"", value->value);
+            return true;
+        case kSymbolValue:
+            fprintf(out, "%s", value->value);
+            return true;
+        case kCellValue: {
+            LispCell * cell = value;
+            // The reader makes () into a list of one empty value.
+            if ( !cell->head && !cell->tail ) {
+                fprintf(out, "()");
+                return true;
+            }
+            fprintf(out, "(");
+            for ( ; ; ) {
+                if ( !write_datum(out, cell->head) )
+                    return false;
+                if ( !cell->tail )
+                    break;
+                if ( value_type(cell->tail) != kCellValue ) {
+                    fprintf(out, " . ");
+                    if ( !write_datum(out, cell->tail) )
+                        return false;
+                    break;
+                }
+                fprintf(out, " ");
+                cell = cell->tail;
+            }
+            fprintf(out, ")");
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static char * datum_source(LispValue * value) {
+    char * source = NULL;
+    size_t size = 0;
+    FILE * out = open_memstream(&source, &size);
+    bool written = write_datum(out, value);
+    fclose(out);
+    if ( written )
+        return source;
+    free(source);
+    return NULL;
+}
+
+static void write_c_string(FILE * out, char * string) {
+    fputc('"', out);
+    for ( ; *string ; string++ ) {
+        if ( *string == '"' || *string == '\\' )
+            fprintf(out, "\\%c", *string);
+        else if ( *string == '\n' )
+            fprintf(out, "\\n");
+        else
+            fputc(*string, out);
+    }
+    fputc('"', out);
+}
+
+// Appends the forms of a file to the program, reversed, with the forms of the files
+// it includes at top level in place of the includes.
+static void read_program(char * filename) {
+    size_t roots = gc_save_roots();
+    LispCell * forms = construct_file_ast(filename);
+    gc_protect(forms);
+    for ( ; forms ; forms = forms->tail ) {
+        LispCell * form = forms->head;
+        if ( !form )
+            continue;
+        if ( is_form(form, "include") && list_length(form) == 2 && value_type(((LispCell *)form->tail)->head) == kStringValue ) {
+            read_program(((LispString *)((LispCell *)form->tail)->head)->value);
+            continue;
+        }
+        program = new_lisp_cell(forms->head, program);
+    }
+    gc_restore_roots(roots);
+}
+
+static void reverse_program() {
+    LispCell * reversed = NULL;
+    while ( program ) {
+        LispCell * next = program->tail;
+        program->tail = reversed;
+        gc_write_barrier(program, reversed);
+        reversed = program;
+        program = next;
+    }
+    program = reversed;
+}
+
+static void record_assignments(LispValue * form) {
+    if ( value_type(form) != kCellValue )
+        return;
+    if ( is_form(form, "set!") && value_type(((LispCell *)form)->tail) == kCellValue ) {
+        LispValue * name = ((LispCell *)((LispCell *)form)->tail)->head;
+        if ( value_type(name) == kSymbolValue )
+            push_string(&assigned_names, name->value);
+    }
+    for ( ; value_type(form) == kCellValue ; form = ((LispCell *)form)->tail )
+        record_assignments(((LispCell *)form)->head);
+}
+
+static bool is_rebound(char * name) {
+    return contains_string(&defined_names, name) || contains_string(&assigned_names, name);
+}
+
+static int global_index(char * name) {
+    for ( size_t i = 0 ; i < globals.count ; i++ )
+        if ( globals.items[i] == name )
+            return i;
+    return push_string(&globals, name);
+}
+
+static bool is_param_list(LispCell * params) {
+    if ( list_length(params) < 0 )
+        return false;
+    for ( ; params ; params = params->tail )
+        if ( value_type(params->head) != kSymbolValue )
+            return false;
+    return true;
+}
+
+static void add_function(LispValue * form, LispSymbol * name, LispCell * params, LispCell * body) {
+    if ( value_type(name) != kSymbolValue || !is_param_list(params) )
+        return;
+    functions = realloc(functions, sizeof(Function) * (function_count + 1));
+    if ( !functions )
+        exit_message("Error while allocating memory for compiler output.", -1);
+    Function * function = &functions[function_count];
+    function->name = name->value;
+    function->params = params;
+    function->body = body;
+    function->form = form;
+    function->arity = list_length(params);
+    function->global = global_index(name->value);
+    char * c_name = format_string("fn_%zu_%s", function_count, name->value);
+    for ( char * c = c_name ; *c ; c++ )
+        if ( !isalnum(*c) )
+            *c = '_';
+    function->c_name = c_name;
+    function->code = NULL;
+    function->compiled = false;
+    function->called = false;
+    function_count++;
+}
+
+static Function * find_function(char * name) {
+    for ( size_t i = 0 ; i < function_count ; i++ )
+        if ( functions[i].name == name )
+            return &functions[i];
+    return NULL;
+}
+
+// Defines the program's macros and functions at compile time, and finds out which
+// globals it ever rebinds.
+static void prepare_program() {
+    size_t roots = gc_save_roots();
+    LispCell * current_cell = program;
+    gc_protect(current_cell);
+    for ( ; current_cell ; current_cell = current_cell->tail ) {
+        LispCell * form = current_cell->head;
+        record_assignments(form);
+        if ( list_length(form) < 3 )
+            continue;
+        LispValue * target = ((LispCell *)form->tail)->head;
+        LispValue * value = ((LispCell *)((LispCell *)form->tail)->tail)->head;
+        if ( is_form(form, "defun") && value_type(target) == kCellValue ) {
+            if ( value_type(((LispCell *)target)->head) == kSymbolValue )
+                push_string(&defined_names, ((LispCell *)target)->head->value);
+            eval(form, compile_ctx);
+        } else if ( is_form(form, "defmacro") ) {
+            if ( value_type(target) == kCellValue && value_type(((LispCell *)target)->head) == kSymbolValue ) {
+                push_string(&defined_names, ((LispCell *)target)->head->value);
+                push_string(&macro_names, ((LispCell *)target)->head->value);
+            }
+            eval(form, compile_ctx);
+        } else if ( is_form(form, "define") && value_type(target) == kSymbolValue ) {
+            push_string(&defined_names, target->value);
+            // Aliases are defined too, since macros may expand to them.
+            if ( value_type(value) == kSymbolValue || (is_form(value, "lambda") && list_length(value) >= 2) )
+                eval(form, compile_ctx);
+        }
+    }
+    gc_restore_roots(roots);
+}
+
+// Finds the functions the compiler may call directly. The program's forms must no
+// longer move.
+static void find_functions() {
+    for ( LispCell * current_cell = program ; current_cell ; current_cell = current_cell->tail ) {
+        LispCell * form = current_cell->head;
+        if ( list_length(form) < 3 )
+            continue;
+        LispCell * target = ((LispCell *)form->tail)->head;
+        LispCell * value = ((LispCell *)((LispCell *)form->tail)->tail)->head;
+        char * name = NULL;
+        if ( is_form(form, "defun") && value_type(target) == kCellValue && value_type(target->head) == kSymbolValue ) {
+            name = target->head->value;
+        } else if ( is_form(form, "define") && value_type(target) == kSymbolValue && is_form(value, "lambda") && list_length(value) >= 2 ) {
+            name = ((LispSymbol *)target)->value;
+        }
+        if ( !name || count_string(&defined_names, name) != 1 || contains_string(&assigned_names, name) )
+            continue;
+        if ( is_form(form, "defun") )
+            add_function(form, target->head, target->tail, ((LispCell *)form->tail)->tail);
+        else
+            add_function(form, target, ((LispCell *)value->tail)->head, ((LispCell *)value->tail)->tail);
+    }
+}
+
+static void emit(Compiler * compiler, char * format, ...) {
+    for ( int i = 0 ; i < compiler->indent ; i++ )
+        fprintf(compiler->out, "    ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(compiler->out, format, args);
+    va_end(args);
+    fprintf(compiler->out, "\n");
+}
+
+static int new_slot(Compiler * compiler) {
+    int slot = compiler->slot_count++;
+    if ( compiler->slot_count > compiler->max_slots )
+        compiler->max_slots = compiler->slot_count;
+    return slot;
+}
+
+static Binding * lookup_binding(Compiler * compiler, char * name) {
+    for ( Binding * binding = compiler->scope ; binding ; binding = binding->next )
+        if ( binding->name == name )
+            return binding;
+    return NULL;
+}
+
+static void finish(Compiler * compiler, Exit * exit, char * expression) {
+    if ( exit->returns )
+        emit(compiler, "AOT_RETURN(%s);", expression);
+    else
+        emit(compiler, "v[%d] = %s;", exit->target, expression);
+}
+
+// Returns true for a call of the named global primitive, unless the program rebinds it.
+static bool is_inline_call(Compiler * compiler, LispValue * form, char * name, int arity) {
+    if ( !is_form(form, name) || lookup_binding(compiler, name) || is_rebound(name) )
+        return false;
+    int argc = list_length(((LispCell *)form)->tail);
+    return argc >= 0 && (arity < 0 || argc == arity);
+}
+
+static char * find_operator(Compiler * compiler, LispValue * form, char * const operators[][2]) {
+    for ( size_t i = 0 ; operators[i][0] ; i++ )
+        if ( is_inline_call(compiler, form, operators[i][0], 2) )
+            return operators[i][1];
+    return NULL;
+}
+
+static char * compile_constant(LispValue * value) {
+    char * source = datum_source(value);
+    if ( !source )
+        return NULL;
+    return format_string("constants[%d]", push_string(&constants, source));
+}
+
+static void compile_form(Compiler * compiler, LispValue * form, Exit * exit);
+
+// Returns the C expression for a form that needs no code of its own, or NULL. With
+// set! in the function, variables are read into slots, so that they are read in order.
+static char * simple_operand(Compiler * compiler, LispValue * form, bool in_order) {
+    switch ( value_type(form) ) {
+        case kNumberValue:
+            return format_string("make_fixnum(%d)", fixnum_value(form));
+        case kStringValue:
+            return compile_constant(form);
+        case kBoolValue:
+            return form->value ? "TRUE_VALUE" : "FALSE_VALUE";
+        case kSymbolValue: {
+            char * name = form->value;
+            Binding * binding = lookup_binding(compiler, name);
+            if ( binding && binding->loop >= 0 ) {
+                compiler->failed = true;
+                return "NULL";
+            }
+            if ( in_order && compiler->has_set )
+                return NULL;
+            if ( binding )
+                return format_string("v[%d]", binding->slot);
+            if ( strcmp(name, "null") == 0 && !is_rebound(name) )
+                return "NULL";
+            if ( strcmp(name, "true") == 0 && !is_rebound(name) )
+                return "TRUE_VALUE";
+            if ( strcmp(name, "false") == 0 && !is_rebound(name) )
+                return "FALSE_VALUE";
+            return format_string("aot_global(globals[%d])", global_index(name));
+        }
+        case kCellValue:
+            if ( is_inline_call(compiler, form, "quote", 1) ) {
+                char * constant = compile_constant(((LispCell *)((LispCell *)form)->tail)->head);
+                if ( !constant ) {
+                    compiler->failed = true;
+                    return "NULL";
+                }
+                return constant;
+            }
+            return NULL;
+        default:
+            if ( !form )
+                return "NULL";
+            return NULL;
+    }
+}
+
+// Returns the C expression for a form's value, computing it into a slot first if needed.
+static char * operand(Compiler * compiler, LispValue * form) {
+    char * expression = simple_operand(compiler, form, true);
+    if ( expression )
+        return expression;
+    Exit exit = { false, new_slot(compiler) };
+    compile_form(compiler, form, &exit);
+    return format_string("v[%d]", exit.target);
+}
+
+static char * int_operand(Compiler * compiler, LispValue * form, char * message) {
+    if ( value_type(form) == kNumberValue )
+        return format_string("%d", fixnum_value(form));
+    return format_string("aot_int(%s, \"%s\")", operand(compiler, form), message);
+}
+
+// Returns a C condition that is true when the form's value isn't false or null.
+static char * compile_condition(Compiler * compiler, LispValue * form) {
+    LispCell * args = value_type(form) == kCellValue ? ((LispCell *)form)->tail : NULL;
+    char * op = find_operator(compiler, form, comparison_operators);
+    if ( op ) {
+        char * a = int_operand(compiler, args->head, "Operator arguments must be numbers.");
+        char * b = int_operand(compiler, args->tail->value, "Operator arguments must be numbers.");
+        return format_string("(%s %s %s)", a, op, b);
+    }
+    if ( is_inline_call(compiler, form, "not", 1) )
+        return format_string("!%s", compile_condition(compiler, args->head));
+    if ( is_inline_call(compiler, form, "null?", 1) )
+        return format_string("(%s == NULL)", operand(compiler, args->head));
+    if ( is_inline_call(compiler, form, "eq?", 2) ) {
+        char * a = operand(compiler, args->head);
+        return format_string("(%s == %s)", a, operand(compiler, args->tail->value));
+    }
+    return format_string("boolify_value(%s)", operand(compiler, form));
+}
+
+static void compile_body(Compiler * compiler, LispCell * body, Exit * exit) {
+    if ( !body ) {
+        finish(compiler, exit, "NULL");
+        return;
+    }
+    for ( ; body->tail ; body = body->tail ) {
+        Exit discard = { false, new_slot(compiler) };
+        compile_form(compiler, body->head, &discard);
+    }
+    compile_form(compiler, body->head, exit);
+}
+
+static void compile_if(Compiler * compiler, LispCell * args, int argc, Exit * exit) {
+    if ( argc != 2 && argc != 3 ) {
+        compiler->failed = true;
+        return;
+    }
+    emit(compiler, "if ( %s ) {", compile_condition(compiler, args->head));
+    compiler->indent++;
+    compile_form(compiler, args->tail->value, exit);
+    compiler->indent--;
+    emit(compiler, "} else {");
+    compiler->indent++;
+    compile_form(compiler, argc == 3 ? ((LispCell *)args->tail)->tail->value : NULL, exit);
+    compiler->indent--;
+    emit(compiler, "}");
+}
+
+// Computes the new values of a loop's variables, then jumps back to its start.
+static void compile_jump(Compiler * compiler, LispCell * args, int first_slot, char * label) {
+    int first_arg = compiler->slot_count;
+    for ( LispCell * arg = args ; arg ; arg = arg->tail ) {
+        Exit exit = { false, new_slot(compiler) };
+        compile_form(compiler, arg->head, &exit);
+    }
+    for ( int i = 0 ; i < compiler->slot_count - first_arg ; i++ )
+        emit(compiler, "v[%d] = v[%d];", first_slot + i, first_arg + i);
+    emit(compiler, "goto %s;", label);
+}
+
+static void compile_let(Compiler * compiler, LispCell * args, int argc, Exit * exit) {
+    LispSymbol * loop_name = NULL;
+    if ( argc >= 2 && value_type(args->head) == kSymbolValue ) {
+        loop_name = args->head;
+        args = args->tail;
+    }
+    LispCell * bindings = args ? args->head : NULL;
+    int count = list_length(bindings);
+    if ( !args || count < 1 ) {
+        compiler->failed = true;
+        return;
+    }
+    for ( LispCell * binding = bindings ; binding ; binding = binding->tail ) {
+        if ( list_length(binding->head) != 2 || value_type(((LispCell *)binding->head)->head) != kSymbolValue ) {
+            compiler->failed = true;
+            return;
+        }
+    }
+    // The values are computed in the enclosing scope, straight into the variables' slots.
+    int first_slot = compiler->slot_count;
+    for ( LispCell * binding = bindings ; binding ; binding = binding->tail ) {
+        Exit init = { false, new_slot(compiler) };
+        compile_form(compiler, ((LispCell *)binding->head)->tail->value, &init);
+    }
+    Binding * scope = compiler->scope;
+    Binding * new_bindings = malloc(sizeof(Binding) * (count + 1));
+    if ( !new_bindings )
+        exit_message("Error while allocating memory for compiler output.", -1);
+    if ( loop_name ) {
+        int label = compiler->label_count++;
+        new_bindings[count] = (Binding){ loop_name->value, first_slot, label, count, exit, compiler->scope };
+        compiler->scope = &new_bindings[count];
+        emit(compiler, "loop_%d: ;", label);
+    }
+    int slot = first_slot;
+    for ( LispCell * binding = bindings ; binding ; binding = binding->tail, slot++ ) {
+        new_bindings[slot - first_slot] = (Binding){ ((LispSymbol *)((LispCell *)binding->head)->head)->value, slot, -1, 0, NULL, compiler->scope };
+        compiler->scope = &new_bindings[slot - first_slot];
+    }
+    compile_body(compiler, args->tail, exit);
+    compiler->scope = scope;
+    free(new_bindings);
+}
+
+static void compile_set(Compiler * compiler, LispCell * args, int argc, Exit * exit) {
+    if ( argc != 2 || value_type(args->head) != kSymbolValue ) {
+        compiler->failed = true;
+        return;
+    }
+    char * name = ((LispSymbol *)args->head)->value;
+    Binding * binding = lookup_binding(compiler, name);
+    if ( binding && binding->loop >= 0 ) {
+        compiler->failed = true;
+        return;
+    }
+    Exit value = { false, new_slot(compiler) };
+    compile_form(compiler, args->tail->value, &value);
+    if ( binding )
+        emit(compiler, "v[%d] = v[%d];", binding->slot, value.target);
+    else
+        emit(compiler, "aot_set_global(globals[%d], v[%d]);", global_index(name), value.target);
+    finish(compiler, exit, "NULL");
+}
+
+// Macros are only expanded ahead of time when their template doesn't use eval,
+// since an expansion that evaluates its arguments depends on the caller's frame.
+static void compile_macro_call(Compiler * compiler, LispMacro * macro, LispCell * args, Exit * exit) {
+    if ( contains_symbol(macro->value->template, "eval") ) {
+        compiler->failed = true;
+        return;
+    }
+    size_t roots = gc_save_roots();
+    LispValue * expansion = expand_macro(macro, args, compile_ctx);
+    gc_protect(expansion);
+    expansions = new_lisp_cell(expansion, expansions);
+    // Promoted, the expansion won't move while it's compiled.
+    gc_minor_collect();
+    gc_restore_roots(roots);
+    compile_form(compiler, expansions->head, exit);
+}
+
+static bool compile_inline_call(Compiler * compiler, LispValue * form, Exit * exit) {
+    LispCell * args = ((LispCell *)form)->tail;
+    char * op = find_operator(compiler, form, arithmetic_operators);
+    if ( op ) {
+        char * a = int_operand(compiler, args->head, "Operator arguments must be numbers.");
+        char * b = int_operand(compiler, args->tail->value, "Operator arguments must be numbers.");
+        finish(compiler, exit, format_string("make_fixnum(%s %s %s)", a, op, b));
+        return true;
+    }
+    if ( is_inline_call(compiler, form, "+", -1) || is_inline_call(compiler, form, "*", -1) ) {
+        char * op = ((LispCell *)form)->head->value;
+        char * expression = strcmp(op, "+") == 0 ? "0" : "1";
+        for ( LispCell * arg = args ; arg ; arg = arg->tail ) {
+            char * value = int_operand(compiler, arg->head, "Attempt to add non-number.");
+            expression = arg == args ? value : format_string("%s %s %s", expression, op, value);
+        }
+        finish(compiler, exit, format_string("make_fixnum(%s)", expression));
+        return true;
+    }
+    if ( find_operator(compiler, form, comparison_operators) || is_inline_call(compiler, form, "not", 1) ||
+         is_inline_call(compiler, form, "null?", 1) || is_inline_call(compiler, form, "eq?", 2) ) {
+        finish(compiler, exit, format_string("valueify_bool(%s)", compile_condition(compiler, form)));
+        return true;
+    }
+    if ( is_inline_call(compiler, form, "car", 1) ) {
+        finish(compiler, exit, format_string("aot_car(%s)", operand(compiler, args->head)));
+        return true;
+    }
+    if ( is_inline_call(compiler, form, "cdr", 1) ) {
+        finish(compiler, exit, format_string("aot_cdr(%s)", operand(compiler, args->head)));
+        return true;
+    }
+    if ( is_inline_call(compiler, form, "vector-length", 1) ) {
+        finish(compiler, exit, format_string("aot_vector_length(%s)", operand(compiler, args->head)));
+        return true;
+    }
+    if ( is_inline_call(compiler, form, "cons", 2) || is_inline_call(compiler, form, "vector-ref", 2) ) {
+        char * a = operand(compiler, args->head);
+        char * b = operand(compiler, args->tail->value);
+        char * function = is_form(form, "cons") ? "new_lisp_cell" : "aot_vector_ref";
+        finish(compiler, exit, format_string("%s(%s, %s)", function, a, b));
+        return true;
+    }
+    return false;
+}
+
+// Evaluates arguments into consecutive slots, returning the first.
+static int compile_args(Compiler * compiler, LispCell * args) {
+    int first_arg = compiler->slot_count;
+    for ( LispCell * arg = args ; arg ; arg = arg->tail ) {
+        Exit arg_exit = { false, new_slot(compiler) };
+        compile_form(compiler, arg->head, &arg_exit);
+    }
+    return first_arg;
+}
+
+// Calls in tail position are left for the caller to make, so that tail calls don't
+// grow the C stack.
+static void compile_direct_call(Compiler * compiler, Function * callee, LispCell * args, Exit * exit) {
+    if ( callee == compiler->function && exit == compiler->function_exit ) {
+        compiler->uses_start = true;
+        compile_jump(compiler, args, 0, "start");
+        return;
+    }
+    int first_arg = compile_args(compiler, args);
+    char * argv = callee->arity ? format_string("v + %d", first_arg) : "NULL";
+    callee->called = true;
+    if ( exit->returns )
+        finish(compiler, exit, format_string("aot_tail_call(%s, %d, %s)", callee->c_name, callee->arity, argv));
+    else
+        finish(compiler, exit, format_string("aot_finish(%s(%s))", callee->c_name, argv));
+}
+
+// Calls whatever the head evaluates to through the runtime, with the arguments in
+// consecutive slots.
+static void compile_generic_call(Compiler * compiler, LispValue * head, LispCell * args, int argc, Exit * exit) {
+    char * callee = NULL;
+    if ( value_type(head) == kSymbolValue && !lookup_binding(compiler, head->value) ) {
+        callee = format_string("aot_global(globals[%d])", global_index(head->value));
+    } else {
+        Exit head_exit = { false, new_slot(compiler) };
+        compile_form(compiler, head, &head_exit);
+        callee = format_string("v[%d]", head_exit.target);
+    }
+    int first_arg = compile_args(compiler, args);
+    char * argv = argc ? format_string("v + %d", first_arg) : "NULL";
+    if ( exit->returns && argc <= AOT_MAX_TAIL_CALL_ARGS )
+        finish(compiler, exit, format_string("aot_tail_call_value(%s, %d, %s)", callee, argc, argv));
+    else
+        finish(compiler, exit, format_string("aot_call(%s, %d, %s)", callee, argc, argv));
+}
+
+static void compile_call(Compiler * compiler, LispCell * form, Exit * exit) {
+    LispValue * head = form->head;
+    LispCell * args = form->tail;
+    int argc = list_length(args);
+    if ( argc < 0 ) {
+        compiler->failed = true;
+        return;
+    }
+    if ( value_type(head) != kSymbolValue ) {
+        compile_generic_call(compiler, head, args, argc, exit);
+        return;
+    }
+    char * name = head->value;
+    Binding * binding = lookup_binding(compiler, name);
+    if ( binding && binding->loop >= 0 ) {
+        if ( exit != binding->exit || argc != binding->count ) {
+            compiler->failed = true;
+            return;
+        }
+        char * label = format_string("loop_%d", binding->loop);
+        compile_jump(compiler, args, binding->slot, label);
+        return;
+    }
+    if ( binding ) {
+        compile_generic_call(compiler, head, args, argc, exit);
+        return;
+    }
+    for ( size_t i = 0 ; special_forms[i] ; i++ ) {
+        if ( strcmp(name, special_forms[i]) != 0 )
+            continue;
+        if ( is_rebound(name) )
+            compiler->failed = true;
+        else if ( strcmp(name, "if") == 0 )
+            compile_if(compiler, args, argc, exit);
+        else if ( strcmp(name, "begin") == 0 )
+            compile_body(compiler, args, exit);
+        else if ( strcmp(name, "let") == 0 )
+            compile_let(compiler, args, argc, exit);
+        else if ( strcmp(name, "set!") == 0 )
+            compile_set(compiler, args, argc, exit);
+        else
+            compiler->failed = true;
+        return;
+    }
+    SymbolTableEntry * global = symbol_entry_of(name);
+    // Every macro has been defined before anything is compiled, so a call of a macro
+    // the program binds again would be compiled with its last binding, even where the
+    // interpreter would still expand an earlier one.
+    if ( contains_string(&macro_names, name) && (count_string(&defined_names, name) != 1 || contains_string(&assigned_names, name)) ) {
+        compiler->failed = true;
+        return;
+    }
+    if ( global->bound && value_type(global->value) == kMacroValue ) {
+        compile_macro_call(compiler, global->value, args, exit);
+        return;
+    }
+    if ( global->bound && is_special_form(global->value) ) {
+        compiler->failed = true;
+        return;
+    }
+    if ( compile_inline_call(compiler, form, exit) )
+        return;
+    Function * callee = find_function(name);
+    if ( callee && callee->arity == argc && argc <= AOT_MAX_TAIL_CALL_ARGS ) {
+        compile_direct_call(compiler, callee, args, exit);
+        return;
+    }
+    compile_generic_call(compiler, head, args, argc, exit);
+}
+
+static void compile_form(Compiler * compiler, LispValue * form, Exit * exit) {
+    if ( compiler->failed )
+        return;
+    int slot_count = compiler->slot_count;
+    char * expression = simple_operand(compiler, form, false);
+    if ( expression )
+        finish(compiler, exit, expression);
+    else if ( value_type(form) == kCellValue )
+        compile_call(compiler, form, exit);
+    else
+        compiler->failed = true;
+    compiler->slot_count = slot_count;
+}
+
+static void write_signature(FILE * out, Function * function) {
+    fprintf(out, "static LispValue * %s(LispValue ** argv)", function->c_name);
+}
+
+// Compiles a function to a C function taking an array of arguments, and a native
+// for the interpreter to call it by. Leaves it uncompiled if the body
+// uses anything the compiler doesn't handle.
+static void compile_function(Function * function) {
+    char * body = NULL;
+    size_t body_size = 0;
+    Exit function_exit = { true, 0 };
+    Compiler compiler = { 0 };
+    compiler.out = open_memstream(&body, &body_size);
+    compiler.function = function;
+    compiler.function_exit = &function_exit;
+    compiler.has_set = contains_symbol(function->body, "set!");
+    compiler.indent = 1;
+    Binding * params = malloc(sizeof(Binding) * (function->arity + 1));
+    int slot = 0;
+    for ( LispCell * param = function->params ; param ; param = param->tail, slot++ ) {
+        params[slot] = (Binding){ ((LispSymbol *)param->head)->value, new_slot(&compiler), -1, 0, NULL, compiler.scope };
+        compiler.scope = &params[slot];
+    }
+    compile_body(&compiler, function->body, &function_exit);
+    fclose(compiler.out);
+    free(params);
+    if ( compiler.failed ) {
+        free(body);
+        return;
+    }
+    char * code = NULL;
+    size_t code_size = 0;
+    FILE * out = open_memstream(&code, &code_size);
+    char * params_source = datum_source(function->params);
+    fprintf(out, "// %s %s\n", function->name, function->params ? params_source : "()");
+    write_signature(out, function);
+    fprintf(out, " {\n");
+    fprintf(out, "    size_t roots = gc_save_roots();\n");
+    int slot_count = compiler.max_slots ? compiler.max_slots : 1;
+    fprintf(out, "    LispValue * v[%d] = { ", slot_count);
+    if ( !function->arity )
+        fprintf(out, "NULL");
+    for ( int i = 0 ; i < function->arity ; i++ )
+        fprintf(out, "%sargv[%d]", i ? ", " : "", i);
+    fprintf(out, " };\n");
+    fprintf(out, "    aot_protect(v, %d);\n", slot_count);
+    if ( compiler.uses_start )
+        fprintf(out, "  start:\n");
+    fprintf(out, "%s}\n\n", body);
+    fprintf(out, "static LispValue * %s_native(LispValue ** argv, size_t argc) {\n", function->c_name);
+    fprintf(out, "    LispValue * padded[%d];\n", function->arity ? function->arity : 1);
+    fprintf(out, "    return aot_finish(%s(aot_pad_args(argv, argc, padded, %d)));\n}\n", function->c_name, function->arity);
+    fclose(out);
+    free(body);
+    free(params_source);
+    function->code = code;
+    function->compiled = true;
+}
+
+// Calls from compiled code of a function the compiler couldn't handle go through its global.
+static void write_stub(FILE * out, Function * function) {
+    write_signature(out, function);
+    fprintf(out, " {\n");
+    fprintf(out, "    return aot_call(aot_global(globals[%d]), %d, argv);\n}\n\n", function->global, function->arity);
+}
+
+static void write_string_array(FILE * out, char * declaration, StringList * list) {
+    fprintf(out, "%s[] = {\n", declaration);
+    for ( size_t i = 0 ; i < list->count ; i++ ) {
+        fprintf(out, "    ");
+        write_c_string(out, list->items[i]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "    NULL\n};\n\n");
+}
+
+static void write_program(char * filename, char * output_filename) {
+    FILE * out = fopen(output_filename, "w");
+    if ( !out )
+        exit_message("Could not open the output file.", -1);
+    fprintf(out, "// Compiled from %s by psxlisp --compile. Build it with make-compiled.sh.\n", filename);
+    fprintf(out, "#include \"./constructor.h\"\n");
+    fprintf(out, "#include \"./context.h\"\n");
+    fprintf(out, "#include \"./primitive.h\"\n");
+    fprintf(out, "#include \"./interpreter.h\"\n");
+    fprintf(out, "#include \"./aot.h\"\n\n");
+    write_string_array(out, "static char * global_names", &globals);
+    fprintf(out, "static SymbolTableEntry * globals[%zu];\n\n", globals.count + 1);
+    write_string_array(out, "static char * constant_sources", &constants);
+    fprintf(out, "static size_t constant_count = %zu;\n", constants.count);
+    fprintf(out, "static LispValue * constants[%zu];\n\n", constants.count + 1);
+    for ( size_t i = 0 ; i < function_count ; i++ ) {
+        Function * function = &functions[i];
+        if ( !function->compiled && !function->called )
+            continue;
+        write_signature(out, function);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n");
+    for ( size_t i = 0 ; i < function_count ; i++ ) {
+        if ( functions[i].compiled )
+            fprintf(out, "%s\n", functions[i].code);
+        else if ( functions[i].called )
+            write_stub(out, &functions[i]);
+    }
+    fprintf(out, "int main(int argc, char ** argv) {\n");
+    fprintf(out, "    aot_init(argc, argv);\n");
+    fprintf(out, "    aot_intern_globals(globals, global_names, %zu);\n", globals.count);
+    fprintf(out, "    aot_read_constants(constants, constant_sources, &constant_count);\n");
+    fprintf(out, "    LispValue * result = NULL;\n");
+    // Consecutive forms left to the interpreter are evaluated together.
+    char * source = NULL;
+    size_t source_size = 0;
+    FILE * source_out = NULL;
+    for ( LispCell * current_cell = program ; current_cell ; current_cell = current_cell->tail ) {
+        Function * function = NULL;
+        for ( size_t i = 0 ; i < function_count && !function ; i++ )
+            if ( functions[i].form == current_cell->head && functions[i].compiled )
+                function = &functions[i];
+        if ( !function ) {
+            if ( !source_out )
+                source_out = open_memstream(&source, &source_size);
+            write_datum(source_out, current_cell->head);
+            fprintf(source_out, "\n");
+            continue;
+        }
+        if ( source_out ) {
+            fclose(source_out);
+            source_out = NULL;
+            fprintf(out, "    result = aot_eval_source(");
+            write_c_string(out, source);
+            fprintf(out, ");\n");
+            free(source);
+        }
+        fprintf(out, "    result = aot_define_compiled(globals[%d], %s_native, %s, %d);\n", function->global, function->c_name, function->c_name, function->arity);
+    }
+    if ( source_out ) {
+        fclose(source_out);
+        fprintf(out, "    result = aot_eval_source(");
+        write_c_string(out, source);
+        fprintf(out, ");\n");
+        free(source);
+    }
+    fprintf(out, "    aot_print_result(result);\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+void compile_file(char * filename, char * output_filename, LispContext * ctx) {
+    compile_ctx = ctx;
+    gc_register_root(&compile_ctx);
+    gc_register_root(&program);
+    gc_register_root(&expansions);
+    read_program(filename);
+    reverse_program();
+    prepare_program();
+    // Promoted, the program's forms won't move while they're compiled.
+    gc_minor_collect();
+    find_functions();
+    for ( size_t i = 0 ; i < function_count ; i++ )
+        compile_function(&functions[i]);
+    write_program(filename, output_filename);
+}
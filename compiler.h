@@ -0,0 +1,14 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "./constructor.h"
+#include "./context.h"
+
+// Translates a program to C to be built with the runtime, by make-compiled.sh.
+// Top-level functions the compiler understands become C functions; every other
+// top-level form is kept as source and evaluated by the interpreter at run time.
+// Macros and functions are defined in the given context while compiling, so that
+// macro calls can be expanded ahead of time.
+void compile_file(char * filename, char * output_filename, LispContext * ctx);
+
+#endif // COMPILER_H
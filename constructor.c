@@ -3,83 +3,281 @@
 #include "./symbols.h"
 #include "./constructor.h"
 
+SymbolTable * GLOBAL_SYM_TABLE;
+
 void init_global_symbol_table(size_t size) {
     GLOBAL_SYM_TABLE = new_symbol_table(size);
 }
 
 LispValue * new_lisp_value(void * value) {
-  LispValue * lisp_val = malloc(sizeof(LispValue));
-  if ( !lisp_val ) {
-    exit_message("Error while allocating new lisp value.", -1);
-  }
+  LispValue * lisp_val = gc_alloc(kGCValue, sizeof(LispValue));
   lisp_val->value = value;
   lisp_val->extra_value = NULL;
   lisp_val->type = kUnknownValue;
-  lisp_val->refs = 0;
   return lisp_val;
 }
 
-#define LispType(name, val_type_enum, return_type, val_type) \
+// Symbols, primitives and booleans live as long as the program and are held in
+// C locals all over the interpreter, so they are allocated old and never move.
+LispValue * new_tenured_lisp_value(void * value) {
+  LispValue * lisp_val = gc_alloc_old(kGCValue, sizeof(LispValue));
+  lisp_val->value = value;
+  lisp_val->extra_value = NULL;
+  lisp_val->type = kUnknownValue;
+  return lisp_val;
+}
+
+#define LispType(name, val_type_enum, return_type, val_type, alloc_value) \
   return_type name (val_type value) { \
-    return_type lisp_value = new_lisp_value(value); \
+    return_type lisp_value = alloc_value(value); \
     lisp_value->type = val_type_enum; \
     return lisp_value; \
   }
 
-LispType(new_lisp_number, kNumberValue, LispNumber *, int)
-LispType(new_lisp_string, kStringValue, LispString *, char *)
-LispType(new_lisp_symbol, kSymbolValue, LispSymbol *, char *)
-LispType(new_lisp_primitive, kPrimitiveValue, LispPrimitive *, PrimitiveFunPtr)
+LispType(new_lisp_symbol, kSymbolValue, LispSymbol *, char *, new_tenured_lisp_value)
+
+LispPrimitive * new_lisp_primitive(PrimitiveFunPtr function, char * name) {
+  LispPrimitive * primitive = new_tenured_lisp_value(function);
+  primitive->name = name;
+  primitive->type = kPrimitiveValue;
+  return primitive;
+}
+
+LispNative * new_lisp_native(NativeFunPtr function, char * name, int arity) {
+  LispNative * native = gc_alloc_old(kGCValue, sizeof(LispNative));
+  native->value = function;
+  native->name = name;
+  native->type = kNativeValue;
+  native->arity = arity;
+  native->compiled = NULL;
+  native->compiled_arity = 0;
+  return native;
+}
+
+// Takes over a malloc'd buffer of the given size holding a string of the given length.
+LispString * new_lisp_string_of_length(char * value, size_t length, size_t capacity) {
+  LispString * str = gc_alloc(kGCValue, sizeof(LispString));
+  str->value = value;
+  str->length = length;
+  str->type = kStringValue;
+  str->capacity = capacity;
+  return str;
+}
+
+// Takes over a malloc'd NUL-terminated string.
+LispString * new_lisp_string(char * value) {
+  size_t length = strlen(value);
+  return new_lisp_string_of_length(value, length, length + 1);
+}
+
+LispStringBuilder * new_lisp_string_builder() {
+  LispStringBuilder * builder = gc_alloc(kGCValue, sizeof(LispStringBuilder));
+  builder->type = kStringBuilderValue;
+  return builder;
+}
+
+LispNumber * new_lisp_number(int value) {
+  return make_fixnum(value);
+}
 
 LispBool * new_lisp_bool(bool value) {
-  LispBool * lisp_value = new_lisp_value((void*)value);
+  LispBool * lisp_value = new_tenured_lisp_value((void*)value);
   lisp_value->type = kBoolValue;
   return lisp_value;
 }
 
+// Returns the unique symbol object for the given name, interning it if necessary.
+LispSymbol * new_interned_symbol(char * name) {
+  return new_interned_symbol_of_length(name, strlen(name));
+}
+
+// The name needn't be NUL-terminated, so a symbol can be interned from the source.
+LispSymbol * new_interned_symbol_of_length(char * name, size_t length) {
+  SymbolTableEntry * entry = insert_symbol_of_length_if_not_found(GLOBAL_SYM_TABLE, name, length);
+  if ( !entry->symbol )
+    entry->symbol = new_lisp_symbol(entry->name);
+  return entry->symbol;
+}
+
 LambdaInfo * new_lambda_info(LispCell * code, LispCell * params) {
-  LambdaInfo * lambda_info = calloc(sizeof(LambdaInfo), 1);
+  size_t roots = gc_save_roots();
+  gc_protect(code);
+  gc_protect(params);
+  LambdaInfo * lambda_info = gc_alloc(kGCLambdaInfo, sizeof(LambdaInfo));
   lambda_info->code = code;
+  lambda_info->source = NULL;
   lambda_info->params = params;
+  lambda_info->bytecode = NULL;
+  lambda_info->resolved = false;
+  lambda_info->stack_frame = false;
+  lambda_info->frame_size = 0;
+  lambda_info->macro_epoch = 0;
+  gc_restore_roots(roots);
   return lambda_info;
 }
 
 LispLambda * new_lisp_lambda(LispCell * code, LispCell * params, struct LispContext * ctx) {
-  LispLambda * lisp_lam = new_lisp_value(new_lambda_info(code, params));
+  size_t roots = gc_save_roots();
+  gc_protect(ctx);
+  LambdaInfo * lambda_info = new_lambda_info(code, params);
+  LispLambda * lisp_lam = new_lisp_closure(lambda_info, ctx);
+  gc_restore_roots(roots);
+  return lisp_lam;
+}
+
+// Creates a lambda sharing the given code and parameters, closed over the context.
+LispLambda * new_lisp_closure(LambdaInfo * lambda_info, struct LispContext * ctx) {
+  size_t roots = gc_save_roots();
+  gc_protect(lambda_info);
+  gc_protect(ctx);
+  LispLambda * lisp_lam = new_lisp_value(NULL);
   lisp_lam->type = kLambdaValue;
+  lisp_lam->value = lambda_info;
   lisp_lam->ctx = ctx;
+  gc_restore_roots(roots);
   return lisp_lam;
 }
 
 MacroInfo * new_macro_info(LispCell * template, LispCell * params) {
-  MacroInfo * macro_info = calloc(sizeof(MacroInfo), 1);
+  size_t roots = gc_save_roots();
+  gc_protect(template);
+  gc_protect(params);
+  MacroInfo * macro_info = gc_alloc(kGCMacroInfo, sizeof(MacroInfo));
   macro_info->template = template;
   macro_info->params = params;
+  gc_restore_roots(roots);
   return macro_info;
 }
 
 LispMacro * new_lisp_macro(LispCell * template, LispCell * params, struct LispContext * ctx) {
-  LispMacro * lisp_mac = new_lisp_value(new_macro_info(template, params));
+  size_t roots = gc_save_roots();
+  gc_protect(ctx);
+  MacroInfo * macro_info = new_macro_info(template, params);
+  gc_protect(macro_info);
+  LispMacro * lisp_mac = new_lisp_value(NULL);
   lisp_mac->type = kMacroValue;
+  lisp_mac->value = macro_info;
   lisp_mac->ctx = ctx;
+  gc_restore_roots(roots);
   return lisp_mac;
 }
 
 LispCell * new_lisp_cell(LispValue * head, LispValue * tail) {
-  LispCell * lisp_cell = new_lisp_value(head);
-  lisp_cell->type = kCellValue;
+  size_t roots = gc_save_roots();
+  gc_protect(head);
+  gc_protect(tail);
+  LispCell * lisp_cell = gc_alloc_pair();
+  lisp_cell->head = head;
   lisp_cell->tail = tail;
+  gc_restore_roots(roots);
   return lisp_cell;
 }
 
+// Vector elements are stored inline, directly after the vector object itself.
 LispVector * new_lisp_vector(size_t length) {
-  LispVector * lisp_vec = new_lisp_value(NULL);
-  lisp_vec->value = calloc(sizeof(LispValue), length);
+  LispVector * lisp_vec = gc_alloc(kGCValue, sizeof(LispVector) + sizeof(LispValue *) * length);
+  lisp_vec->value = (LispValue **)(lisp_vec + 1);
   lisp_vec->length = length;
   lisp_vec->type = kVectorValue;
   return lisp_vec;
 }
 
+// The elements start out as zeros.
+LispTypedVector * new_lisp_typed_vector(TypedVectorKind kind, size_t length) {
+  size_t size = typed_vector_element_size(kind) * length;
+  LispTypedVector * vec = gc_alloc(kGCValue, sizeof(LispTypedVector) + size);
+  vec->value = vec + 1;
+  vec->length = length;
+  vec->type = kTypedVectorValue;
+  vec->kind = kind;
+  memset(vec->value, 0, size);
+  return vec;
+}
+
+LispHashEntries * new_hash_entries(size_t capacity) {
+  LispHashEntries * entries = gc_alloc(kGCHashEntries, sizeof(LispHashEntries) + sizeof(LispHashEntry) * capacity);
+  entries->capacity = capacity;
+  for ( size_t i = 0 ; i < capacity ; i++ )
+    entries->items[i].key = HASH_EMPTY_KEY;
+  return entries;
+}
+
+LispHashTable * new_lisp_hash_table(HashTableKind kind) {
+  size_t roots = gc_save_roots();
+  LispHashEntries * entries = new_hash_entries(HASH_TABLE_INITIAL_CAPACITY);
+  gc_protect(entries);
+  LispHashTable * table = gc_alloc(kGCValue, sizeof(LispHashTable));
+  table->entries = entries;
+  table->type = kHashTableValue;
+  table->kind = kind;
+  gc_restore_roots(roots);
+  return table;
+}
+
+LispLexicalRef * new_lisp_lexical_ref(LispSymbol * symbol, unsigned int depth, unsigned int slot) {
+  LispLexicalRef * ref = new_lisp_value(symbol);
+  ref->type = kLexicalRefValue;
+  ref->depth = depth;
+  ref->slot = slot;
+  return ref;
+}
+
+LispGlobalRef * new_lisp_global_ref(LispSymbol * symbol) {
+  LispGlobalRef * ref = new_lisp_value(symbol);
+  ref->type = kGlobalRefValue;
+  return ref;
+}
+
+LispConstant * new_lisp_constant(LispValue * value) {
+  size_t roots = gc_save_roots();
+  gc_protect(value);
+  LispConstant * constant = new_lisp_value(NULL);
+  constant->value = value;
+  constant->type = kConstantValue;
+  gc_restore_roots(roots);
+  return constant;
+}
+
+LispIfNode * new_lisp_if_node(LispValue * test, LispValue * consequent, LispValue * alternative) {
+  size_t roots = gc_save_roots();
+  gc_protect(test);
+  gc_protect(consequent);
+  gc_protect(alternative);
+  LispIfNode * node = gc_alloc(kGCValue, sizeof(LispIfNode));
+  node->test = test;
+  node->consequent = consequent;
+  node->alternative = alternative;
+  node->type = kIfNodeValue;
+  gc_restore_roots(roots);
+  return node;
+}
+
+LispLambdaNode * new_lisp_lambda_node(LispCell * code, LispCell * params) {
+  LambdaInfo * lambda_info = new_lambda_info(code, params);
+  size_t roots = gc_save_roots();
+  gc_protect(lambda_info);
+  LispLambdaNode * node = new_lisp_value(NULL);
+  node->info = lambda_info;
+  node->type = kLambdaNodeValue;
+  gc_restore_roots(roots);
+  return node;
+}
+
+LispCallNode * new_lisp_call_node(LispValue * head, LispCell * args) {
+  size_t roots = gc_save_roots();
+  gc_protect(head);
+  gc_protect(args);
+  LispCallNode * node = gc_alloc(kGCValue, sizeof(LispCallNode));
+  node->head = head;
+  node->args = args;
+  node->type = kCallNodeValue;
+  node->argc = 0;
+  for ( LispCell * arg = node->args ; arg ; arg = arg->tail )
+    node->argc++;
+  gc_restore_roots(roots);
+  return node;
+}
+
 // Returns true if the token is a left paren, bracket, or brace.
 bool is_opener(Token * token) {
   switch (token->type) {
@@ -120,30 +318,49 @@ bool is_modifier_token(Token * token) {
 // Sets the passed cell's head to the given head value, then returns a new cell
 // after setting the old cell's tail to it.
 LispCell * extend_cell(LispCell * current_cell, LispValue * head) {
-  current_cell->head = head;
+  size_t roots = gc_save_roots();
+  gc_protect(current_cell);
+  gc_protect(head);
   LispCell * new_cell = new_lisp_cell(NULL, NULL);
+  current_cell->head = head;
   current_cell->tail = new_cell;
+  gc_write_barrier(current_cell, head);
+  gc_write_barrier(current_cell, new_cell);
+  gc_restore_roots(roots);
   return new_cell;
 }
 
 bool boolify_value(LispValue * value) {
   if ( !value )
     return false;
-  if ( value->type == kBoolValue && value->value == false )
+  if ( value_type(value) == kBoolValue && value->value == false )
     return false;
   return true;
 }
 
-LispValue * token_to_value(Token * token) {
+// Numbers and symbols are read straight from the source. Only a string is copied,
+// into the buffer the string object owns.
+LispValue * token_to_value(TokenList * token_list, Token * token) {
+  char * text = token_text(token_list, token);
   switch (token->type) {
-    case kNumber:
-    return new_lisp_number(atoi(token->value));
-    case kString:
-    return new_lisp_string(token->value);
+    case kNumber: {
+    int number = 0;
+    for ( size_t i = 0 ; i < token->length ; i++ )
+      number = number * 10 + (text[i] - '0');
+    return new_lisp_number(number);
+    }
+    case kString: {
+    char * value = malloc(token->length + 1);
+    if ( !value )
+      exit_message("Error while allocating memory for string.", -1);
+    memcpy(value, text, token->length);
+    value[token->length] = 0;
+    return new_lisp_string_of_length(value, token->length, token->length + 1);
+    }
     case kIdentifier:
-    return new_lisp_symbol(insert_symbol_if_not_found(GLOBAL_SYM_TABLE, token->value)->name);
+    return new_interned_symbol_of_length(text, token->length);
     default:
-    printf("ERROR: Unknown token with type %d and value '%s'\n", token->type, token->value);
+    printf("ERROR: Unknown token with type %d and value '%.*s'\n", token->type, (int)token->length, text);
     exit(-1);
   }
 }
@@ -169,48 +386,56 @@ LispValue ** cells_to_array(LispCell * cells) {
   return val_array;
 }
 
-LispCell * construct_list(TokenList * token_list, Token *** current_token);
+LispCell * construct_list(TokenList * token_list, Token ** current_token);
 
-LispValue const * END_OF_LIST = -1;
+// Returned by construct_next_token at a closing paren. It is neither a tagged
+// number nor an aligned pointer, so it can't be mistaken for a value.
+LispValue * const END_OF_LIST = (LispValue *)0x2;
+
+// Wraps the value in a two element list headed by the given symbol, e.g. (quote value).
+LispCell * symbol_wrap(char * symbol_name, LispValue * value) {
+  size_t roots = gc_save_roots();
+  gc_protect(value);
+  LispSymbol * symbol = new_interned_symbol(symbol_name);
+  LispCell * wrapped = new_lisp_cell(symbol, new_lisp_cell(value, NULL));
+  gc_restore_roots(roots);
+  return wrapped;
+}
 
 LispCell * quoteify(LispValue * value) {
-  LispSymbol * quote_symbol = new_lisp_symbol(find_symbol(GLOBAL_SYM_TABLE, "quote")->name);
-  return new_lisp_cell(quote_symbol, new_lisp_cell(value, NULL));
+  return symbol_wrap("quote", value);
 }
 
 LispCell * quasiquoteify(LispValue * value) {
-  LispSymbol * qquote_symbol = new_lisp_symbol(find_symbol(GLOBAL_SYM_TABLE, "quasiquote")->name);
-  return new_lisp_cell(qquote_symbol, new_lisp_cell(value, NULL));
+  return symbol_wrap("quasiquote", value);
 }
 
 LispCell * unquoteify(LispValue * value) {
-  LispSymbol * unquote_symbol = new_lisp_symbol(insert_symbol_if_not_found(GLOBAL_SYM_TABLE, "unquote")->name);
-  return new_lisp_cell(unquote_symbol, new_lisp_cell(value, NULL));
+  return symbol_wrap("unquote", value);
 }
 
 LispCell * flatten_unquoteify(LispValue * value ) {
-  LispSymbol * flatten_symbol = new_lisp_symbol(insert_symbol_if_not_found(GLOBAL_SYM_TABLE, "unquote-flatten")->name);
-  return new_lisp_cell(flatten_symbol, new_lisp_cell(value, NULL));
+  return symbol_wrap("unquote-flatten", value);
 }
 
-LispValue * construct_next_token(TokenList * token_list, Token *** current_token);
+LispValue * construct_next_token(TokenList * token_list, Token ** current_token);
 
-LispValue * construct_modifier_token(TokenList * token_list, Token *** current_token) {
-  if ( (**current_token)->type == kSingleQuote ) {
+LispValue * construct_modifier_token(TokenList * token_list, Token ** current_token) {
+  if ( (*current_token)->type == kSingleQuote ) {
     (*current_token)++;
     LispValue * next_value = construct_next_token(token_list, current_token);
     if ( next_value == END_OF_LIST )
       exit_message("Expecting value following quote.", -1);
     return quoteify(next_value);
-  } else if ( (**current_token)->type == kBacktick ) {
+  } else if ( (*current_token)->type == kBacktick ) {
     (*current_token)++;
     LispValue * next_value = construct_next_token(token_list, current_token);
     if ( next_value == END_OF_LIST )
       exit_message("Expecting value following quasiquote.", -1);
     return quasiquoteify(next_value);
-  } else if ( (**current_token)->type == kComma ) {
+  } else if ( (*current_token)->type == kComma ) {
     (*current_token)++;
-    if ( (**current_token)->type == kAtSign ) {
+    if ( (*current_token)->type == kAtSign ) {
       (*current_token)++;
       LispValue * next_value = construct_next_token(token_list, current_token);
       if ( next_value == END_OF_LIST )
@@ -221,45 +446,54 @@ LispValue * construct_modifier_token(TokenList * token_list, Token *** current_t
     if ( next_value == END_OF_LIST )
       exit_message("Expecting value following unquote.", -1);
     return unquoteify(next_value);
-  } else if ( (**current_token)->type == kHash ) {
+  } else if ( (*current_token)->type == kHash ) {
     exit_message("Vector literals are unimplemented.", -1);
   }
 }
 
-LispValue * construct_next_token(TokenList * token_list, Token *** current_token) {
-  if ( is_atomic_token(**current_token) ) {
+LispValue * construct_next_token(TokenList * token_list, Token ** current_token) {
+  if ( is_atomic_token(*current_token) ) {
     (*current_token)++;
-    return token_to_value(*((*current_token)-1));
-  } else if ( is_modifier_token(**current_token)) {
+    return token_to_value(token_list, (*current_token) - 1);
+  } else if ( is_modifier_token(*current_token)) {
     return construct_modifier_token(token_list, current_token);
-  } else if ( is_opener(**current_token) ) {
+  } else if ( is_opener(*current_token) ) {
     (*current_token)++;
     return construct_list(token_list, current_token);
-  } else if ( is_closer(**current_token) ) {
+  } else if ( is_closer(*current_token) ) {
     (*current_token)++;
     return END_OF_LIST;
   } else {
     printf("ERROR: ");
-    print_token(**current_token);
+    print_token(token_list, *current_token);
     return NULL;
   }
 }
 
-LispCell * construct_list(TokenList * token_list, Token *** current_token) {
+LispCell * construct_list(TokenList * token_list, Token ** current_token) {
+  size_t roots = gc_save_roots();
   LispCell * list_root = new_lisp_cell(NULL, NULL);
   LispCell * current_cell = list_root;
   LispCell * last_cell = NULL;
-  if ( (**current_token)->type == kPeriod )
+  LispValue * next_value = NULL;
+  gc_protect(list_root);
+  gc_protect(current_cell);
+  gc_protect(last_cell);
+  gc_protect(next_value);
+  if ( (*current_token)->type == kPeriod )
     exit_message("Dotted list must have car value.", -1);
-  LispValue * next_value = construct_next_token(token_list, current_token);
+  next_value = construct_next_token(token_list, current_token);
   while ( next_value != END_OF_LIST ) {
-    if ( (**current_token)->type == kPeriod ) {
+    if ( (*current_token)->type == kPeriod ) {
       (*current_token)++;
       LispValue * tail_value = construct_next_token(token_list, current_token);
       current_cell->head = next_value;
       current_cell->tail = tail_value;
+      gc_write_barrier(current_cell, next_value);
+      gc_write_barrier(current_cell, tail_value);
       if ( construct_next_token(token_list, current_token) != END_OF_LIST )
         exit_message("Dotted list can't have more than one cdr value.", -1);
+      gc_restore_roots(roots);
       return list_root;
     }
     last_cell = current_cell;
@@ -268,14 +502,19 @@ LispCell * construct_list(TokenList * token_list, Token *** current_token) {
   }
   if ( last_cell )
     last_cell->tail = NULL;
+  gc_restore_roots(roots);
   return list_root;
 }
 
-LispCell * construct_ast(TokenList * token_list, Token *** current_token) {
+LispCell * construct_ast(TokenList * token_list, Token ** current_token) {
+  size_t roots = gc_save_roots();
   LispCell * root_cell = new_lisp_cell(NULL, NULL);
   LispCell * current_cell = root_cell;
   LispCell * last_cell = NULL;
-  Token ** stack_token_ptr = token_list->tokens;
+  gc_protect(root_cell);
+  gc_protect(current_cell);
+  gc_protect(last_cell);
+  Token * stack_token_ptr = token_list->tokens;
   if (!current_token) // use stack allocated token ptr if none is passed
     current_token = &stack_token_ptr;
   while (*current_token < (token_list->current) ) {
@@ -285,17 +524,54 @@ LispCell * construct_ast(TokenList * token_list, Token *** current_token) {
   }
   if ( last_cell )
     last_cell->tail = NULL;
+  gc_restore_roots(roots);
   return root_cell;
 }
 
+// Reads the next top-level form of the reader. Returns false at the end of the input.
+bool construct_next_form(Reader * reader, LispValue ** form) {
+  if ( !tokenize_next_datum(reader) )
+    return false;
+  Token * current_token = reader->tokens->tokens;
+  *form = construct_next_token(reader->tokens, &current_token);
+  if ( *form == END_OF_LIST )
+    exit_message("Unexpected closing paren at top level.", -1);
+  return true;
+}
+
+// Reads all the forms of a file into a list.
+LispCell * construct_file_ast(char * filename) {
+  size_t roots = gc_save_roots();
+  Reader * reader = open_reader(filename);
+  LispCell * forms = NULL;
+  LispCell * last_cell = NULL;
+  LispValue * form = NULL;
+  gc_protect(forms);
+  gc_protect(last_cell);
+  gc_protect(form);
+  while ( construct_next_form(reader, &form) ) {
+    LispCell * cell = new_lisp_cell(form, NULL);
+    if ( last_cell ) {
+      last_cell->tail = cell;
+      gc_write_barrier(last_cell, cell);
+    } else {
+      forms = cell;
+    }
+    last_cell = cell;
+  }
+  close_reader(reader);
+  gc_restore_roots(roots);
+  return forms;
+}
+
 void print_value(LispValue * value) {
   if (!value) {
     printf("() ");
     return;
   }
-  switch(value->type) {
+  switch(value_type(value)) {
     case kNumberValue:
-    printf("%d", value->value);
+    printf("%d", fixnum_value(value));
     break;
     case kStringValue:
     printf("%s", value->value);
@@ -303,18 +579,64 @@ void print_value(LispValue * value) {
     case kSymbolValue:
     printf("%s", value->value);
     break;
+    case kLexicalRefValue:
+    printf("%s", ((LispLexicalRef *)value)->symbol->value);
+    break;
+    case kGlobalRefValue:
+    printf("%s", ((LispGlobalRef *)value)->symbol->value);
+    break;
+    case kConstantValue:
+    printf("'");
+    print_value(((LispConstant *)value)->value);
+    break;
+    case kIfNodeValue:
+    printf("(if ");
+    print_value(((LispIfNode *)value)->test);
+    print_value(((LispIfNode *)value)->consequent);
+    print_value(((LispIfNode *)value)->alternative);
+    printf(")");
+    break;
+    case kLambdaNodeValue:
+    printf("(lambda ");
+    print_value(((LispLambdaNode *)value)->info->params);
+    for ( LispCell * form = ((LispLambdaNode *)value)->info->code ; form ; form = form->tail )
+      print_value(form->head);
+    printf(")");
+    break;
+    case kCallNodeValue:
+    printf("(");
+    print_value(((LispCallNode *)value)->head);
+    for ( LispCell * arg = ((LispCallNode *)value)->args ; arg ; arg = arg->tail )
+      print_value(arg->head);
+    printf(")");
+    break;
     case kLambdaValue:
     printf("<LAMBDA 0x%x>", value->value);
     break;
     case kPrimitiveValue:
     printf("<PRIMITIVE 0x%x>", value->value);
     break;
+    case kNativeValue:
+    printf("<PRIMITIVE %s>", ((LispNative *)value)->name);
+    break;
     case kBoolValue:
     value->value ? printf("true") : printf("false");
     break;
+    case kHashTableValue:
+    printf("<HASH-TABLE count=%zu>", ((LispHashTable *)value)->count);
+    break;
+    case kTypedVectorValue: {
+    static char * kind_names[] = { "U8VECTOR", "S32VECTOR", "S64VECTOR" };
+    LispTypedVector * vec = value;
+    printf("<%s length=%zu>", kind_names[vec->kind], vec->length);
+    break;
+    }
+    case kStringBuilderValue:
+    printf("<STRING-BUILDER length=%zu>", ((LispStringBuilder *)value)->length);
+    break;
     default:
     case kUnknownValue:
-    printf("<UNKNOWN type=%d>", value->type);
+    printf("<UNKNOWN type=%d>", value_type(value));
     break;
     case kCellValue:
     print_cell(value);
@@ -329,23 +651,23 @@ void print_value_raw(LispValue * value) {
     return;
   }
   printf("<");
-  if ( value->type == kCellValue ) {
+  if ( value_type(value) == kCellValue ) {
     print_cell_raw(value);
   } else {
     print_value(value);
   }
-  printf(" | type=%d addr=0x%x>", value->type, value);
+  printf(" | type=%d addr=0x%x>", value_type(value), value);
 }
 
 void print_cell(LispCell * list) {
-  if (!list || list->type != kCellValue)
+  if (!list || value_type(list) != kCellValue)
     return;
   LispCell * current_cell = list;
   printf("(");
   while ( current_cell ) {
     print_value(current_cell->head);
     current_cell = current_cell->tail;
-    if ( current_cell && current_cell->type != kCellValue ) {
+    if ( current_cell && value_type(current_cell) != kCellValue ) {
       printf(". ");
       print_value(current_cell);
       break;
@@ -355,7 +677,7 @@ void print_cell(LispCell * list) {
 }
 
 void print_cell_raw(LispCell * list) {
-  if (!list || list->type != kCellValue)
+  if (!list || value_type(list) != kCellValue)
     return;
   LispCell * current_cell = list;
   while ( current_cell ) {
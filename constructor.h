@@ -3,25 +3,36 @@
 
 #include "./tokenizer.h"
 #include "./symbols.h"
+#include "./gc.h"
+#include <stdint.h>
 
 typedef enum ValueType {
   kUnknownValue,
   kNumberValue,
   kStringValue,
+  kStringBuilderValue,
   kSymbolValue,
   kCellValue,
   kLambdaValue,
   kPrimitiveValue,
   kMacroValue,
   kBoolValue,
-  kVectorValue
+  kVectorValue,
+  kTypedVectorValue,
+  kHashTableValue,
+  kLexicalRefValue,
+  kGlobalRefValue,
+  kConstantValue,
+  kIfNodeValue,
+  kLambdaNodeValue,
+  kCallNodeValue,
+  kNativeValue
 } ValueType;
 
 typedef struct LispValue {
   void * value;
   void * extra_value;
   ValueType type;
-  unsigned int refs;
 } LispValue;
 
 #define LispTypeStruct(name, value_type, value_name, extra_type, extra_name) \
@@ -29,38 +40,237 @@ typedef struct LispValue {
     value_type value_name; \
     extra_type extra_name; \
     ValueType type; \
-    unsigned int refs; \
   } name ;
 
-LispTypeStruct(LispCell, LispValue *, head, LispValue *, tail)
-LispTypeStruct(LispNumber, int, value, void *, unused)
-LispTypeStruct(LispString, char *, value, void *, unused)
+// Pairs are just two words. They have no type field; value_type recognizes them
+// by their address in the pair space instead. The head and tail line up with
+// value and extra_value of LispValue.
+typedef struct LispCell {
+  LispValue * head;
+  LispValue * tail;
+} LispCell;
+
+// A string owns its malloc'd buffer, which holds the characters followed by a NUL.
+// The length doesn't count the NUL; the capacity is the size of the buffer.
+typedef struct LispString {
+  char * value;
+  size_t length;
+  ValueType type;
+  size_t capacity;
+} LispString;
+
+// A string being built up. Appending doubles the buffer when it runs out, and
+// freezing the builder hands its buffer over to a string without copying it,
+// leaving the builder empty.
+typedef struct LispStringBuilder {
+  char * value;
+  size_t length;
+  ValueType type;
+  size_t capacity;
+} LispStringBuilder;
+
 LispTypeStruct(LispSymbol, char *, value, void *, unused)
 LispTypeStruct(LispBool, bool, value, void *, unused)
-LispTypeStruct(LispVector, LispValue *, value, size_t, length)
+LispTypeStruct(LispVector, LispValue **, value, size_t, length)
+
+// The element type of a typed vector.
+typedef enum TypedVectorKind {
+  kU8Vector,
+  kS32Vector,
+  kS64Vector
+} TypedVectorKind;
+
+// A vector of unboxed integers of one type, stored right after the header like the
+// elements of a vector. Value points at them, so it must be fixed up when the vector
+// is moved.
+typedef struct LispTypedVector {
+  void * value;
+  size_t length;
+  ValueType type;
+  TypedVectorKind kind;
+} LispTypedVector;
+
+static inline size_t typed_vector_element_size(TypedVectorKind kind) {
+  switch ( kind ) {
+    case kU8Vector:
+      return sizeof(uint8_t);
+    case kS32Vector:
+      return sizeof(int32_t);
+    default:
+      return sizeof(int64_t);
+  }
+}
+
+// How a hash table compares its keys: like eq?, eqv? or equal?.
+typedef enum HashTableKind {
+  kHashEq,
+  kHashEqv,
+  kHashEqual
+} HashTableKind;
+
+typedef struct LispHashEntry {
+  LispValue * key;
+  LispValue * value;
+} LispHashEntry;
+
+// Keys of the slots of a hash table that hold no entry. Neither is a value, and the
+// collector skips them for not being aligned.
+#define HASH_EMPTY_KEY ((LispValue *)0x4)
+#define HASH_DELETED_KEY ((LispValue *)0xc)
+
+#define HASH_TABLE_INITIAL_CAPACITY 8
+
+// The slots of a hash table, replaced by a new array when the table grows. The
+// capacity is a power of two.
+typedef struct LispHashEntries {
+  size_t capacity;
+  LispHashEntry items[];
+} LispHashEntries;
+
+// A hash table with open addressing. Used counts the slots that held an entry at
+// some point, removed ones included. Keys hashed by address move when a minor
+// collection promotes them, so a table that was given such a key while it was
+// young records the collection count at the time, and is rehashed before it is
+// used after the next one.
+typedef struct LispHashTable {
+  LispHashEntries * entries;
+  size_t count;
+  ValueType type;
+  HashTableKind kind;
+  size_t used;
+  size_t young_keys_epoch;
+  bool young_keys;
+} LispHashTable;
+
+// A variable reference in a resolved lambda body, addressed by how many frames up
+// the chain its binding lives and at which slot. The symbol is kept so that the
+// reference can still be looked up by name if that slot holds something else.
+typedef struct LispLexicalRef {
+  LispSymbol * symbol;
+  unsigned int depth;
+  unsigned int slot;
+  ValueType type;
+} LispLexicalRef;
+
+// A reference to a global in a resolved lambda body. Its value is read straight
+// from the symbol's value cell.
+LispTypeStruct(LispGlobalRef, LispSymbol *, symbol, void *, unused)
+
+// A quoted datum in a resolved lambda body. Evaluates to the datum.
+LispTypeStruct(LispConstant, LispValue *, value, void *, unused)
+
+// An IF in a resolved lambda body. The type has to stay in the third word, where
+// value_type looks for it, so the alternative comes after it.
+typedef struct LispIfNode {
+  LispValue * test;
+  LispValue * consequent;
+  ValueType type;
+  LispValue * alternative;
+} LispIfNode;
+
+// A call in a resolved lambda body whose head isn't a special form the resolver
+// compiles. The head and arguments are resolved, and evaluated like those of a list.
+// The number of arguments comes after the type, like an IF node's alternative.
+typedef struct LispCallNode {
+  LispValue * head;
+  LispCell * args;
+  ValueType type;
+  unsigned int argc;
+} LispCallNode;
+
+// Numbers are never allocated: the integer is stored directly in the value
+// pointer, shifted left by one and tagged with a set low bit. Heap objects are
+// always at least 8-byte aligned, so the tag can't collide with them. LispNumber
+// is deliberately left incomplete so a tagged number can't be dereferenced.
+typedef struct LispNumber LispNumber;
+
+#define FIXNUM_TAG 1
+#define is_fixnum(value) (((intptr_t)(value)) & FIXNUM_TAG)
+#define make_fixnum(number) ((LispValue *)(((uintptr_t)(intptr_t)(number) << 1) | FIXNUM_TAG))
+#define fixnum_value(value) ((int)(((intptr_t)(value)) >> 1))
+
+// Returns the type of any value, including tagged numbers. The empty list has
+// no type of its own and reports kUnknownValue.
+static inline ValueType value_type(LispValue * value) {
+  if ( is_fixnum(value) )
+    return kNumberValue;
+  if ( !value )
+    return kUnknownValue;
+  if ( gc_is_pair(value) )
+    return kCellValue;
+  return value->type;
+}
 
 struct LispContext;
 
 typedef LispValue *(*PrimitiveFunPtr)(LispCell *, struct LispContext *);
-LispTypeStruct(LispPrimitive, PrimitiveFunPtr, value, void *, unused);
+LispTypeStruct(LispPrimitive, PrimitiveFunPtr, value, char *, name);
+
+// A primitive that takes its arguments evaluated, in an array, rather than as forms:
+// every primitive but the special forms. Like any C code, a native that allocates
+// must protect the arguments it still needs afterwards. The arity is the number of
+// arguments it must be called with, or -1 for any number. A native standing for a
+// function of a compiled program also holds the C function that compiled calls with
+// compiled_arity arguments go to directly; compiled is NULL for any other.
+typedef LispValue *(*NativeFunPtr)(LispValue ** argv, size_t argc);
+
+typedef struct LispNative {
+  NativeFunPtr value;
+  char * name;
+  ValueType type;
+  int arity;
+  LispValue *(*compiled)(LispValue ** argv);
+  size_t compiled_arity;
+} LispNative;
 
 LispCell * new_lisp_cell(LispValue * head, LispValue * tail);
 LispNumber * new_lisp_number(int value);
 LispString * new_lisp_string(char * value);
+LispString * new_lisp_string_of_length(char * value, size_t length, size_t capacity);
+LispStringBuilder * new_lisp_string_builder();
 LispSymbol * new_lisp_symbol(char * value);
-LispPrimitive * new_lisp_primitive(PrimitiveFunPtr value);
+LispSymbol * new_interned_symbol(char * name);
+LispSymbol * new_interned_symbol_of_length(char * name, size_t length);
+LispPrimitive * new_lisp_primitive(PrimitiveFunPtr function, char * name);
+LispNative * new_lisp_native(NativeFunPtr function, char * name, int arity);
 LispBool * new_lisp_bool(bool value);
 LispVector * new_lisp_vector(size_t length);
+LispTypedVector * new_lisp_typed_vector(TypedVectorKind kind, size_t length);
+LispHashEntries * new_hash_entries(size_t capacity);
+LispHashTable * new_lisp_hash_table(HashTableKind kind);
+LispLexicalRef * new_lisp_lexical_ref(LispSymbol * symbol, unsigned int depth, unsigned int slot);
+LispGlobalRef * new_lisp_global_ref(LispSymbol * symbol);
+LispConstant * new_lisp_constant(LispValue * value);
+LispIfNode * new_lisp_if_node(LispValue * test, LispValue * consequent, LispValue * alternative);
+LispCallNode * new_lisp_call_node(LispValue * head, LispCell * args);
 
+struct LispBytecode;
+
+// Once a lambda has been called, code holds its resolved body, with macro calls
+// expanded, and bytecode its compiled body if the VM is enabled and the body could
+// be compiled. If a macro call was expanded, source keeps the body as written, to
+// resolve again when a macro is redefined.
 typedef struct LambdaInfo {
   LispCell * code;
+  LispCell * source;
   LispCell * params;
+  struct LispBytecode * bytecode;
+  bool resolved;
+  bool stack_frame;
+  unsigned int frame_size;
+  size_t macro_epoch;
 } LambdaInfo;
 
 struct LispContext;
 
 LispTypeStruct(LispLambda, LambdaInfo *, value, struct LispContext *, ctx)
 LispLambda * new_lisp_lambda(LispCell * code, LispCell * params, struct LispContext * ctx);
+LispLambda * new_lisp_closure(LambdaInfo * lambda_info, struct LispContext * ctx);
+
+// A LAMBDA in a resolved lambda body. Every closure it creates shares the one
+// LambdaInfo, so the body is resolved once rather than once per closure.
+LispTypeStruct(LispLambdaNode, LambdaInfo *, info, void *, unused)
+LispLambdaNode * new_lisp_lambda_node(LispCell * code, LispCell * params);
 
 typedef struct MacroInfo {
   LispCell * template;
@@ -74,13 +284,15 @@ void print_value(LispValue * value);
 void print_value_raw(LispValue * value);
 void print_cell(LispCell * list);
 void print_cell_raw(LispCell * list);
-LispCell * construct_ast(TokenList * token_list, Token *** current_token);
+LispCell * construct_ast(TokenList * token_list, Token ** current_token);
+LispCell * construct_file_ast(char * filename);
+bool construct_next_form(Reader * reader, LispValue ** form);
 LispCell * extend_cell(LispCell * cell, LispValue * head);
 bool boolify_value(LispValue * value);
 size_t cells_length(LispCell * cells);
 LispValue ** cells_to_array(LispCell * cells);
 
-SymbolTable * GLOBAL_SYM_TABLE;
+extern SymbolTable * GLOBAL_SYM_TABLE;
 void init_global_symbol_table(size_t size);
 
 #endif // CONSTRUCTOR_H
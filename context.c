@@ -1,121 +1,169 @@
+#include <string.h>
 #include "./constructor.h"
 #include "./symbols.h"
 #include "./context.h"
 
-LispContext * new_context() {
-    LispContext * ctx = calloc(sizeof(LispContext), 1);
+#define DEFAULT_CONTEXT_CAPACITY 4
+
+static void init_context(LispContext * ctx, size_t capacity) {
     ctx->entries = NULL;
-    ctx->last_entry = NULL;
     ctx->next = NULL;
     ctx->parent_lambda = NULL;
-    ctx->tco_buf = NULL;
+    ctx->count = 0;
+    ctx->capacity = capacity;
+}
+
+LispContext * new_context() {
+    return new_sized_context(0);
+}
+
+// Creates a context with room for the given number of bindings before it has to grow.
+LispContext * new_sized_context(size_t capacity) {
+    LispContext * ctx = gc_alloc(kGCContext, sizeof(LispContext) + sizeof(LispContextEntry) * capacity);
+    init_context(ctx, capacity);
     return ctx;
 }
 
-// Creates a new context object and chains it to the given context object. Returns the new context object.
-LispContext * extend_context(LispContext * ctx, LispLambda * lam) {
-    LispContext * new_ctx = new_context();
-    new_ctx->next = ctx;
-    new_ctx->parent_lambda = lam;
-    return new_ctx;
+// Creates a context on the frame stack, for a call whose frame can't be captured. The
+// caller pops it with gc_pop_frames when the call returns. Returns NULL if the frame
+// stack is full.
+LispContext * new_stack_context(size_t capacity) {
+    LispContext * ctx = gc_push_frame(kGCContext, sizeof(LispContext) + sizeof(LispContextEntry) * capacity);
+    if ( ctx )
+        init_context(ctx, capacity);
+    return ctx;
 }
 
-LispContextEntry * find_last_context_entry(LispContext * ctx) {
-    LispContextEntry * current_entry = ctx->entries;
-    while ( current_entry && current_entry->next ) {
-        current_entry = current_entry->next;
-    }
-    return current_entry;
-}
-
-LispContextEntry * copy_context_entries(LispContextEntry * entries) {
-    LispContextEntry * current_entry = entries;
-    LispContextEntry * current_new_entry = NULL;
-    LispContextEntry * new_root_entry = NULL;
-    while ( current_entry ) {
-        if ( current_new_entry ) {
-            current_new_entry->next = new_context_entry(current_entry->interned_name, current_entry->value, NULL);
-            current_new_entry = current_new_entry->next;
-        } else {
-            current_new_entry = new_context_entry(current_entry->interned_name, current_entry->value, NULL);
-            new_root_entry = current_new_entry;
-        }
-        current_entry = current_entry->next;
+// Returns true if the context or any context it is chained to lives on the frame stack.
+bool context_on_frame_stack(LispContext * ctx) {
+    for ( ; ctx ; ctx = ctx->next ) {
+        if ( gc_is_stack_frame(ctx) )
+            return true;
     }
-    return new_root_entry;
+    return false;
+}
+
+static LispContextEntries * new_context_entries(size_t capacity) {
+    LispContextEntries * entries = gc_alloc(kGCContextEntries, sizeof(LispContextEntries) + sizeof(LispContextEntry) * capacity);
+    entries->capacity = capacity;
+    return entries;
 }
 
-LispContext * copy_context(LispContext * ctx) {
+// Creates a new context object and chains it to the given context object. Returns the new context object.
+LispContext * extend_context(LispContext * ctx, LispLambda * lam) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    gc_protect(lam);
     LispContext * new_ctx = new_context();
-    new_ctx->entries = copy_context_entries(ctx->entries);
-    new_ctx->last_entry = find_last_context_entry(new_ctx);
+    new_ctx->next = ctx;
+    new_ctx->parent_lambda = lam;
+    gc_restore_roots(roots);
     return new_ctx;
 }
 
-// Creates a new context entry object with the given interned symbol and value.
-LispContextEntry * new_context_entry(char * interned_name, LispValue * value, LispContextEntry * next) {
-    LispContextEntry * new_entry = calloc(sizeof(LispContextEntry), 1);
-    new_entry->interned_name = interned_name;
-    new_entry->value = value;
-    new_entry->next = next;
-    return new_entry;
+// Moves the context's bindings into an entries array twice the size of the slots
+// they are in now. Slot indices are unchanged.
+static void grow_context_entries(LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    size_t capacity = context_capacity(ctx) ? context_capacity(ctx) * 2 : DEFAULT_CONTEXT_CAPACITY;
+    LispContextEntries * new_entries = new_context_entries(capacity);
+    memcpy(new_entries->items, context_items(ctx), sizeof(LispContextEntry) * ctx->count);
+    ctx->entries = new_entries;
+    gc_write_barrier(ctx, new_entries);
+    gc_restore_roots(roots);
 }
 
-// Creates a new context entry object by converting the given name into an interned symbol.
-LispContextEntry * new_context_entry_by_name(char * interned_name, LispValue * value, LispContextEntry * next) {
-    SymbolTableEntry * sym_name = insert_symbol_if_not_found(GLOBAL_SYM_TABLE, interned_name);
-    return new_context_entry(sym_name->name, value, next);
+// Records a store of the value into one of the context's slots.
+#define context_write_barrier(ctx, value) \
+    gc_write_barrier((ctx)->entries ? (void *)(ctx)->entries : (void *)(ctx), value)
+
+// Appends a binding of the given interned symbol to a local context. Returns its slot index.
+size_t insert_context_entry(LispContext * ctx, char * interned_name, LispValue * value) {
+    if ( ctx->count == context_capacity(ctx) ) {
+        size_t roots = gc_save_roots();
+        gc_protect(ctx);
+        gc_protect(value);
+        grow_context_entries(ctx);
+        gc_restore_roots(roots);
+    }
+    size_t slot = ctx->count++;
+    context_name(ctx, slot) = interned_name;
+    context_value(ctx, slot) = value;
+    context_write_barrier(ctx, value);
+    return slot;
 }
 
-// Inserts the given interned symbol and value as a context entry into the given context object.
-LispContextEntry * insert_context_entry(LispContext * ctx, char * interned_name, LispValue * value) {
-    if ( !ctx->last_entry ) {
-        ctx->entries = new_context_entry(interned_name, value, NULL);
-        ctx->last_entry = ctx->entries;
-        return ctx->entries;
+// Binds the given interned symbol in the context, replacing the context's own binding of it if
+// there is one. Bindings of the global context go to the symbol's value cell.
+void define_context_value(LispContext * ctx, char * interned_name, LispValue * value) {
+    if ( is_global_context(ctx) ) {
+        set_global_value(symbol_entry_of(interned_name), value);
+        return;
+    }
+    long found_slot = find_context_slot(ctx, interned_name);
+    if ( found_slot >= 0 ) {
+        set_context_value(ctx, found_slot, value);
     } else {
-        ctx->last_entry->next = new_context_entry(interned_name, value, NULL);
-        ctx->last_entry = ctx->last_entry->next;
-        return ctx->last_entry;
+        insert_context_entry(ctx, interned_name, value);
     }
 }
 
-// Converts the given name into an interned symbol and inserts the resulting context entry into the context.
-LispContextEntry * insert_context_entry_by_name(LispContext * ctx, char * name, LispValue * value) {
+// Converts the given name into an interned symbol and binds it in the context.
+void define_context_value_by_name(LispContext * ctx, char * name, LispValue * value) {
     SymbolTableEntry * sym_name = insert_symbol_if_not_found(GLOBAL_SYM_TABLE, name);
-    return insert_context_entry(ctx, sym_name->name, value);
+    define_context_value(ctx, sym_name->name, value);
 }
 
-// Searches for a context entry with the given interned symbol within the given context.
-LispContextEntry * find_context_entry(LispContext * ctx, char * interned_name) {
-    LispContextEntry * current_entry = ctx->entries;
-    while ( current_entry ) {
-        if ( current_entry->interned_name == interned_name )
-            return current_entry;
-        current_entry = current_entry->next;
+void set_context_value(LispContext * ctx, size_t slot, LispValue * value) {
+    context_value(ctx, slot) = value;
+    context_write_barrier(ctx, value);
+}
+
+size_t macro_epoch = 0;
+
+// Binds the global, invalidating the expansions of the macro it held, if any.
+void set_global_value(SymbolTableEntry * entry, LispValue * value) {
+    if ( entry->bound && value_type(entry->value) == kMacroValue )
+        macro_epoch++;
+    entry->value = value;
+    entry->bound = true;
+}
+
+// Returns the slot of the given interned symbol within the given context, or -1 if it isn't bound there.
+long find_context_slot(LispContext * ctx, char * interned_name) {
+    LispContextEntry * items = context_items(ctx);
+    for ( size_t i = 0 ; i < ctx->count ; i++ ) {
+        if ( items[i].interned_name == interned_name )
+            return i;
     }
-    return NULL;
+    return -1;
 }
 
-// Searches for a context entry with the given interned symbol in the given context or chained contexts.
-LispContextEntry * find_context_entry_all(LispContext * ctx, char * interned_name) {
-    LispContextEntry * current_entry = ctx->entries;
-    LispContext * current_ctx = ctx;
-    while ( current_ctx ) {
-        LispContextEntry * found_entry = find_context_entry(current_ctx, interned_name);
-        if ( found_entry )
-            return found_entry;
-        current_ctx = current_ctx->next;
+// Searches for the given interned symbol in the given context or chained contexts. Returns the
+// context that binds it and stores the slot, or returns NULL if no local context binds it.
+LispContext * find_context_slot_all(LispContext * ctx, char * interned_name, size_t * slot) {
+    for ( LispContext * current_ctx = ctx ; current_ctx ; current_ctx = current_ctx->next ) {
+        long found_slot = find_context_slot(current_ctx, interned_name);
+        if ( found_slot >= 0 ) {
+            *slot = found_slot;
+            return current_ctx;
+        }
     }
     return NULL;
 }
 
+// Returns the symbol table entry holding the global binding of the given interned symbol,
+// or NULL if it has none.
+SymbolTableEntry * find_global(char * interned_name) {
+    SymbolTableEntry * entry = symbol_entry_of(interned_name);
+    return entry->bound ? entry : NULL;
+}
+
 void print_context(LispContext * ctx) {
-    LispContextEntry * current_entry = ctx->entries;
-    while ( current_entry ) {
-        printf("%s = ", current_entry->interned_name);
-        print_value(current_entry->value);
+    for ( size_t i = 0 ; i < context_entry_count(ctx) ; i++ ) {
+        printf("%s = ", context_name(ctx, i));
+        print_value(context_value(ctx, i));
         printf("\n");
-        current_entry = current_entry->next;
     }
 }
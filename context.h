@@ -2,32 +2,60 @@
 #define CONTEXT_H
 
 #include "./constructor.h"
-#include <setjmp.h>
 
 typedef struct LispContextEntry {
     char * interned_name;
     LispValue * value;
-    struct LispContextEntry * next;
 } LispContextEntry;
 
+// Bindings moved out of a frame whose inline slots ran out.
+typedef struct LispContextEntries {
+    size_t capacity;
+    LispContextEntry items[];
+} LispContextEntries;
+
+// A frame is a single block: these fields followed by its binding slots, in the
+// order the bindings were made. A binding keeps its slot index for the life of the
+// frame, so lexical addresses can refer to it. If more bindings are made than the
+// frame was sized for, they all move to a separate entries array.
 typedef struct LispContext {
-    LispContextEntry * entries;
-    LispContextEntry * last_entry;
+    LispContextEntries * entries;
     LispLambda * parent_lambda;
-    jmp_buf * tco_buf;
     struct LispContext * next;
+    unsigned int count;
+    unsigned int capacity;
+    LispContextEntry items[];
 } LispContext;
 
+// The outermost context holds the globals. They are kept in the symbol table's
+// value cells rather than in the context's own entries.
+#define is_global_context(ctx) (!(ctx)->next)
+
+#define context_items(ctx) ((ctx)->entries ? (ctx)->entries->items : (ctx)->items)
+#define context_capacity(ctx) ((ctx)->entries ? (ctx)->entries->capacity : (ctx)->capacity)
+#define context_entry_count(ctx) ((ctx)->count)
+#define context_name(ctx, slot) (context_items(ctx)[slot].interned_name)
+#define context_value(ctx, slot) (context_items(ctx)[slot].value)
+
+// Counts the rebindings of globals that held a macro. Resolved code with macro calls
+// expanded in it is resolved again once the count has moved on.
+extern size_t macro_epoch;
+
 void init_global_symbol_table(size_t size);
 
 LispContext * new_context();
+LispContext * new_sized_context(size_t capacity);
+LispContext * new_stack_context(size_t capacity);
+bool context_on_frame_stack(LispContext * ctx);
 LispContext * extend_context(LispContext * ctx, LispLambda * lam);
-LispContextEntry * new_context_entry(char * interned_name, LispValue * value, LispContextEntry * next);
-LispContextEntry * new_context_entry_by_name(char * interned_name, LispValue * value, LispContextEntry * next);
-LispContextEntry * insert_context_entry(LispContext * ctx, char * interned_name, LispValue * value);
-LispContextEntry * insert_context_entry_by_name(LispContext * ctx, char * name, LispValue * value);
-LispContextEntry * find_context_entry(LispContext * ctx, char * interned_name);
-LispContextEntry * find_context_entry_all(LispContext * ctx, char * interned_name);
+size_t insert_context_entry(LispContext * ctx, char * interned_name, LispValue * value);
+void define_context_value(LispContext * ctx, char * interned_name, LispValue * value);
+void define_context_value_by_name(LispContext * ctx, char * name, LispValue * value);
+void set_context_value(LispContext * ctx, size_t slot, LispValue * value);
+void set_global_value(SymbolTableEntry * entry, LispValue * value);
+long find_context_slot(LispContext * ctx, char * interned_name);
+LispContext * find_context_slot_all(LispContext * ctx, char * interned_name, size_t * slot);
+SymbolTableEntry * find_global(char * interned_name);
 void print_context(LispContext * ctx);
 
 #endif // CONTEXT_H
@@ -0,0 +1,455 @@
+#include "./helper.h"
+#include "./constructor.h"
+#include "./fasl.h"
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool fasl_enabled = true;
+
+#define FASL_MAGIC "PSXFASL3"
+
+// Identifies the source a cache was written from, and the forms written after it. A
+// cache whose forms don't have the size and checksum written with them is treated
+// as missing, before any of them is evaluated.
+typedef struct FaslHeader {
+    char magic[8];
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    int64_t source_size;
+    uint64_t body_size;
+    uint64_t body_checksum;
+} FaslHeader;
+
+#define FASL_SOURCE_HEADER_SIZE offsetof(FaslHeader, body_size)
+
+#define FASL_CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+// A multiple of the eight bytes hashed at a time, so that the checksum of the forms
+// can be taken a buffer at a time as they are written.
+#define FASL_BUFFER_SIZE 65536
+
+// Every datum starts with a byte holding one of these tags. A list is written as the
+// number of its elements, the elements, and its tail.
+typedef enum FaslTag {
+    kFaslNull,
+    kFaslNumber,
+    kFaslString,
+    kFaslSymbol,
+    kFaslNewSymbol,
+    kFaslList
+} FaslTag;
+
+struct FaslReader {
+    char * data;
+    size_t length;
+    size_t position;
+    LispSymbol ** symbols;
+    size_t symbol_count;
+};
+
+// The forms are written through a buffer to a temporary file, after a header that
+// is written over once the size and checksum of the forms are known. Writers are
+// chained to those of the files being read when they were opened, so that their
+// temporary files can be removed if the interpreter exits before closing them. Maps
+// the interned names of the symbols written so far to their numbers.
+struct FaslWriter {
+    int fd;
+    char * temp_path;
+    char * path;
+    FaslHeader header;
+    bool failed;
+    char buffer[FASL_BUFFER_SIZE];
+    size_t buffered;
+    FaslWriter * outer;
+    char ** symbol_names;
+    size_t * symbol_numbers;
+    size_t symbol_capacity;
+    size_t symbol_count;
+};
+
+static char * cache_path(char * filename, char * suffix) {
+    char * path = malloc(strlen(filename) + strlen(suffix) + 1);
+    if ( !path )
+        exit_message("Error while allocating memory for FASL path.", -1);
+    strcpy(path, filename);
+    strcat(path, suffix);
+    return path;
+}
+
+static bool source_header(char * filename, FaslHeader * header) {
+    struct stat source_stat;
+    if ( strcmp(filename, "-") == 0 || stat(filename, &source_stat) < 0 || !S_ISREG(source_stat.st_mode) )
+        return false;
+    memset(header, 0, sizeof(FaslHeader));
+    memcpy(header->magic, FASL_MAGIC, sizeof(header->magic));
+    header->source_mtime_sec = source_stat.st_mtim.tv_sec;
+    header->source_mtime_nsec = source_stat.st_mtim.tv_nsec;
+    header->source_size = source_stat.st_size;
+    return true;
+}
+
+// Hashes eight bytes at a time, as 64-bit FNV-1a does one, continuing from the hash
+// of the bytes before.
+static uint64_t body_checksum(uint64_t hash, char * body, size_t size) {
+    size_t i = 0;
+    for ( ; i + 8 <= size ; i += 8 ) {
+        uint64_t word;
+        memcpy(&word, body + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for ( ; i < size ; i++ )
+        hash = (hash ^ (unsigned char)body[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+FaslReader * open_fasl_reader(char * filename) {
+    FaslHeader expected;
+    if ( !source_header(filename, &expected) )
+        return NULL;
+    char * path = cache_path(filename, ".fasl");
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if ( fd < 0 )
+        return NULL;
+    struct stat cache_stat;
+    FaslHeader header;
+    if ( fstat(fd, &cache_stat) < 0 || cache_stat.st_size < sizeof(FaslHeader) ||
+         read(fd, &header, sizeof(FaslHeader)) != sizeof(FaslHeader) ||
+         memcmp(&header, &expected, FASL_SOURCE_HEADER_SIZE) != 0 ||
+         header.body_size != cache_stat.st_size - sizeof(FaslHeader) ) {
+        close(fd);
+        return NULL;
+    }
+    char * data = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( data == MAP_FAILED )
+        return NULL;
+    if ( body_checksum(FASL_CHECKSUM_SEED, data + sizeof(FaslHeader), header.body_size) != header.body_checksum ) {
+        munmap(data, cache_stat.st_size);
+        return NULL;
+    }
+    FaslReader * reader = calloc(sizeof(FaslReader), 1);
+    if ( !reader )
+        exit_message("Error while allocating memory for FASL reader.", -1);
+    reader->data = data;
+    reader->length = cache_stat.st_size;
+    reader->position = sizeof(FaslHeader);
+    return reader;
+}
+
+void close_fasl_reader(FaslReader * reader) {
+    munmap(reader->data, reader->length);
+    free(reader->symbols);
+    free(reader);
+}
+
+static void read_bytes(FaslReader * reader, void * bytes, size_t count) {
+    if ( count > reader->length - reader->position )
+        exit_message("Corrupt FASL file.", -1);
+    memcpy(bytes, reader->data + reader->position, count);
+    reader->position += count;
+}
+
+// Counts, lengths and numbers are written as varints: seven bits to a byte, low bits
+// first, with the top bit set on every byte but the last.
+static uint64_t read_varint(FaslReader * reader) {
+    uint64_t value = 0;
+    for ( unsigned int shift = 0 ; shift < 64 ; shift += 7 ) {
+        unsigned char byte = 0;
+        read_bytes(reader, &byte, 1);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ( !(byte & 0x80) )
+            return value;
+    }
+    exit_message("Corrupt FASL file.", -1);
+    return 0;
+}
+
+static LispSymbol * read_new_symbol(FaslReader * reader) {
+    uint64_t length = read_varint(reader);
+    if ( length > reader->length - reader->position )
+        exit_message("Corrupt FASL file.", -1);
+    LispSymbol * symbol = new_interned_symbol_of_length(reader->data + reader->position, length);
+    reader->position += length;
+    reader->symbols = realloc(reader->symbols, sizeof(LispSymbol *) * (reader->symbol_count + 1));
+    if ( !reader->symbols )
+        exit_message("Error while allocating memory for FASL symbols.", -1);
+    reader->symbols[reader->symbol_count++] = symbol;
+    return symbol;
+}
+
+static LispValue * read_datum(FaslReader * reader) {
+    unsigned char tag = 0;
+    read_bytes(reader, &tag, 1);
+    switch ( tag ) {
+        case kFaslNull:
+            return NULL;
+        case kFaslNumber: {
+            // Numbers are zigzag encoded, so that small negative ones stay short too.
+            uint64_t encoded = read_varint(reader);
+            return new_lisp_number((int)((encoded >> 1) ^ -(encoded & 1)));
+        }
+        case kFaslString: {
+            uint64_t length = read_varint(reader);
+            char * value = malloc(length + 1);
+            if ( !value )
+                exit_message("Error while allocating memory for string.", -1);
+            read_bytes(reader, value, length);
+            value[length] = 0;
+            return new_lisp_string_of_length(value, length, length + 1);
+        }
+        case kFaslSymbol: {
+            uint64_t number = read_varint(reader);
+            if ( number >= reader->symbol_count )
+                exit_message("Corrupt FASL file.", -1);
+            return reader->symbols[number];
+        }
+        case kFaslNewSymbol:
+            return read_new_symbol(reader);
+        case kFaslList: {
+            uint64_t count = read_varint(reader);
+            size_t roots = gc_save_roots();
+            LispCell * list = NULL;
+            LispCell * last_cell = NULL;
+            LispValue * value = NULL;
+            gc_protect(list);
+            gc_protect(last_cell);
+            gc_protect(value);
+            for ( uint64_t i = 0 ; i < count ; i++ ) {
+                value = read_datum(reader);
+                LispCell * cell = new_lisp_cell(value, NULL);
+                if ( last_cell ) {
+                    last_cell->tail = cell;
+                    gc_write_barrier(last_cell, cell);
+                } else {
+                    list = cell;
+                }
+                last_cell = cell;
+            }
+            if ( !last_cell )
+                exit_message("Corrupt FASL file.", -1);
+            value = read_datum(reader);
+            last_cell->tail = value;
+            gc_write_barrier(last_cell, value);
+            gc_restore_roots(roots);
+            return list;
+        }
+        default:
+            exit_message("Corrupt FASL file.", -1);
+            return NULL;
+    }
+}
+
+bool read_fasl_form(FaslReader * reader, LispValue ** form) {
+    if ( reader->position == reader->length )
+        return false;
+    *form = read_datum(reader);
+    return true;
+}
+
+static FaslWriter * open_writers = NULL;
+
+static void remove_open_writers(void) {
+    for ( FaslWriter * writer = open_writers ; writer ; writer = writer->outer )
+        unlink(writer->temp_path);
+}
+
+static bool write_all(int fd, void * data, size_t size) {
+    for ( char * bytes = data ; size ; ) {
+        ssize_t written = write(fd, bytes, size);
+        if ( written <= 0 )
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+FaslWriter * open_fasl_writer(char * filename) {
+    static bool registered = false;
+    FaslHeader header;
+    if ( !source_header(filename, &header) )
+        return NULL;
+    FaslWriter * writer = calloc(sizeof(FaslWriter), 1);
+    if ( !writer )
+        exit_message("Error while allocating memory for FASL writer.", -1);
+    writer->path = cache_path(filename, ".fasl");
+    writer->fd = open_temp_file(writer->path, &writer->temp_path);
+    if ( writer->fd < 0 || !write_all(writer->fd, &header, sizeof(FaslHeader)) ) {
+        if ( writer->fd >= 0 ) {
+            close(writer->fd);
+            commit_temp_file(writer->temp_path, writer->path, false);
+        }
+        free(writer->path);
+        free(writer);
+        return NULL;
+    }
+    header.body_checksum = FASL_CHECKSUM_SEED;
+    writer->header = header;
+    if ( !registered ) {
+        atexit(remove_open_writers);
+        registered = true;
+    }
+    writer->outer = open_writers;
+    open_writers = writer;
+    return writer;
+}
+
+static void flush_fasl_writer(FaslWriter * writer) {
+    if ( !writer->failed ) {
+        writer->header.body_checksum = body_checksum(writer->header.body_checksum, writer->buffer, writer->buffered);
+        writer->header.body_size += writer->buffered;
+        if ( !write_all(writer->fd, writer->buffer, writer->buffered) )
+            writer->failed = true;
+    }
+    writer->buffered = 0;
+}
+
+void close_fasl_writer(FaslWriter * writer) {
+    flush_fasl_writer(writer);
+    bool written = !writer->failed &&
+        pwrite(writer->fd, &writer->header, sizeof(FaslHeader), 0) == sizeof(FaslHeader);
+    written = close(writer->fd) == 0 && written;
+    commit_temp_file(writer->temp_path, writer->path, written);
+    FaslWriter ** link = &open_writers;
+    while ( *link != writer )
+        link = &(*link)->outer;
+    *link = writer->outer;
+    free(writer->path);
+    free(writer->symbol_names);
+    free(writer->symbol_numbers);
+    free(writer);
+}
+
+static void write_byte(FaslWriter * writer, unsigned char byte) {
+    if ( writer->buffered == FASL_BUFFER_SIZE )
+        flush_fasl_writer(writer);
+    writer->buffer[writer->buffered++] = byte;
+}
+
+static void write_bytes(FaslWriter * writer, char * bytes, size_t count) {
+    while ( count ) {
+        if ( writer->buffered == FASL_BUFFER_SIZE )
+            flush_fasl_writer(writer);
+        size_t chunk = FASL_BUFFER_SIZE - writer->buffered;
+        if ( chunk > count )
+            chunk = count;
+        memcpy(writer->buffer + writer->buffered, bytes, chunk);
+        writer->buffered += chunk;
+        bytes += chunk;
+        count -= chunk;
+    }
+}
+
+static void write_tag(FaslWriter * writer, FaslTag tag) {
+    write_byte(writer, tag);
+}
+
+static void write_varint(FaslWriter * writer, uint64_t value) {
+    while ( value >= 0x80 ) {
+        write_byte(writer, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    write_byte(writer, value);
+}
+
+// Returns the slot of the name in the table of symbols written, which is empty if it
+// hasn't been written yet. Names are interned, so they are compared by address.
+static size_t find_written_symbol(FaslWriter * writer, char * name) {
+    size_t mask = writer->symbol_capacity - 1;
+    size_t slot = symbol_entry_of(name)->hash & mask;
+    while ( writer->symbol_names[slot] && writer->symbol_names[slot] != name )
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static void grow_written_symbols(FaslWriter * writer) {
+    char ** old_names = writer->symbol_names;
+    size_t * old_numbers = writer->symbol_numbers;
+    size_t old_capacity = writer->symbol_capacity;
+    writer->symbol_capacity = old_capacity ? old_capacity * 2 : 64;
+    writer->symbol_names = calloc(sizeof(char *), writer->symbol_capacity);
+    writer->symbol_numbers = calloc(sizeof(size_t), writer->symbol_capacity);
+    if ( !writer->symbol_names || !writer->symbol_numbers )
+        exit_message("Error while allocating memory for FASL symbols.", -1);
+    for ( size_t i = 0 ; i < old_capacity ; i++ ) {
+        if ( !old_names[i] )
+            continue;
+        size_t slot = find_written_symbol(writer, old_names[i]);
+        writer->symbol_names[slot] = old_names[i];
+        writer->symbol_numbers[slot] = old_numbers[i];
+    }
+    free(old_names);
+    free(old_numbers);
+}
+
+static void write_symbol(FaslWriter * writer, LispSymbol * symbol) {
+    if ( (writer->symbol_count + 1) * 2 > writer->symbol_capacity )
+        grow_written_symbols(writer);
+    size_t slot = find_written_symbol(writer, symbol->value);
+    if ( writer->symbol_names[slot] ) {
+        write_tag(writer, kFaslSymbol);
+        write_varint(writer, writer->symbol_numbers[slot]);
+        return;
+    }
+    writer->symbol_names[slot] = symbol->value;
+    writer->symbol_numbers[slot] = writer->symbol_count++;
+    size_t length = strlen(symbol->value);
+    write_tag(writer, kFaslNewSymbol);
+    write_varint(writer, length);
+    write_bytes(writer, symbol->value, length);
+}
+
+// Anything but what the reader makes leaves the cache unwritten.
+static void write_datum(FaslWriter * writer, LispValue * value) {
+    switch ( value_type(value) ) {
+        case kUnknownValue:
+            if ( value ) {
+                writer->failed = true;
+                return;
+            }
+            write_tag(writer, kFaslNull);
+            return;
+        case kNumberValue: {
+            int64_t number = fixnum_value(value);
+            write_tag(writer, kFaslNumber);
+            write_varint(writer, ((uint64_t)number << 1) ^ (uint64_t)(number >> 63));
+            return;
+        }
+        case kStringValue: {
+            LispString * str = value;
+            write_tag(writer, kFaslString);
+            write_varint(writer, str->length);
+            write_bytes(writer, str->value, str->length);
+            return;
+        }
+        case kSymbolValue:
+            write_symbol(writer, value);
+            return;
+        case kCellValue: {
+            LispCell * cell = value;
+            size_t count = 0;
+            for ( ; value_type(cell) == kCellValue ; cell = cell->tail )
+                count++;
+            write_tag(writer, kFaslList);
+            write_varint(writer, count);
+            for ( cell = value ; value_type(cell) == kCellValue ; cell = cell->tail )
+                write_datum(writer, cell->head);
+            write_datum(writer, cell);
+            return;
+        }
+        default:
+            writer->failed = true;
+            return;
+    }
+}
+
+void write_fasl_form(FaslWriter * writer, LispValue * form) {
+    if ( !writer->failed )
+        write_datum(writer, form);
+}
@@ -0,0 +1,28 @@
+#ifndef FASL_H
+#define FASL_H
+
+#include "./constructor.h"
+
+// Files of forms that have already been read, written next to a source file as
+// <file>.fasl the first time it is read, and read in place of it while the source
+// keeps the modification time and size it had then. Only numbers, strings, symbols
+// and lists, which is everything the reader makes, can be written. Symbols are
+// written by name the first time and by number afterwards, and interned again when
+// the file is read. Turned off with --no-fasl.
+extern bool fasl_enabled;
+
+typedef struct FaslReader FaslReader;
+typedef struct FaslWriter FaslWriter;
+
+// Returns NULL if the source has no cache or it is out of date.
+FaslReader * open_fasl_reader(char * filename);
+bool read_fasl_form(FaslReader * reader, LispValue ** form);
+void close_fasl_reader(FaslReader * reader);
+
+// Returns NULL if the cache can't be written. The forms are written to a temporary
+// file as they are given, which is renamed over the old cache once it is closed.
+FaslWriter * open_fasl_writer(char * filename);
+void write_fasl_form(FaslWriter * writer, LispValue * form);
+void close_fasl_writer(FaslWriter * writer);
+
+#endif // FASL_H
@@ -0,0 +1,711 @@
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "./helper.h"
+#include "./gc.h"
+#include "./pool.h"
+#include "./symbols.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./vm.h"
+
+// A full collection is triggered once this many bytes have reached the old
+// generation since the last one, or once as many bytes as survived the last
+// full collection, whichever is larger.
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#endif
+
+// Sizes of the two nurseries. New objects and pairs are bump allocated there,
+// and a minor collection runs whenever either fills up.
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (1024 * 1024)
+#endif
+#ifndef GC_PAIR_NURSERY_SIZE
+#define GC_PAIR_NURSERY_SIZE (512 * 1024)
+#endif
+
+// Address space reserved for old pairs. Pages are only backed by memory once used.
+#ifndef GC_PAIR_SPACE_SIZE
+#define GC_PAIR_SPACE_SIZE ((size_t)1 << 30)
+#endif
+
+// Address space reserved for the frame stack. Pages are only backed by memory once used.
+#ifndef GC_FRAME_STACK_SIZE
+#define GC_FRAME_STACK_SIZE ((size_t)64 * 1024 * 1024)
+#endif
+
+// Objects whose header and payload fit in this many bytes are served from pools.
+// Larger objects skip the nursery and are allocated old.
+#define GC_MAX_POOLED_SLOT 256
+#define GC_SLOT_ALIGNMENT 8
+
+#define header_of(obj) (((GCHeader *)(obj)) - 1)
+
+typedef struct PointerStack {
+    void ** items;
+    size_t count;
+    size_t capacity;
+} PointerStack;
+
+// Objects allocated with malloc: everything under the malloc allocator, and
+// objects too large for a pool under the pool allocator.
+static PointerStack heap_objects;
+static Pool pools[GC_MAX_POOLED_SLOT / GC_SLOT_ALIGNMENT + 1];
+static GCAllocator heap_allocator = kGCPoolAllocator;
+static PointerStack root_stack;
+static PointerStack global_roots;
+static PointerStack root_arrays;
+static PointerStack root_array_counts;
+static PointerStack mark_stack;
+
+// The young generation is a single reserved region holding the object nursery
+// followed by the pair nursery, which is also the start of the pair space:
+//
+//   gc_nursery_start    gc_pair_space_start    old_pairs    gc_pair_space_end
+//   | object nursery    | pair nursery         | old pairs ...               |
+//
+char * gc_nursery_start = NULL;
+char * gc_nursery_end = NULL;
+char * gc_pair_space_start = NULL;
+char * gc_pair_space_end = NULL;
+static size_t nursery_top = 0;
+static size_t pair_nursery_top = 0;
+char * gc_frame_stack_start = NULL;
+char * gc_frame_stack_end = NULL;
+static size_t frame_stack_top = 0;
+static uint64_t * pair_forwarded = NULL;
+
+// Old objects that may point into the nursery, recorded by the write barrier.
+static PointerStack remembered_set;
+// Objects promoted by the running minor collection whose fields still need scanning.
+static PointerStack promoted_objects;
+
+// Old pairs below pair_top have been handed out at least once; the free ones
+// among them are threaded through their first word.
+static char * old_pairs = NULL;
+static size_t pair_top = 0;
+static size_t pairs_in_use = 0;
+static void ** pair_free_list = NULL;
+static uint64_t * pair_marks = NULL;
+static uint64_t * pair_remembered = NULL;
+
+static size_t young_objects = 0;
+static size_t bytes_since_collect = 0;
+static GCStats stats;
+
+static void push_pointer(PointerStack * stack, void * ptr) {
+    if ( stack->count == stack->capacity ) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items = realloc(stack->items, sizeof(void *) * stack->capacity);
+        if ( !stack->items )
+            exit_message("Error while growing garbage collector stack.", -1);
+    }
+    stack->items[stack->count++] = ptr;
+}
+
+static void * reserve_pages(size_t size) {
+    void * pages = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ( pages == MAP_FAILED )
+        exit_message("Error while reserving garbage collector memory.", -1);
+    return pages;
+}
+
+static void init_spaces() {
+    size_t old_pair_count = GC_PAIR_SPACE_SIZE / GC_PAIR_SIZE;
+    size_t young_pair_count = GC_PAIR_NURSERY_SIZE / GC_PAIR_SIZE;
+    gc_nursery_start = reserve_pages(GC_NURSERY_SIZE + GC_PAIR_NURSERY_SIZE + GC_PAIR_SPACE_SIZE);
+    gc_nursery_end = gc_nursery_start + GC_NURSERY_SIZE + GC_PAIR_NURSERY_SIZE;
+    gc_pair_space_start = gc_nursery_start + GC_NURSERY_SIZE;
+    gc_pair_space_end = gc_nursery_end + GC_PAIR_SPACE_SIZE;
+    old_pairs = gc_nursery_end;
+    pair_marks = reserve_pages(old_pair_count / 8);
+    pair_remembered = reserve_pages(old_pair_count / 8);
+    pair_forwarded = reserve_pages((young_pair_count + 63) / 64 * sizeof(uint64_t));
+    gc_frame_stack_start = reserve_pages(GC_FRAME_STACK_SIZE);
+    gc_frame_stack_end = gc_frame_stack_start + GC_FRAME_STACK_SIZE;
+    frame_stack_top = 0;
+    nursery_top = 0;
+    pair_nursery_top = 0;
+    pair_top = 0;
+    pairs_in_use = 0;
+    pair_free_list = NULL;
+}
+
+void gc_init(GCAllocator allocator) {
+    heap_allocator = allocator;
+    if ( !gc_nursery_start )
+        init_spaces();
+    for ( size_t i = 2 ; i < sizeof(pools) / sizeof(Pool) ; i++ )
+        init_pool(&pools[i], i * GC_SLOT_ALIGNMENT);
+    stats.collections = 0;
+    stats.minor_collections = 0;
+    stats.live_objects = 0;
+    stats.live_bytes = 0;
+    stats.freed_objects = 0;
+    stats.promoted_bytes = 0;
+    bytes_since_collect = 0;
+}
+
+void gc_register_root(void ** root) {
+    push_pointer(&global_roots, root);
+}
+
+void gc_register_root_array(void ** items, size_t * count) {
+    push_pointer(&root_arrays, (void **)items);
+    push_pointer(&root_array_counts, (void **)count);
+}
+
+size_t gc_save_roots() {
+    return root_stack.count;
+}
+
+void gc_restore_roots(size_t saved) {
+    root_stack.count = saved;
+}
+
+void gc_push_root(void ** root) {
+    push_pointer(&root_stack, root);
+}
+
+void gc_note_allocation(size_t size) {
+    bytes_since_collect += size;
+}
+
+GCStats gc_stats() {
+    return stats;
+}
+
+static size_t collect_threshold() {
+    return stats.live_bytes > GC_MIN_THRESHOLD ? stats.live_bytes : GC_MIN_THRESHOLD;
+}
+
+static size_t slot_size_for(size_t size) {
+    size_t slot_size = sizeof(GCHeader) + size;
+    return (slot_size + GC_SLOT_ALIGNMENT - 1) & ~(GC_SLOT_ALIGNMENT - 1);
+}
+
+#define old_pair_index(ptr) (((char *)(ptr) - old_pairs) / GC_PAIR_SIZE)
+#define young_pair_index(ptr) (((char *)(ptr) - gc_pair_space_start) / GC_PAIR_SIZE)
+#define bitmap_test(bitmap, i) ((bitmap)[(i) / 64] & ((uint64_t)1 << ((i) % 64)))
+#define bitmap_set(bitmap, i) ((bitmap)[(i) / 64] |= ((uint64_t)1 << ((i) % 64)))
+#define bitmap_clear(bitmap, i) ((bitmap)[(i) / 64] &= ~((uint64_t)1 << ((i) % 64)))
+
+// Allocates straight into the old generation. Never collects.
+static void * alloc_old(GCKind kind, size_t size) {
+    size_t slot_size = slot_size_for(size);
+    GCHeader * header = NULL;
+    if ( heap_allocator == kGCPoolAllocator && slot_size <= GC_MAX_POOLED_SLOT ) {
+        header = pool_alloc(&pools[slot_size / GC_SLOT_ALIGNMENT]);
+        memset(header, 0, slot_size);
+    } else {
+        header = calloc(slot_size, 1);
+        if ( !header )
+            exit_message("Error while allocating heap object.", -1);
+        push_pointer(&heap_objects, header);
+    }
+    header->size = size;
+    header->kind = kind;
+    header->marked = false;
+    header->remembered = false;
+    bytes_since_collect += slot_size;
+    return header + 1;
+}
+
+static void * alloc_old_pair() {
+    void ** pair = pair_free_list;
+    if ( pair ) {
+        pair_free_list = pair[0];
+    } else {
+        if ( old_pairs + (pair_top + 1) * GC_PAIR_SIZE > gc_pair_space_end )
+            exit_message("Error while allocating pair: pair space exhausted.", -1);
+        pair = (void **)(old_pairs + pair_top++ * GC_PAIR_SIZE);
+    }
+    pairs_in_use++;
+    bytes_since_collect += GC_PAIR_SIZE;
+    return pair;
+}
+
+// Runs a minor collection, followed by a full one if the old generation has
+// grown past its threshold.
+static void collect_young() {
+    gc_minor_collect();
+    if ( bytes_since_collect >= collect_threshold() )
+        gc_collect();
+}
+
+static void * bump_alloc(GCKind kind, size_t size, size_t slot_size) {
+    GCHeader * header = (GCHeader *)(gc_nursery_start + nursery_top);
+    nursery_top += slot_size;
+    memset(header, 0, slot_size);
+    header->size = size;
+    header->kind = kind;
+    young_objects++;
+    return header + 1;
+}
+
+static void * bump_alloc_pair() {
+    void ** pair = (void **)(gc_pair_space_start + pair_nursery_top);
+    pair_nursery_top += GC_PAIR_SIZE;
+    pair[0] = NULL;
+    pair[1] = NULL;
+    young_objects++;
+    return pair;
+}
+
+void * gc_alloc(GCKind kind, size_t size) {
+    size_t slot_size = slot_size_for(size);
+    if ( slot_size > GC_MAX_POOLED_SLOT )
+        return gc_alloc_old(kind, size);
+    if ( nursery_top + slot_size > GC_NURSERY_SIZE )
+        collect_young();
+    return bump_alloc(kind, size, slot_size);
+}
+
+// Objects allocated old may be filled with young pointers before the next
+// minor collection, so they start out remembered.
+void * gc_alloc_old(GCKind kind, size_t size) {
+    if ( bytes_since_collect >= collect_threshold() )
+        gc_collect();
+    void * obj = alloc_old(kind, size);
+    gc_remember(obj);
+    return obj;
+}
+
+void * gc_alloc_pair() {
+    if ( pair_nursery_top + GC_PAIR_SIZE > GC_PAIR_NURSERY_SIZE )
+        collect_young();
+    return bump_alloc_pair();
+}
+
+// Once the nursery is full, objects are allocated old and remembered instead of
+// collecting. Objects that must never move are allocated old as well.
+void * gc_alloc_uncollected(GCKind kind, size_t size, bool old) {
+    size_t slot_size = slot_size_for(size);
+    if ( old || slot_size > GC_MAX_POOLED_SLOT || nursery_top + slot_size > GC_NURSERY_SIZE ) {
+        void * obj = alloc_old(kind, size);
+        gc_remember(obj);
+        return obj;
+    }
+    return bump_alloc(kind, size, slot_size);
+}
+
+void * gc_alloc_uncollected_pair() {
+    if ( pair_nursery_top + GC_PAIR_SIZE > GC_PAIR_NURSERY_SIZE ) {
+        void * pair = alloc_old_pair();
+        gc_remember(pair);
+        return pair;
+    }
+    return bump_alloc_pair();
+}
+
+// Pushes a zeroed object on the frame stack. Returns NULL if the frame stack is full.
+void * gc_push_frame(GCKind kind, size_t size) {
+    size_t slot_size = slot_size_for(size);
+    if ( frame_stack_top + slot_size > GC_FRAME_STACK_SIZE )
+        return NULL;
+    GCHeader * header = (GCHeader *)(gc_frame_stack_start + frame_stack_top);
+    frame_stack_top += slot_size;
+    memset(header, 0, slot_size);
+    header->size = size;
+    header->kind = kind;
+    return header + 1;
+}
+
+size_t gc_frame_mark() {
+    return frame_stack_top;
+}
+
+void gc_pop_frames(size_t mark) {
+    frame_stack_top = mark;
+}
+
+// Moves the topmost frame down to the given mark, popping the frames it lands on.
+// Nothing may point at the frame but the caller. Returns its new address.
+void * gc_slide_frame(void * frame, size_t mark) {
+    GCHeader * header = (GCHeader *)frame - 1;
+    GCHeader * new_header = (GCHeader *)(gc_frame_stack_start + mark);
+    size_t slot_size = slot_size_for(header->size);
+    if ( new_header != header )
+        memmove(new_header, header, slot_size);
+    frame_stack_top = mark + slot_size;
+    return new_header + 1;
+}
+
+// Frames on the frame stack are scanned by every collection, so they are never remembered.
+void gc_remember(void * obj) {
+    if ( gc_is_stack_frame(obj) )
+        return;
+    if ( gc_is_pair(obj) ) {
+        size_t i = old_pair_index(obj);
+        if ( bitmap_test(pair_remembered, i) )
+            return;
+        bitmap_set(pair_remembered, i);
+    } else {
+        GCHeader * header = header_of(obj);
+        if ( header->remembered )
+            return;
+        header->remembered = true;
+    }
+    push_pointer(&remembered_set, obj);
+}
+
+static void visit_fields(void * obj, SlotVisitor visit) {
+    if ( gc_is_pair(obj) ) {
+        LispCell * pair = obj;
+        visit((void **)&pair->head);
+        visit((void **)&pair->tail);
+        return;
+    }
+    switch ( header_of(obj)->kind ) {
+        case kGCValue: {
+            LispValue * value = obj;
+            if ( value->type == kLambdaValue || value->type == kMacroValue ) {
+                visit(&value->value);
+                visit(&value->extra_value);
+            } else if ( value->type == kLexicalRefValue || value->type == kGlobalRefValue || value->type == kConstantValue || value->type == kLambdaNodeValue || value->type == kHashTableValue ) {
+                visit(&value->value);
+            } else if ( value->type == kCallNodeValue ) {
+                visit(&value->value);
+                visit(&value->extra_value);
+            } else if ( value->type == kIfNodeValue ) {
+                LispIfNode * node = obj;
+                visit((void **)&node->test);
+                visit((void **)&node->consequent);
+                visit((void **)&node->alternative);
+            } else if ( value->type == kVectorValue ) {
+                LispVector * vec = obj;
+                for ( size_t i = 0 ; i < vec->length ; i++ )
+                    visit((void **)&vec->value[i]);
+            }
+            break;
+        }
+        case kGCLambdaInfo: {
+            LambdaInfo * info = obj;
+            visit((void **)&info->code);
+            visit((void **)&info->source);
+            visit((void **)&info->params);
+            visit((void **)&info->bytecode);
+            break;
+        }
+        case kGCBytecode: {
+            LispBytecode * bytecode = obj;
+            for ( size_t i = 0 ; i < bytecode->const_count ; i++ )
+                visit((void **)&bytecode->consts[i]);
+            break;
+        }
+        case kGCHashEntries: {
+            LispHashEntries * entries = obj;
+            for ( size_t i = 0 ; i < entries->capacity ; i++ ) {
+                visit((void **)&entries->items[i].key);
+                visit((void **)&entries->items[i].value);
+            }
+            break;
+        }
+        case kGCMacroInfo: {
+            MacroInfo * info = obj;
+            visit((void **)&info->template);
+            visit((void **)&info->params);
+            break;
+        }
+        case kGCContext: {
+            LispContext * ctx = obj;
+            if ( !ctx->entries ) {
+                for ( size_t i = 0 ; i < ctx->count ; i++ )
+                    visit((void **)&ctx->items[i].value);
+            }
+            visit((void **)&ctx->entries);
+            visit((void **)&ctx->parent_lambda);
+            visit((void **)&ctx->next);
+            break;
+        }
+        case kGCContextEntries: {
+            LispContextEntries * entries = obj;
+            for ( size_t i = 0 ; i < entries->capacity ; i++ )
+                visit((void **)&entries->items[i].value);
+            break;
+        }
+    }
+}
+
+void gc_visit_fields(void * obj, SlotVisitor visit) {
+    visit_fields(obj, visit);
+}
+
+static void visit_symbol_table(SymbolTable * table, SlotVisitor visit) {
+    if ( !table )
+        return;
+    for ( size_t i = 0 ; i < table->size ; i++ ) {
+        SymbolTableEntry * entry = table->entries[i];
+        if ( !entry )
+            continue;
+        visit((void **)&entry->symbol);
+        visit((void **)&entry->value);
+    }
+}
+
+static void visit_roots(SlotVisitor visit) {
+    for ( size_t i = 0 ; i < global_roots.count ; i++ )
+        visit(global_roots.items[i]);
+    for ( size_t i = 0 ; i < root_arrays.count ; i++ ) {
+        void ** items = (void **)root_arrays.items[i];
+        size_t count = *(size_t *)root_array_counts.items[i];
+        for ( size_t j = 0 ; j < count ; j++ )
+            visit(&items[j]);
+    }
+    for ( size_t i = 0 ; i < root_stack.count ; i++ )
+        visit(root_stack.items[i]);
+    for ( size_t offset = 0 ; offset < frame_stack_top ; ) {
+        GCHeader * header = (GCHeader *)(gc_frame_stack_start + offset);
+        offset += slot_size_for(header->size);
+        visit_fields(header + 1, visit);
+    }
+    visit_symbol_table(GLOBAL_SYM_TABLE, visit);
+}
+
+// Copies a young object into the old generation, leaving a forwarding pointer
+// in its first word. Young pairs are flagged as forwarded in a bitmap, other
+// objects by their header kind.
+static void * promote(void * obj) {
+    if ( gc_is_pair(obj) ) {
+        size_t i = young_pair_index(obj);
+        void ** young_pair = obj;
+        if ( bitmap_test(pair_forwarded, i) )
+            return young_pair[0];
+        void ** old_pair = alloc_old_pair();
+        old_pair[0] = young_pair[0];
+        old_pair[1] = young_pair[1];
+        bitmap_set(pair_forwarded, i);
+        young_pair[0] = old_pair;
+        push_pointer(&promoted_objects, old_pair);
+        stats.promoted_bytes += GC_PAIR_SIZE;
+        return old_pair;
+    }
+    GCHeader * header = header_of(obj);
+    if ( header->kind == kGCForwarded )
+        return *(void **)obj;
+    void * copy = alloc_old(header->kind, header->size);
+    memcpy(copy, obj, header->size);
+    if ( header->kind == kGCValue && ((LispValue *)copy)->type == kVectorValue ) {
+        LispVector * vec = copy;
+        vec->value = (LispValue **)(vec + 1);
+    } else if ( header->kind == kGCValue && ((LispValue *)copy)->type == kTypedVectorValue ) {
+        LispTypedVector * vec = copy;
+        vec->value = vec + 1;
+    }
+    header->kind = kGCForwarded;
+    *(void **)obj = copy;
+    push_pointer(&promoted_objects, copy);
+    stats.promoted_bytes += slot_size_for(header->size);
+    return copy;
+}
+
+static void forward_slot(void ** slot) {
+    if ( gc_is_young(*slot) )
+        *slot = promote(*slot);
+}
+
+// Releases resources owned by an object outside of the collected heap.
+static void finalize_object(GCHeader * header);
+
+// Finalizes the nursery objects that were not promoted.
+static void finalize_nursery() {
+    size_t offset = 0;
+    while ( offset < nursery_top ) {
+        GCHeader * header = (GCHeader *)(gc_nursery_start + offset);
+        offset += slot_size_for(header->size);
+        if ( header->kind != kGCForwarded )
+            finalize_object(header);
+    }
+}
+
+// Promotes every nursery object reachable from the roots or from remembered
+// old objects, then empties both nurseries. Survivors go straight to the old
+// generation, so the work done is proportional to the live young data.
+void gc_minor_collect() {
+    size_t survivors = 0;
+    visit_roots(forward_slot);
+    for ( size_t i = 0 ; i < remembered_set.count ; i++ ) {
+        void * obj = remembered_set.items[i];
+        if ( gc_is_pair(obj) )
+            bitmap_clear(pair_remembered, old_pair_index(obj));
+        else
+            header_of(obj)->remembered = false;
+        visit_fields(obj, forward_slot);
+    }
+    remembered_set.count = 0;
+    while ( promoted_objects.count ) {
+        visit_fields(promoted_objects.items[--promoted_objects.count], forward_slot);
+        survivors++;
+    }
+    finalize_nursery();
+    memset(pair_forwarded, 0, (pair_nursery_top / GC_PAIR_SIZE + 63) / 64 * sizeof(uint64_t));
+    nursery_top = 0;
+    pair_nursery_top = 0;
+    stats.freed_objects += young_objects - survivors;
+    stats.minor_collections++;
+    young_objects = 0;
+}
+
+// Marks the object and queues it for tracing. Only runs right after a minor
+// collection, so every object reached is old. Pointers that are not 8-byte aligned
+// (tagged fixnums, the reader's END_OF_LIST sentinel) are never heap objects and are
+// skipped, as are frames on the frame stack, which are traced as roots.
+static void mark_object(void * obj) {
+    if ( !obj || ((size_t)obj & 7) || gc_is_stack_frame(obj) )
+        return;
+    if ( gc_is_pair(obj) ) {
+        size_t i = old_pair_index(obj);
+        if ( bitmap_test(pair_marks, i) )
+            return;
+        bitmap_set(pair_marks, i);
+        push_pointer(&mark_stack, obj);
+        return;
+    }
+    GCHeader * header = header_of(obj);
+    if ( header->marked )
+        return;
+    header->marked = true;
+    push_pointer(&mark_stack, obj);
+}
+
+static void mark_slot(void ** slot) {
+    mark_object(*slot);
+}
+
+static void finalize_object(GCHeader * header) {
+    if ( header->kind != kGCValue )
+        return;
+    LispValue * value = (LispValue *)(header + 1);
+    if ( value->type == kStringValue || value->type == kStringBuilderValue )
+        free(value->value);
+}
+
+static void mark_roots() {
+    visit_roots(mark_slot);
+    while ( mark_stack.count )
+        visit_fields(mark_stack.items[--mark_stack.count], mark_slot);
+}
+
+static size_t sweep_malloc_objects() {
+    size_t kept = 0;
+    size_t freed = 0;
+    for ( size_t i = 0 ; i < heap_objects.count ; i++ ) {
+        GCHeader * header = heap_objects.items[i];
+        if ( header->marked ) {
+            header->marked = false;
+            stats.live_bytes += slot_size_for(header->size);
+            heap_objects.items[kept++] = header;
+        } else {
+            finalize_object(header);
+            free(header);
+            freed++;
+        }
+    }
+    heap_objects.count = kept;
+    stats.live_objects += kept;
+    return freed;
+}
+
+// Sweeps every slab of the pool and rebuilds its free list in address order.
+// Slabs left without any live object are returned to the system.
+static size_t sweep_pool(Pool * pool) {
+    size_t freed = 0;
+    PoolSlab * prev_slab = NULL;
+    PoolSlab * slab = pool->slabs;
+    pool->free_list = NULL;
+    while ( slab ) {
+        PoolSlab * next_slab = slab->next;
+        size_t live = 0;
+        for ( size_t i = 0 ; i < slab->slot_count ; i++ ) {
+            GCHeader * header = pool_slot(pool, slab, i);
+            if ( header->kind == kGCFree )
+                continue;
+            if ( header->marked ) {
+                header->marked = false;
+                live++;
+            } else {
+                finalize_object(header);
+                header->kind = kGCFree;
+                freed++;
+            }
+        }
+        if ( live ) {
+            for ( size_t i = slab->slot_count ; i > 0 ; i-- ) {
+                GCHeader * header = pool_slot(pool, slab, i - 1);
+                if ( header->kind == kGCFree )
+                    pool_free(pool, header);
+            }
+            stats.live_objects += live;
+            stats.live_bytes += live * pool->slot_size;
+            prev_slab = slab;
+        } else {
+            release_pool_slab(pool, slab, prev_slab);
+        }
+        slab = next_slab;
+    }
+    return freed;
+}
+
+// Sweeps the old pairs: every unmarked pair below the highest live one goes
+// back on the free list in address order, and the pages above it are returned
+// to the system.
+static size_t sweep_pairs() {
+    size_t old_top = pair_top;
+    size_t word_count = (old_top + 63) / 64;
+    size_t live = 0;
+    size_t new_top = 0;
+    for ( size_t w = 0 ; w < word_count ; w++ ) {
+        if ( !pair_marks[w] )
+            continue;
+        live += __builtin_popcountll(pair_marks[w]);
+        new_top = w * 64 + 64 - __builtin_clzll(pair_marks[w]);
+    }
+    pair_free_list = NULL;
+    for ( size_t i = new_top ; i > 0 ; i-- ) {
+        if ( bitmap_test(pair_marks, i - 1) )
+            continue;
+        void ** pair = (void **)(old_pairs + (i - 1) * GC_PAIR_SIZE);
+        pair[0] = pair_free_list;
+        pair[1] = NULL;
+        pair_free_list = pair;
+    }
+    memset(pair_marks, 0, word_count * sizeof(uint64_t));
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t used_bytes = (new_top * GC_PAIR_SIZE + page_size - 1) & ~(page_size - 1);
+    if ( used_bytes < old_top * GC_PAIR_SIZE )
+        madvise(old_pairs + used_bytes, old_top * GC_PAIR_SIZE - used_bytes, MADV_DONTNEED);
+
+    size_t freed = pairs_in_use - live;
+    pair_top = new_top;
+    pairs_in_use = live;
+    stats.live_objects += live;
+    stats.live_bytes += live * GC_PAIR_SIZE;
+    return freed;
+}
+
+static size_t sweep() {
+    stats.live_objects = 0;
+    stats.live_bytes = 0;
+    size_t freed = sweep_pairs();
+    freed += sweep_malloc_objects();
+    for ( size_t i = 2 ; i < sizeof(pools) / sizeof(Pool) ; i++ )
+        freed += sweep_pool(&pools[i]);
+    return freed;
+}
+
+// Empties the nursery, then runs a full mark-and-sweep collection of the old
+// generation. Returns the number of objects freed.
+size_t gc_collect() {
+    size_t freed_before = stats.freed_objects;
+    gc_minor_collect();
+    mark_roots();
+    size_t freed = stats.freed_objects - freed_before + sweep();
+    stats.collections++;
+    stats.freed_objects = freed_before + freed;
+    bytes_since_collect = 0;
+    return freed;
+}
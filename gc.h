@@ -0,0 +1,132 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Every object handed out by gc_alloc is one of these kinds. The kind decides
+// how the collector traces the object's fields and whether it needs finalizing.
+// kGCFree tags unused pool slots and must stay zero, since new slabs are zeroed.
+// kGCForwarded tags nursery objects that a minor collection has promoted.
+typedef enum GCKind {
+    kGCFree,
+    kGCValue,
+    kGCLambdaInfo,
+    kGCMacroInfo,
+    kGCContext,
+    kGCContextEntries,
+    kGCBytecode,
+    kGCHashEntries,
+    kGCForwarded
+} GCKind;
+
+// Hidden header placed in front of every collected object.
+typedef struct GCHeader {
+    unsigned int size;
+    unsigned char kind;
+    unsigned char marked;
+    unsigned char remembered;
+} GCHeader;
+
+// The header of an object that isn't a pair.
+#define gc_header_of(obj) (((GCHeader *)(obj)) - 1)
+
+// Backing allocator for collected objects, chosen once at startup. The pool
+// allocator serves small objects from size-classed slabs with free lists; the
+// malloc allocator gives every object its own malloc call. Pairs always come
+// from the pair space, whichever allocator is chosen.
+typedef enum GCAllocator {
+    kGCPoolAllocator,
+    kGCMallocAllocator
+} GCAllocator;
+
+typedef struct GCStats {
+    size_t collections;
+    size_t minor_collections;
+    size_t live_objects;
+    size_t live_bytes;
+    size_t freed_objects;
+    size_t promoted_bytes;
+} GCStats;
+
+// The heap has two generations. New objects are bump allocated in a nursery, and
+// a minor collection copies the survivors into the old generation, which is only
+// collected by a full mark-and-sweep. Objects can therefore move: every heap
+// pointer held in a C local across an allocation must be protected, and every
+// store into an object that may already be old must go through gc_write_barrier.
+void gc_init(GCAllocator allocator);
+void * gc_alloc(GCKind kind, size_t size);
+void * gc_alloc_old(GCKind kind, size_t size);
+void * gc_alloc_pair();
+void gc_minor_collect();
+size_t gc_collect();
+void gc_note_allocation(size_t size);
+GCStats gc_stats();
+
+// Allocate without ever collecting, for building objects whose fields don't hold
+// valid pointers yet, as when a heap image is loaded. They go in the nursery while
+// there is room, unless old is set.
+void * gc_alloc_uncollected(GCKind kind, size_t size, bool old);
+void * gc_alloc_uncollected_pair();
+
+// Calls visit on every field of the object that can hold a heap pointer.
+typedef void (*SlotVisitor)(void ** slot);
+void gc_visit_fields(void * obj, SlotVisitor visit);
+
+// Pairs are two bare words with no header. They live in one contiguous reserved
+// region, so an object's address alone tells whether it is a pair, and their mark
+// bits are kept in a side bitmap.
+#define GC_PAIR_SIZE (2 * sizeof(void *))
+
+extern char * gc_pair_space_start;
+extern char * gc_pair_space_end;
+
+#define gc_is_pair(ptr) \
+    ((char *)(ptr) >= gc_pair_space_start && (char *)(ptr) < gc_pair_space_end)
+
+// Both nurseries share one region, so a single range check tells young objects apart.
+extern char * gc_nursery_start;
+extern char * gc_nursery_end;
+
+#define gc_is_young(ptr) \
+    (!((size_t)(ptr) & 7) && (char *)(ptr) >= gc_nursery_start && (char *)(ptr) < gc_nursery_end)
+
+// Frames that can't outlive the call that made them are pushed on a stack of their
+// own instead of the heap, and popped when the call returns. Every collection
+// traces them as roots, so they never need to be remembered.
+extern char * gc_frame_stack_start;
+extern char * gc_frame_stack_end;
+
+#define gc_is_stack_frame(ptr) \
+    ((char *)(ptr) >= gc_frame_stack_start && (char *)(ptr) < gc_frame_stack_end)
+
+void * gc_push_frame(GCKind kind, size_t size);
+size_t gc_frame_mark();
+void gc_pop_frames(size_t mark);
+void * gc_slide_frame(void * frame, size_t mark);
+
+// Records an old object that was just made to point at a young one, so the next
+// minor collection treats the object's fields as roots.
+void gc_remember(void * obj);
+
+#define gc_write_barrier(obj, value) \
+    do { \
+        if ( gc_is_young(value) && !gc_is_young(obj) ) \
+            gc_remember(obj); \
+    } while ( 0 )
+
+// Permanent roots, e.g. global variables holding heap objects.
+void gc_register_root(void ** root);
+
+// A permanent array of roots, of which the first *count are live.
+void gc_register_root_array(void ** items, size_t * count);
+
+// Temporary roots live on a shadow stack. Any local holding a heap object across
+// a call that may allocate must be protected, and the stack restored before returning.
+size_t gc_save_roots();
+void gc_restore_roots(size_t saved);
+void gc_push_root(void ** root);
+
+#define gc_protect(var) gc_push_root((void **)&(var))
+
+#endif // GC_H
@@ -0,0 +1,253 @@
+#include "./helper.h"
+#include "./constructor.h"
+#include "./hashtable.h"
+#include <string.h>
+
+// Numbers are immediates and symbols are interned, so eqv? is identity.
+bool values_eqv(LispValue * a, LispValue * b) {
+    return a == b;
+}
+
+bool values_equal(LispValue * a, LispValue * b) {
+    while ( a != b ) {
+        ValueType type = value_type(a);
+        if ( type != value_type(b) )
+            return false;
+        if ( type == kCellValue ) {
+            if ( !values_equal(((LispCell *)a)->head, ((LispCell *)b)->head) )
+                return false;
+            a = ((LispCell *)a)->tail;
+            b = ((LispCell *)b)->tail;
+        } else if ( type == kStringValue ) {
+            LispString * str_a = a;
+            LispString * str_b = b;
+            return str_a->length == str_b->length && memcmp(str_a->value, str_b->value, str_a->length) == 0;
+        } else if ( type == kTypedVectorValue ) {
+            LispTypedVector * vec_a = a;
+            LispTypedVector * vec_b = b;
+            return vec_a->kind == vec_b->kind && vec_a->length == vec_b->length &&
+                memcmp(vec_a->value, vec_b->value, vec_a->length * typed_vector_element_size(vec_a->kind)) == 0;
+        } else if ( type == kVectorValue ) {
+            LispVector * vec_a = a;
+            LispVector * vec_b = b;
+            if ( vec_a->length != vec_b->length )
+                return false;
+            for ( size_t i = 0 ; i < vec_a->length ; i++ ) {
+                if ( !values_equal(vec_a->value[i], vec_b->value[i]) )
+                    return false;
+            }
+            return true;
+        } else {
+            return values_eqv(a, b);
+        }
+    }
+    return true;
+}
+
+static inline uint64_t mix_hash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static inline uint64_t combine_hash(uint64_t seed, uint64_t hash) {
+    return (seed ^ hash) * 0x100000001b3ULL;
+}
+
+// Hashes an address, noting whether it is young and will change when promoted.
+static inline uint64_t address_hash(void * address, bool * moves) {
+    if ( gc_is_young(address) )
+        *moves = true;
+    return (uint64_t)(size_t)address;
+}
+
+static uint64_t eqv_hash(LispValue * value, bool * moves) {
+    if ( !value || is_fixnum(value) )
+        return (uint64_t)(size_t)value;
+    return address_hash(value, moves);
+}
+
+static uint64_t structural_hash(LispValue * value, size_t * budget, bool * moves) {
+    uint64_t hash = 0;
+    for ( ; *budget ; (*budget)-- ) {
+        switch ( value_type(value) ) {
+            case kCellValue:
+                hash = combine_hash(hash, structural_hash(((LispCell *)value)->head, budget, moves));
+                value = ((LispCell *)value)->tail;
+                continue;
+            case kStringValue:
+                return combine_hash(hash, hash_symbol_of_length(value->value, ((LispString *)value)->length));
+            case kSymbolValue:
+                return combine_hash(hash, symbol_entry_of(value->value)->hash);
+            case kVectorValue: {
+                LispVector * vec = value;
+                hash = combine_hash(hash, vec->length);
+                for ( size_t i = 0 ; i < vec->length && *budget ; i++ )
+                    hash = combine_hash(hash, structural_hash(vec->value[i], budget, moves));
+                return hash;
+            }
+            case kTypedVectorValue: {
+                LispTypedVector * vec = value;
+                unsigned char * bytes = vec->value;
+                size_t size = vec->length * typed_vector_element_size(vec->kind);
+                hash = combine_hash(hash, vec->kind);
+                hash = combine_hash(hash, vec->length);
+                for ( size_t i = 0 ; i < size && *budget ; i++, (*budget)-- )
+                    hash = combine_hash(hash, bytes[i]);
+                return hash;
+            }
+            default:
+                return combine_hash(hash, eqv_hash(value, moves));
+        }
+    }
+    return hash;
+}
+
+uint64_t equal_hash(LispValue * value) {
+    size_t budget = EQUAL_HASH_LIMIT;
+    bool moves = false;
+    return mix_hash(structural_hash(value, &budget, &moves));
+}
+
+static uint64_t hash_key(LispHashTable * table, LispValue * key, bool * moves) {
+    size_t budget = EQUAL_HASH_LIMIT;
+    switch ( table->kind ) {
+        case kHashEq:
+            return mix_hash(address_hash(key, moves));
+        case kHashEqv:
+            return mix_hash(eqv_hash(key, moves));
+        default:
+            return mix_hash(structural_hash(key, &budget, moves));
+    }
+}
+
+static inline bool keys_match(LispHashTable * table, LispValue * a, LispValue * b) {
+    switch ( table->kind ) {
+        case kHashEq:
+            return a == b;
+        case kHashEqv:
+            return values_eqv(a, b);
+        default:
+            return values_equal(a, b);
+    }
+}
+
+// Returns the slot holding the key, or the slot it should go in if there is none:
+// the first removed one on its probe sequence, or else the empty one ending it.
+static LispHashEntry * find_slot(LispHashTable * table, LispValue * key, bool * moves) {
+    size_t mask = table->entries->capacity - 1;
+    LispHashEntry * free_slot = NULL;
+    for ( size_t index = hash_key(table, key, moves) & mask ; ; index = (index + 1) & mask ) {
+        LispHashEntry * slot = &table->entries->items[index];
+        if ( slot->key == HASH_EMPTY_KEY )
+            return free_slot ? free_slot : slot;
+        if ( slot->key == HASH_DELETED_KEY ) {
+            if ( !free_slot )
+                free_slot = slot;
+        } else if ( keys_match(table, slot->key, key) ) {
+            return slot;
+        }
+    }
+}
+
+static inline bool is_free_slot(LispHashEntry * slot) {
+    return slot->key == HASH_EMPTY_KEY || slot->key == HASH_DELETED_KEY;
+}
+
+static inline void note_key_moves(LispHashTable * table, bool moves) {
+    if ( !moves )
+        return;
+    table->young_keys = true;
+    table->young_keys_epoch = gc_stats().minor_collections;
+}
+
+// Moves the entries into a new array of the given capacity, dropping removed ones.
+// The keys are hashed once the array is allocated, so they are where they will stay
+// until the next minor collection.
+static void resize_table(LispHashTable * table, size_t capacity) {
+    size_t roots = gc_save_roots();
+    gc_protect(table);
+    LispHashEntries * new_entries = new_hash_entries(capacity);
+    LispHashEntries * old_entries = table->entries;
+    table->entries = new_entries;
+    table->used = table->count;
+    table->young_keys = false;
+    gc_write_barrier(table, new_entries);
+    bool moves = false;
+    for ( size_t i = 0 ; i < old_entries->capacity ; i++ ) {
+        LispHashEntry * old_slot = &old_entries->items[i];
+        if ( is_free_slot(old_slot) )
+            continue;
+        LispHashEntry * slot = find_slot(table, old_slot->key, &moves);
+        *slot = *old_slot;
+    }
+    note_key_moves(table, moves);
+    gc_restore_roots(roots);
+}
+
+static void rehash_moved_keys(LispHashTable * table) {
+    if ( table->young_keys && table->young_keys_epoch != gc_stats().minor_collections )
+        resize_table(table, table->entries->capacity);
+}
+
+void hash_table_mark_moved(LispHashTable * table) {
+    table->young_keys = true;
+    table->young_keys_epoch = gc_stats().minor_collections - 1;
+}
+
+bool hash_table_lookup(LispHashTable * table, LispValue * key, LispValue ** value) {
+    size_t roots = gc_save_roots();
+    gc_protect(table);
+    gc_protect(key);
+    rehash_moved_keys(table);
+    gc_restore_roots(roots);
+    bool moves = false;
+    LispHashEntry * slot = find_slot(table, key, &moves);
+    if ( is_free_slot(slot) )
+        return false;
+    *value = slot->value;
+    return true;
+}
+
+// Keeps the table at most three quarters full, counting removed entries, by
+// doubling it, or by clearing out the removed entries if that frees enough slots.
+void hash_table_insert(LispHashTable * table, LispValue * key, LispValue * value) {
+    size_t roots = gc_save_roots();
+    gc_protect(table);
+    gc_protect(key);
+    gc_protect(value);
+    rehash_moved_keys(table);
+    size_t capacity = table->entries->capacity;
+    if ( (table->used + 1) * 4 > capacity * 3 )
+        resize_table(table, (table->count + 1) * 2 > capacity ? capacity * 2 : capacity);
+    bool moves = false;
+    LispHashEntry * slot = find_slot(table, key, &moves);
+    if ( is_free_slot(slot) ) {
+        if ( slot->key == HASH_EMPTY_KEY )
+            table->used++;
+        table->count++;
+        slot->key = key;
+        gc_write_barrier(table->entries, key);
+        note_key_moves(table, moves);
+    }
+    slot->value = value;
+    gc_write_barrier(table->entries, value);
+    gc_restore_roots(roots);
+}
+
+bool hash_table_delete(LispHashTable * table, LispValue * key) {
+    size_t roots = gc_save_roots();
+    gc_protect(table);
+    gc_protect(key);
+    rehash_moved_keys(table);
+    gc_restore_roots(roots);
+    bool moves = false;
+    LispHashEntry * slot = find_slot(table, key, &moves);
+    if ( is_free_slot(slot) )
+        return false;
+    slot->key = HASH_DELETED_KEY;
+    slot->value = NULL;
+    table->count--;
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "./constructor.h"
+
+// Structural equality, as equal?: lists and vectors are equal if their elements
+// are, strings and typed vectors if their contents are, and anything else if it
+// is eqv?.
+bool values_eqv(LispValue * a, LispValue * b);
+bool values_equal(LispValue * a, LispValue * b);
+
+// A hash consistent with equal?. Only the first EQUAL_HASH_LIMIT parts of a value
+// are hashed, so hashing takes bounded time and stops on circular lists.
+#define EQUAL_HASH_LIMIT 64
+uint64_t equal_hash(LispValue * value);
+
+// These may allocate, to grow or rehash the table.
+bool hash_table_lookup(LispHashTable * table, LispValue * key, LispValue ** value);
+void hash_table_insert(LispHashTable * table, LispValue * key, LispValue * value);
+bool hash_table_delete(LispHashTable * table, LispValue * key);
+
+// Has the table rehashed before it is next used, for when its keys have all moved.
+void hash_table_mark_moved(LispHashTable * table);
+
+#endif // HASHTABLE_H
@@ -1,6 +1,40 @@
 #include "./helper.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 void exit_message(char * msg, int code) {
   printf("ERROR: %s\n", msg);
   exit(code);
 }
+
+// Returns the descriptor of the new file, or -1, and its name in temp_path, which
+// commit_temp_file frees.
+int open_temp_file(char * path, char ** temp_path) {
+  *temp_path = malloc(strlen(path) + strlen(".XXXXXX") + 1);
+  if ( !*temp_path )
+    exit_message("Error while allocating memory for file path.", -1);
+  strcpy(*temp_path, path);
+  strcat(*temp_path, ".XXXXXX");
+  int fd = mkstemp(*temp_path);
+  if ( fd < 0 ) {
+    free(*temp_path);
+    *temp_path = NULL;
+    return -1;
+  }
+  // mkstemp makes the file readable only by its owner, unlike fopen.
+  mode_t mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+  return fd;
+}
+
+// Renames the closed temporary file over path if it was written, and removes it if it
+// wasn't or can't be. Returns whether it was renamed.
+bool commit_temp_file(char * temp_path, char * path, bool written) {
+  bool renamed = written && rename(temp_path, path) == 0;
+  if ( !renamed )
+    unlink(temp_path);
+  free(temp_path);
+  return renamed;
+}
@@ -3,7 +3,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 void exit_message(char * msg, int code);
 
+// A file is written to a temporary file beside it and renamed over it once written,
+// so that processes writing the same file at once don't write over each other.
+int open_temp_file(char * path, char ** temp_path);
+bool commit_temp_file(char * temp_path, char * path, bool written);
+
 #endif // HELPER_H
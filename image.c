@@ -0,0 +1,537 @@
+#include "./helper.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./primitive.h"
+#include "./hashtable.h"
+#include "./vm.h"
+#include "./image.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "PSXIMG01"
+
+typedef struct ImageHeader {
+    char magic[8];
+    uint64_t record_count;
+    uint64_t special_count;
+    uint64_t global_count;
+    uint64_t macro_epoch;
+} ImageHeader;
+
+// Every object is written as a record, and numbered by its position among them. The
+// records of the objects looked up by name come first, then those of the objects
+// copied, then the globals.
+typedef enum ImageTag {
+    kImageSymbol,
+    kImageBuiltin,
+    kImageTrue,
+    kImageFalse,
+    kImageGlobalContext,
+    kImagePair,
+    kImageObject
+} ImageTag;
+
+// A record is followed by size bytes: the name of a symbol or primitive, NUL included,
+// or the fields of a pair or object. The characters of a string follow its fields,
+// extra_size of them counting the NUL. Both are padded to eight bytes.
+typedef struct ImageRecord {
+    uint32_t tag;
+    uint32_t kind;
+    uint32_t size;
+    uint32_t extra_size;
+} ImageRecord;
+
+typedef struct ImageGlobal {
+    void * symbol;
+    void * value;
+} ImageGlobal;
+
+// A field holding a heap object is written as the object's number, shifted so that
+// it is aligned and nonzero like a pointer. Anything else, such as a fixnum, NULL or
+// a sentinel, is written as it is.
+#define is_heap_pointer(word) ((word) && !((size_t)(word) & 7))
+#define encode_number(number) ((void *)(((size_t)(number) + 1) << 3))
+#define decode_number(word) (((size_t)(word) >> 3) - 1)
+
+#define padded_size(size) (((size_t)(size) + 7) & ~(size_t)7)
+
+typedef struct ObjectList {
+    void ** items;
+    size_t count;
+    size_t capacity;
+} ObjectList;
+
+// While saving, the objects found so far, looked up by name or copied, and a table
+// from their addresses to their places in those lists: twice the index, plus one for
+// the objects looked up by name.
+static ObjectList specials;
+static ObjectList copies;
+static void ** found_objects = NULL;
+static size_t * found_indices = NULL;
+static size_t found_capacity = 0;
+static size_t found_count = 0;
+static LispContext * global_ctx = NULL;
+
+// The object whose fields are being written, and the copy they are written to.
+static char * encoded_object = NULL;
+static char * encoded_copy = NULL;
+
+// While loading, the object each record was loaded as.
+static void ** loaded_objects = NULL;
+static size_t loaded_count = 0;
+
+static void push_object(ObjectList * list, void * obj) {
+    if ( list->count == list->capacity ) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->items = realloc(list->items, sizeof(void *) * list->capacity);
+        if ( !list->items )
+            exit_message("Error while allocating memory for heap image.", -1);
+    }
+    list->items[list->count++] = obj;
+}
+
+static size_t find_object_slot(void * obj) {
+    size_t mask = found_capacity - 1;
+    size_t slot = (size_t)((((uint64_t)(size_t)obj >> 3) * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    while ( found_objects[slot] && found_objects[slot] != obj )
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static void grow_found_objects() {
+    void ** old_objects = found_objects;
+    size_t * old_indices = found_indices;
+    size_t old_capacity = found_capacity;
+    found_capacity = old_capacity ? old_capacity * 2 : 4096;
+    found_objects = calloc(sizeof(void *), found_capacity);
+    found_indices = calloc(sizeof(size_t), found_capacity);
+    if ( !found_objects || !found_indices )
+        exit_message("Error while allocating memory for heap image.", -1);
+    for ( size_t i = 0 ; i < old_capacity ; i++ ) {
+        if ( !old_objects[i] )
+            continue;
+        size_t slot = find_object_slot(old_objects[i]);
+        found_objects[slot] = old_objects[i];
+        found_indices[slot] = old_indices[i];
+    }
+    free(old_objects);
+    free(old_indices);
+}
+
+// Objects that exist in every process before an image is loaded.
+static bool is_special(void * obj) {
+    if ( obj == global_ctx )
+        return true;
+    if ( gc_is_pair(obj) || gc_header_of(obj)->kind != kGCValue )
+        return false;
+    ValueType type = ((LispValue *)obj)->type;
+    return type == kSymbolValue || type == kBoolValue || type == kPrimitiveValue || type == kNativeValue;
+}
+
+static void find_object(void * obj) {
+    if ( !is_heap_pointer(obj) )
+        return;
+    if ( gc_is_stack_frame(obj) )
+        exit_message("Cannot save a heap image while a frame is on the frame stack.", -1);
+    if ( (found_count + 1) * 2 > found_capacity )
+        grow_found_objects();
+    size_t slot = find_object_slot(obj);
+    if ( found_objects[slot] )
+        return;
+    found_objects[slot] = obj;
+    found_count++;
+    if ( is_special(obj) ) {
+        found_indices[slot] = specials.count * 2 + 1;
+        push_object(&specials, obj);
+    } else {
+        found_indices[slot] = copies.count * 2;
+        push_object(&copies, obj);
+    }
+}
+
+static void find_slot_object(void ** slot) {
+    find_object(*slot);
+}
+
+// Returns the binding slots kept in the object itself, if it is a context whose
+// bindings haven't moved out or an entries array. Their names are interned names,
+// which are written as the numbers of their symbols.
+static LispContextEntry * own_context_items(void * obj, size_t * capacity) {
+    if ( gc_is_pair(obj) )
+        return NULL;
+    if ( gc_header_of(obj)->kind == kGCContext ) {
+        LispContext * ctx = obj;
+        *capacity = ctx->capacity;
+        return ctx->entries ? NULL : ctx->items;
+    }
+    if ( gc_header_of(obj)->kind == kGCContextEntries ) {
+        LispContextEntries * entries = obj;
+        *capacity = entries->capacity;
+        return entries->items;
+    }
+    return NULL;
+}
+
+static void find_context_names(void * obj) {
+    size_t capacity = 0;
+    LispContextEntry * items = own_context_items(obj, &capacity);
+    for ( size_t i = 0 ; items && i < capacity ; i++ ) {
+        if ( items[i].interned_name )
+            find_object(symbol_entry_of(items[i].interned_name)->symbol);
+    }
+}
+
+static size_t object_number(void * obj) {
+    size_t index = found_indices[find_object_slot(obj)];
+    return index & 1 ? index / 2 : specials.count + index / 2;
+}
+
+static void * encode_pointer(void * word) {
+    return is_heap_pointer(word) ? encode_number(object_number(word)) : word;
+}
+
+static void encode_slot(void ** slot) {
+    *(void **)(encoded_copy + ((char *)slot - encoded_object)) = encode_pointer(*slot);
+}
+
+static void encode_context_names(void * obj, char * copy) {
+    size_t capacity = 0;
+    LispContextEntry * items = own_context_items(obj, &capacity);
+    if ( !items )
+        return;
+    LispContextEntry * copy_items = (LispContextEntry *)(copy + ((char *)items - (char *)obj));
+    for ( size_t i = 0 ; i < capacity ; i++ ) {
+        if ( items[i].interned_name )
+            copy_items[i].interned_name = encode_number(object_number(symbol_entry_of(items[i].interned_name)->symbol));
+    }
+}
+
+static void write_padded(FILE * file, void * data, size_t size, size_t padded) {
+    static char zeros[8];
+    fwrite(data, 1, size, file);
+    fwrite(zeros, 1, padded - size, file);
+}
+
+static void write_record(FILE * file, ImageTag tag, unsigned int kind, size_t size, size_t extra_size) {
+    ImageRecord record = { tag, kind, size, extra_size };
+    fwrite(&record, sizeof(ImageRecord), 1, file);
+}
+
+static void write_special(FILE * file, LispValue * value) {
+    char * name = NULL;
+    size_t size = 0;
+    ImageTag tag = kImageGlobalContext;
+    if ( value != (LispValue *)global_ctx ) {
+        switch ( value->type ) {
+            case kSymbolValue:
+                tag = kImageSymbol;
+                name = value->value;
+                size = symbol_entry_of(name)->length + 1;
+                break;
+            case kBoolValue:
+                tag = ((LispBool *)value)->value ? kImageTrue : kImageFalse;
+                break;
+            case kPrimitiveValue:
+                tag = kImageBuiltin;
+                name = ((LispPrimitive *)value)->name;
+                size = strlen(name) + 1;
+                break;
+            default:
+                tag = kImageBuiltin;
+                name = ((LispNative *)value)->name;
+                size = strlen(name) + 1;
+                break;
+        }
+    }
+    write_record(file, tag, 0, size, 0);
+    write_padded(file, name, size, padded_size(size));
+}
+
+// Writes the object's fields with every pointer replaced by a number. Pointers into
+// the object itself and to buffers it owns are cleared, to be made again on loading.
+static void write_copy(FILE * file, void * obj, char ** scratch, size_t * scratch_size) {
+    size_t size = gc_is_pair(obj) ? GC_PAIR_SIZE : gc_header_of(obj)->size;
+    if ( size > *scratch_size ) {
+        *scratch_size = size * 2;
+        *scratch = realloc(*scratch, *scratch_size);
+        if ( !*scratch )
+            exit_message("Error while allocating memory for heap image.", -1);
+    }
+    char * copy = *scratch;
+    memcpy(copy, obj, size);
+    encoded_object = obj;
+    encoded_copy = copy;
+    gc_visit_fields(obj, encode_slot);
+    if ( gc_is_pair(obj) ) {
+        write_record(file, kImagePair, 0, size, 0);
+        write_padded(file, copy, size, size);
+        return;
+    }
+    LispString * str = NULL;
+    GCKind kind = gc_header_of(obj)->kind;
+    if ( kind == kGCValue ) {
+        switch ( ((LispValue *)obj)->type ) {
+            case kStringValue:
+            case kStringBuilderValue:
+                str = obj;
+                ((LispString *)copy)->value = NULL;
+                ((LispString *)copy)->capacity = str->value ? str->length + 1 : 0;
+                break;
+            case kVectorValue:
+            case kTypedVectorValue:
+                ((LispValue *)copy)->value = NULL;
+                break;
+            default:
+                break;
+        }
+    } else if ( kind == kGCContext && ((LispContext *)obj)->entries ) {
+        memset(((LispContext *)copy)->items, 0, sizeof(LispContextEntry) * ((LispContext *)obj)->capacity);
+    }
+    encode_context_names(obj, copy);
+    size_t extra_size = str && str->value ? str->length + 1 : 0;
+    write_record(file, kImageObject, kind, size, extra_size);
+    write_padded(file, copy, size, padded_size(size));
+    if ( extra_size )
+        write_padded(file, str->value, str->length, padded_size(extra_size));
+}
+
+static void free_saving_state() {
+    free(specials.items);
+    free(copies.items);
+    free(found_objects);
+    free(found_indices);
+    specials = (ObjectList){ NULL, 0, 0 };
+    copies = (ObjectList){ NULL, 0, 0 };
+    found_objects = NULL;
+    found_indices = NULL;
+    found_capacity = 0;
+    found_count = 0;
+    global_ctx = NULL;
+}
+
+void save_image(char * filename, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    // Globals are written with their symbols, so every name is given one first. After
+    // this nothing allocates, so nothing moves while the objects are found and written.
+    for ( size_t i = 0 ; i < GLOBAL_SYM_TABLE->size ; i++ ) {
+        SymbolTableEntry * entry = GLOBAL_SYM_TABLE->entries[i];
+        if ( entry && !entry->symbol )
+            new_interned_symbol_of_length(entry->name, entry->length);
+    }
+    global_ctx = ctx;
+    size_t global_count = 0;
+    for ( size_t i = 0 ; i < GLOBAL_SYM_TABLE->size ; i++ ) {
+        SymbolTableEntry * entry = GLOBAL_SYM_TABLE->entries[i];
+        if ( !entry || !entry->bound )
+            continue;
+        find_object(entry->symbol);
+        find_object(entry->value);
+        global_count++;
+    }
+    for ( size_t i = 0 ; i < copies.count ; i++ ) {
+        gc_visit_fields(copies.items[i], find_slot_object);
+        find_context_names(copies.items[i]);
+    }
+
+    char * temp_path;
+    int fd = open_temp_file(filename, &temp_path);
+    FILE * file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if ( !file )
+        exit_message("Error while opening heap image for writing.", -1);
+    ImageHeader header;
+    memset(&header, 0, sizeof(ImageHeader));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.record_count = specials.count + copies.count;
+    header.special_count = specials.count;
+    header.global_count = global_count;
+    header.macro_epoch = macro_epoch;
+    fwrite(&header, sizeof(ImageHeader), 1, file);
+    for ( size_t i = 0 ; i < specials.count ; i++ )
+        write_special(file, specials.items[i]);
+    char * scratch = NULL;
+    size_t scratch_size = 0;
+    for ( size_t i = 0 ; i < copies.count ; i++ )
+        write_copy(file, copies.items[i], &scratch, &scratch_size);
+    free(scratch);
+    for ( size_t i = 0 ; i < GLOBAL_SYM_TABLE->size ; i++ ) {
+        SymbolTableEntry * entry = GLOBAL_SYM_TABLE->entries[i];
+        if ( !entry || !entry->bound )
+            continue;
+        ImageGlobal global = { encode_pointer(entry->symbol), encode_pointer(entry->value) };
+        fwrite(&global, sizeof(ImageGlobal), 1, file);
+    }
+    bool failed = ferror(file);
+    if ( !commit_temp_file(temp_path, filename, fclose(file) == 0 && !failed) )
+        exit_message("Error while writing heap image.", -1);
+    free_saving_state();
+    gc_restore_roots(roots);
+}
+
+static void * load_pointer(void * word) {
+    if ( !is_heap_pointer(word) )
+        return word;
+    size_t number = decode_number(word);
+    if ( number >= loaded_count )
+        exit_message("Corrupt heap image.", -1);
+    return loaded_objects[number];
+}
+
+static void relocate_slot(void ** slot) {
+    *slot = load_pointer(*slot);
+}
+
+static char * record_name(ImageRecord * record) {
+    char * name = (char *)(record + 1);
+    if ( !record->size || name[record->size - 1] )
+        exit_message("Corrupt heap image.", -1);
+    return name;
+}
+
+// Symbols may allocate, so these are all looked up before any object is copied.
+static void * load_special(ImageRecord * record) {
+    switch ( record->tag ) {
+        case kImageSymbol:
+            return new_interned_symbol_of_length(record_name(record), record->size - 1);
+        case kImageBuiltin: {
+            char * name = record_name(record);
+            SymbolTableEntry * entry = find_symbol(GLOBAL_SYM_TABLE, name);
+            if ( !entry || !entry->bound || (value_type(entry->value) != kPrimitiveValue && value_type(entry->value) != kNativeValue) ) {
+                printf("UNFOUND: %s\n", name);
+                exit_message("Heap image refers to an undefined primitive.", -1);
+            }
+            return entry->value;
+        }
+        case kImageTrue:
+            return TRUE_VALUE;
+        case kImageFalse:
+            return FALSE_VALUE;
+        default:
+            exit_message("Corrupt heap image.", -1);
+            return NULL;
+    }
+}
+
+static void * allocate_copy(ImageRecord * record) {
+    if ( record->tag == kImagePair && record->size == GC_PAIR_SIZE )
+        return gc_alloc_uncollected_pair();
+    if ( record->tag != kImageObject || record->kind < kGCValue || record->kind >= kGCForwarded || !record->size )
+        exit_message("Corrupt heap image.", -1);
+    return gc_alloc_uncollected(record->kind, record->size, record->kind == kGCBytecode);
+}
+
+// Fills in an allocated object from its record, making again the pointers that were
+// cleared when it was written.
+static void load_copy(ImageRecord * record, void * obj) {
+    memcpy(obj, record + 1, record->size);
+    if ( record->tag == kImageObject && record->kind == kGCValue ) {
+        LispValue * value = obj;
+        switch ( value->type ) {
+            case kStringValue:
+            case kStringBuilderValue: {
+                LispString * str = obj;
+                if ( record->extra_size && record->extra_size != str->length + 1 )
+                    exit_message("Corrupt heap image.", -1);
+                str->value = NULL;
+                if ( record->extra_size ) {
+                    str->value = malloc(record->extra_size);
+                    if ( !str->value )
+                        exit_message("Error while allocating memory for string.", -1);
+                    memcpy(str->value, (char *)(record + 1) + padded_size(record->size), record->extra_size);
+                }
+                break;
+            }
+            case kVectorValue:
+                value->value = (LispVector *)obj + 1;
+                break;
+            case kTypedVectorValue:
+                value->value = (LispTypedVector *)obj + 1;
+                break;
+            case kHashTableValue:
+                hash_table_mark_moved(obj);
+                break;
+            default:
+                break;
+        }
+    } else if ( record->tag == kImageObject && record->kind == kGCLambdaInfo && !vm_enabled ) {
+        ((LambdaInfo *)obj)->bytecode = NULL;
+    }
+    gc_visit_fields(obj, relocate_slot);
+    size_t capacity = 0;
+    LispContextEntry * items = own_context_items(obj, &capacity);
+    for ( size_t i = 0 ; items && i < capacity ; i++ ) {
+        LispSymbol * symbol = load_pointer(items[i].interned_name);
+        if ( symbol && value_type(symbol) != kSymbolValue )
+            exit_message("Corrupt heap image.", -1);
+        items[i].interned_name = symbol ? symbol->value : NULL;
+    }
+}
+
+void load_image(char * filename, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    int fd = open(filename, O_RDONLY);
+    struct stat image_stat;
+    if ( fd < 0 || fstat(fd, &image_stat) < 0 )
+        exit_message("Error while opening heap image.", -1);
+    size_t length = image_stat.st_size;
+    char * data = length >= sizeof(ImageHeader) ? mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if ( data == MAP_FAILED || memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC) - 1) != 0 )
+        exit_message("Not a heap image.", -1);
+    ImageHeader * header = (ImageHeader *)data;
+    if ( header->special_count > header->record_count || header->record_count > length / sizeof(ImageRecord) )
+        exit_message("Corrupt heap image.", -1);
+
+    loaded_count = header->record_count;
+    loaded_objects = malloc(sizeof(void *) * loaded_count);
+    ImageRecord ** records = malloc(sizeof(ImageRecord *) * loaded_count);
+    if ( !loaded_objects || !records )
+        exit_message("Error while allocating memory for heap image.", -1);
+    size_t position = sizeof(ImageHeader);
+    for ( size_t i = 0 ; i < loaded_count ; i++ ) {
+        if ( length - position < sizeof(ImageRecord) )
+            exit_message("Corrupt heap image.", -1);
+        records[i] = (ImageRecord *)(data + position);
+        position += sizeof(ImageRecord);
+        size_t size = padded_size(records[i]->size) + padded_size(records[i]->extra_size);
+        if ( length - position < size )
+            exit_message("Corrupt heap image.", -1);
+        position += size;
+    }
+    if ( (length - position) / sizeof(ImageGlobal) != header->global_count || (length - position) % sizeof(ImageGlobal) )
+        exit_message("Corrupt heap image.", -1);
+
+    // Interning may collect, and move the global context, so it is filled in afterwards.
+    for ( size_t i = 0 ; i < header->special_count ; i++ ) {
+        if ( records[i]->tag != kImageGlobalContext )
+            loaded_objects[i] = load_special(records[i]);
+    }
+    for ( size_t i = 0 ; i < header->special_count ; i++ ) {
+        if ( records[i]->tag == kImageGlobalContext )
+            loaded_objects[i] = ctx;
+    }
+    for ( size_t i = header->special_count ; i < loaded_count ; i++ )
+        loaded_objects[i] = allocate_copy(records[i]);
+    for ( size_t i = header->special_count ; i < loaded_count ; i++ )
+        load_copy(records[i], loaded_objects[i]);
+
+    ImageGlobal * globals = (ImageGlobal *)(data + position);
+    for ( size_t i = 0 ; i < header->global_count ; i++ ) {
+        LispSymbol * symbol = load_pointer(globals[i].symbol);
+        if ( value_type(symbol) != kSymbolValue )
+            exit_message("Corrupt heap image.", -1);
+        set_global_value(symbol_entry_of(symbol->value), load_pointer(globals[i].value));
+    }
+    macro_epoch = header->macro_epoch;
+
+    munmap(data, length);
+    free(records);
+    free(loaded_objects);
+    loaded_objects = NULL;
+    loaded_count = 0;
+    gc_restore_roots(roots);
+}
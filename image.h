@@ -0,0 +1,21 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "./constructor.h"
+#include "./context.h"
+
+// A heap image holds the globals of a running program and everything they reach,
+// so that a later run can start from them instead of evaluating the same
+// definitions again: psxlisp --save-image std.img std.scm, then --image std.img.
+// Objects are written with their pointers replaced by object numbers, and copied
+// into the heap and fixed up when the image is loaded. Symbols, booleans,
+// primitives and the global context exist in every process before an image is
+// loaded, so they are written by name and looked up again instead. An image can
+// only be loaded by the build that saved it.
+void save_image(char * filename, LispContext * ctx);
+
+// Loads the image into a global context that has just had the primitives defined
+// in it, binding the globals it holds.
+void load_image(char * filename, LispContext * ctx);
+
+#endif // IMAGE_H
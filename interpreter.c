@@ -2,62 +2,134 @@
 #include "./constructor.h"
 #include "./context.h"
 #include "./interpreter.h"
-#include <setjmp.h>
+#include "./resolver.h"
+#include "./vm.h"
+#include "./fasl.h"
 
-// Both the following functions are incredibly platform-specific and dirty and stinky.
-// Any potential ports will have to fit these to the memory layout of their target platform.
-// NOTE: program will crash in gdb unless you set disable-randomization to off because of these functions.
-// Like I said, dirty and stinky.
-LispValue * convert_to_jump_val(LispValue * val) {
-    if ( val == NULL )
-        return 2;
-    return val;
-}
-
-LispValue * convert_from_jump_val(LispValue * val) {
-    if ( val == 2 )
-        return NULL;
-    return 0x7FFF00000000 | (0xFFFFFFFF & (int)val); // <-- the dirty and stinky culprit
+// Returns the number of parameters, including a trailing rest parameter.
+size_t count_params(LispCell * params) {
+    size_t count = 0;
+    for ( LispCell * current_param = params ; current_param ; current_param = current_param->tail ) {
+        count++;
+        if ( value_type(current_param) != kCellValue )
+            break;
+    }
+    return count;
 }
 
-LispContext * new_context_from_args(LispCell * args, LispCell * params, LispContext * parent_ctx, LispLambda * parent_lam) {
+// Binds the parameters to the evaluated arguments in a frame that holds no bindings yet.
+static void bind_args(LispContext * frame, LispCell * args, LispCell * params) {
+    size_t roots = gc_save_roots();
     LispCell * current_arg = args;
     LispCell * current_param = params;
-    LispContext * new_ctx = new_context();
-    new_ctx->parent_lambda = parent_lam;
-    new_ctx->next = parent_ctx;
+    gc_protect(frame);
+    gc_protect(current_arg);
+    gc_protect(current_param);
     while ( current_param ) {
-        if ( current_param->head->type != kSymbolValue )
+        if ( value_type(current_param->head) != kSymbolValue )
             exit_message("Encountered non-symbol value in parameter list.", -1);
         LispSymbol * param_sym = current_param->head;
         if ( current_arg ) {
-            insert_context_entry(new_ctx, param_sym->value, current_arg->head);
+            insert_context_entry(frame, param_sym->value, current_arg->head);
             current_arg = current_arg->tail;
         } else {
-            insert_context_entry(new_ctx, param_sym->value, NULL);
+            insert_context_entry(frame, param_sym->value, NULL);
         }
         current_param = current_param->tail;
-        if ( current_param && current_param->type != kCellValue ) {
+        if ( current_param && value_type(current_param) != kCellValue ) {
             param_sym = current_param;
-            insert_context_entry(new_ctx, param_sym->value, current_arg);
-            return new_ctx;
+            insert_context_entry(frame, param_sym->value, current_arg);
+            gc_restore_roots(roots);
+            return;
         }
     }
     if ( current_arg )
         exit_message("Too many arguments passed to lambda.", -1);
+    gc_restore_roots(roots);
+}
+
+LispContext * new_context_from_args(LispCell * args, LispCell * params, LispContext * parent_ctx, LispLambda * parent_lam) {
+    size_t roots = gc_save_roots();
+    gc_protect(args);
+    gc_protect(params);
+    gc_protect(parent_ctx);
+    gc_protect(parent_lam);
+    LispContext * new_ctx = new_sized_context(count_params(params));
+    new_ctx->parent_lambda = parent_lam;
+    new_ctx->next = parent_ctx;
+    gc_write_barrier(new_ctx, parent_lam);
+    gc_write_barrier(new_ctx, parent_ctx);
+    bind_args(new_ctx, args, params);
+    gc_restore_roots(roots);
     return new_ctx;
 }
 
+// Creates an empty frame for a call of the lambda. It goes on the frame stack when
+// nothing in the lambda's body can capture it, unless the frame stack is full.
+LispContext * new_lambda_frame(LispLambda * lambda) {
+    LambdaInfo * info = lambda->value;
+    size_t frame_size = info->frame_size ? info->frame_size : count_params(info->params);
+    LispContext * frame = NULL;
+    if ( info->stack_frame )
+        frame = new_stack_context(frame_size);
+    if ( !frame ) {
+        size_t roots = gc_save_roots();
+        gc_protect(lambda);
+        frame = new_sized_context(frame_size);
+        gc_restore_roots(roots);
+    }
+    frame->parent_lambda = lambda;
+    frame->next = lambda->ctx;
+    gc_write_barrier(frame, lambda);
+    gc_write_barrier(frame, lambda->ctx);
+    return frame;
+}
+
+// Resolves the lambda's body to lexical addresses on its first call, once the globals
+// it uses are defined, and compiles it to bytecode if the VM is enabled. A body with
+// macro calls expanded in it is resolved again from its source after a macro it may
+// have used is redefined.
+void resolve_lambda(LispLambda * lambda) {
+    LambdaInfo * info = lambda->value;
+    if ( info->resolved && (!info->source || info->macro_epoch == macro_epoch) )
+        return;
+    if ( info->resolved ) {
+        info->code = info->source;
+        info->source = NULL;
+        info->bytecode = NULL;
+        info->resolved = false;
+    }
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    LispCell * resolved_code = resolve_lambda_body(lambda);
+    lambda->value->code = resolved_code;
+    lambda->value->resolved = true;
+    gc_write_barrier(lambda->value, resolved_code);
+    if ( vm_enabled ) {
+        LispBytecode * bytecode = compile_lambda(lambda);
+        lambda->value->bytecode = bytecode;
+    }
+    gc_restore_roots(roots);
+}
+
 LispValue * eval_args(LispCell * args, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    LispCell * current_arg = args;
+    gc_protect(ctx);
+    gc_protect(current_arg);
     LispCell * new_root_args = new_lisp_cell(NULL, NULL);
     LispCell * new_current_arg = new_root_args;
     LispCell * new_last_arg = NULL;
-    LispCell * current_arg = args;
+    gc_protect(new_root_args);
+    gc_protect(new_current_arg);
+    gc_protect(new_last_arg);
     while ( current_arg ) {
         new_last_arg = new_current_arg;
-        new_current_arg = extend_cell(new_current_arg, eval(current_arg->head, ctx));
+        LispValue * arg_value = eval(current_arg->head, ctx);
+        new_current_arg = extend_cell(new_current_arg, arg_value);
         current_arg = current_arg->tail;
     }
+    gc_restore_roots(roots);
     if ( new_root_args->head ) {
         new_last_arg->tail = NULL;
         return new_root_args;
@@ -66,88 +138,454 @@ LispValue * eval_args(LispCell * args, LispContext * ctx) {
     }
 }
 
-LispValue * eval_lambda(LispLambda * lambda, LispCell * args, LispContext * ctx) {
-    LispContext * lambda_ctx = new_context_from_args(eval_args(args, ctx), lambda->value->params, lambda->ctx, lambda);
-    return eval_seq(lambda->value->code, lambda_ctx);
+// Creates the frame for a call of the lambda and evaluates the arguments in the caller's
+// context straight into its slots, rather than into a list first.
+static LispContext * eval_args_into_frame(LispLambda * lambda, LispCell * args, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    gc_protect(args);
+    gc_protect(ctx);
+    resolve_lambda(lambda);
+    LispContext * lambda_ctx = new_lambda_frame(lambda);
+    LispCell * current_arg = args;
+    LispCell * current_param = lambda->value->params;
+    gc_protect(lambda_ctx);
+    gc_protect(current_arg);
+    gc_protect(current_param);
+    while ( current_param ) {
+        if ( value_type(current_param->head) != kSymbolValue )
+            exit_message("Encountered non-symbol value in parameter list.", -1);
+        LispValue * arg_value = NULL;
+        if ( current_arg ) {
+            arg_value = eval(current_arg->head, ctx);
+            current_arg = current_arg->tail;
+        }
+        insert_context_entry(lambda_ctx, ((LispSymbol *)current_param->head)->value, arg_value);
+        current_param = current_param->tail;
+        if ( current_param && value_type(current_param) != kCellValue ) {
+            LispCell * rest_args = eval_args(current_arg, ctx);
+            insert_context_entry(lambda_ctx, ((LispSymbol *)current_param)->value, rest_args);
+            current_arg = NULL;
+            break;
+        }
+    }
+    if ( current_arg )
+        exit_message("Too many arguments passed to lambda.", -1);
+    gc_restore_roots(roots);
+    return lambda_ctx;
+}
+
+// Creates the frame for a call of the lambda with already evaluated arguments.
+static LispContext * bind_args_into_frame(LispLambda * lambda, LispCell * evaled_args) {
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    gc_protect(evaled_args);
+    resolve_lambda(lambda);
+    LispContext * lambda_ctx = new_lambda_frame(lambda);
+    bind_args(lambda_ctx, evaled_args, lambda->value->params);
+    gc_restore_roots(roots);
+    return lambda_ctx;
+}
+
+// Creates the frame for a call of the lambda with evaluated arguments in an array.
+static LispContext * bind_argv_into_frame(LispLambda * lambda, LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    resolve_lambda(lambda);
+    LispContext * lambda_ctx = new_lambda_frame(lambda);
+    LispCell * current_param = lambda->value->params;
+    LispCell * rest_args = NULL;
+    size_t arg_index = 0;
+    gc_protect(lambda_ctx);
+    gc_protect(current_param);
+    gc_protect(rest_args);
+    while ( current_param ) {
+        if ( value_type(current_param->head) != kSymbolValue )
+            exit_message("Encountered non-symbol value in parameter list.", -1);
+        LispValue * arg_value = arg_index < argc ? argv[arg_index++] : NULL;
+        insert_context_entry(lambda_ctx, ((LispSymbol *)current_param->head)->value, arg_value);
+        current_param = current_param->tail;
+        if ( current_param && value_type(current_param) != kCellValue ) {
+            for ( size_t i = argc ; i > arg_index ; i-- )
+                rest_args = new_lisp_cell(argv[i - 1], rest_args);
+            insert_context_entry(lambda_ctx, ((LispSymbol *)current_param)->value, rest_args);
+            arg_index = argc;
+            break;
+        }
+    }
+    if ( arg_index < argc )
+        exit_message("Too many arguments passed to lambda.", -1);
+    gc_restore_roots(roots);
+    return lambda_ctx;
+}
+
+LispValue * const TAIL_CALL = (LispValue *)0x6;
+
+// Returns true for the forms the trampoline evaluates: lists and the nodes the
+// resolver compiles them into. Everything else evaluates without making a call.
+static inline bool is_call_form(LispValue * form) {
+    ValueType type = value_type(form);
+    return type == kCellValue || type == kCallNodeValue || type == kIfNodeValue;
+}
+
+// The evaluation a special form handed back to the trampoline, either a form to
+// evaluate in a context or a lambda to apply. It is taken as soon as the special
+// form returns, before anything can allocate.
+static struct {
+    LispValue * form;
+    LispContext * ctx;
+    LispLambda * lambda;
+    LispCell * args;
+} pending_tail_call;
+
+LispValue * tail_eval(LispValue * form, LispContext * ctx) {
+    if ( !is_call_form(form) )
+        return eval(form, ctx);
+    pending_tail_call.form = form;
+    pending_tail_call.ctx = ctx;
+    pending_tail_call.lambda = NULL;
+    pending_tail_call.args = NULL;
+    return TAIL_CALL;
+}
+
+LispValue * tail_apply(LispLambda * lambda, LispCell * evaled_args) {
+    pending_tail_call.form = NULL;
+    pending_tail_call.ctx = NULL;
+    pending_tail_call.lambda = lambda;
+    pending_tail_call.args = evaled_args;
+    return TAIL_CALL;
+}
+
+static void take_pending_tail_call(LispValue ** form, LispContext ** ctx, LispLambda ** lambda, LispCell ** args) {
+    *form = pending_tail_call.form;
+    *ctx = pending_tail_call.ctx;
+    *lambda = pending_tail_call.lambda;
+    *args = pending_tail_call.args;
+}
+
+// Makes the frame just created for a tail call replace the frames the trampoline
+// pushed before it, which nothing can refer to any more: frames on the frame stack
+// are never captured. Returns the frame's address after the move.
+LispContext * replace_frames(LispContext * frame, size_t frame_mark) {
+    if ( gc_is_stack_frame(frame) )
+        return gc_slide_frame(frame, frame_mark);
+    gc_pop_frames(frame_mark);
+    return frame;
+}
+
+// Calls a native with evaluated arguments, which the caller protects.
+LispValue * call_native(LispNative * native, LispValue ** argv, size_t argc) {
+    if ( native->arity >= 0 && argc != (size_t)native->arity ) {
+        printf("PRIMITIVE: %s\n", native->name);
+        exit_message("Wrong number of arguments passed to primitive.", -1);
+    }
+    return native->value(argv, argc);
+}
+
+// Evaluates the arguments of a native call into an array, which is on the C stack
+// unless there are a lot of them, and calls the native. Each argument is protected
+// while the ones after it are evaluated, so a call with one argument needs no roots.
+static LispValue * eval_native_call(LispNative * native, LispCell * args, size_t argc, LispContext * ctx) {
+    if ( argc == 1 ) {
+        LispValue * arg = eval(args->head, ctx);
+        return call_native(native, &arg, 1);
+    }
+    size_t roots = gc_save_roots();
+    LispValue * stack_argv[NATIVE_STACK_ARGS];
+    LispValue ** argv = stack_argv;
+    if ( argc > NATIVE_STACK_ARGS ) {
+        argv = malloc(sizeof(LispValue *) * argc);
+        if ( !argv )
+            exit_message("Error while allocating memory for arguments.", -1);
+    }
+    gc_protect(args);
+    gc_protect(ctx);
+    for ( size_t i = 0 ; args ; args = args->tail, i++ ) {
+        argv[i] = eval(args->head, ctx);
+        if ( args->tail )
+            gc_protect(argv[i]);
+    }
+    LispValue * result = call_native(native, argv, argc);
+    if ( argv != stack_argv )
+        free(argv);
+    gc_restore_roots(roots);
+    return result;
 }
 
-LispValue * eval_macro(LispMacro * macro, LispCell * args, LispContext * ctx) {
+// Evaluates a call, or applies a lambda to evaluated arguments when given no form.
+// Calls in tail position don't recurse: a lambda's body, a macro's expansion and the
+// evaluation special forms hand back with TAIL_CALL are all evaluated by going around
+// this loop, so any chain of tail calls runs in constant C stack.
+static LispValue * trampoline(LispValue * form, LispContext * ctx, LispLambda * lambda, LispCell * evaled_args) {
+    size_t roots = gc_save_roots();
+    size_t frame_mark = gc_frame_mark();
+    LispValue * head = NULL;
+    LispValue * result = NULL;
+    gc_protect(form);
+    gc_protect(ctx);
+    gc_protect(lambda);
+    gc_protect(evaled_args);
+    gc_protect(head);
+    for ( ;; ) {
+        if ( lambda ) {
+            ctx = replace_frames(bind_args_into_frame(lambda, evaled_args), frame_mark);
+            if ( lambda->value->bytecode ) {
+                result = vm_run(ctx);
+                if ( result != TAIL_CALL )
+                    break;
+                take_pending_tail_call(&form, &ctx, &lambda, &evaled_args);
+                result = NULL;
+                continue;
+            }
+            form = eval_all_but_last(lambda->value->code, ctx);
+            lambda = NULL;
+            evaled_args = NULL;
+        }
+        if ( !is_call_form(form) ) {
+            result = eval(form, ctx);
+            break;
+        }
+        if ( value_type(form) == kIfNodeValue ) {
+            LispIfNode * node = form;
+            LispValue * condition_value = eval(node->test, ctx);
+            node = form;
+            form = boolify_value(condition_value) ? node->consequent : node->alternative;
+            continue;
+        }
+        LispCell * args = NULL;
+        if ( value_type(form) == kCallNodeValue ) {
+            head = eval(((LispCallNode *)form)->head, ctx);
+            args = ((LispCallNode *)form)->args;
+        } else {
+            head = eval(((LispCell *)form)->head, ctx);
+            args = ((LispCell *)form)->tail;
+        }
+        if ( value_type(head) == kLambdaValue ) {
+            ctx = replace_frames(eval_args_into_frame(head, args, ctx), frame_mark);
+            if ( ((LispLambda *)head)->value->bytecode ) {
+                result = vm_run(ctx);
+                if ( result != TAIL_CALL )
+                    break;
+                take_pending_tail_call(&form, &ctx, &lambda, &evaled_args);
+                result = NULL;
+                continue;
+            }
+            form = eval_all_but_last(((LispLambda *)head)->value->code, ctx);
+        } else if ( value_type(head) == kNativeValue ) {
+            size_t argc = value_type(form) == kCallNodeValue ? ((LispCallNode *)form)->argc : cells_length(args);
+            result = eval_native_call(head, args, argc, ctx);
+            break;
+        } else if ( value_type(head) == kMacroValue ) {
+            form = expand_macro(head, args, ctx);
+        } else if ( value_type(head) == kPrimitiveValue ) {
+            PrimitiveFunPtr prim_ptr = head->value;
+            result = (*prim_ptr)(args, ctx);
+            if ( result != TAIL_CALL )
+                break;
+            take_pending_tail_call(&form, &ctx, &lambda, &evaled_args);
+            result = NULL;
+        } else {
+            printf("HEAD OF LIST: ");
+            print_value(head->value);
+            printf("\n");
+            exit_message("Encountered value other than lambda, macro, or primitive at head of list.", -1);
+        }
+    }
+    gc_pop_frames(frame_mark);
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Finishes the evaluation a special form handed back with TAIL_CALL.
+LispValue * run_pending_tail_call() {
+    return trampoline(pending_tail_call.form, pending_tail_call.ctx, pending_tail_call.lambda, pending_tail_call.args);
+}
+
+// Calls the lambda with already evaluated arguments.
+LispValue * apply_lambda(LispLambda * lambda, LispCell * evaled_args) {
+    return trampoline(NULL, NULL, lambda, evaled_args);
+}
+
+// Calls the lambda with evaluated arguments in an array, which the caller protects,
+// so that C code calling a procedure doesn't need to make a list of its arguments.
+LispValue * call_lambda(LispLambda * lambda, LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    size_t frame_mark = gc_frame_mark();
+    LispContext * frame = bind_argv_into_frame(lambda, argv, argc);
+    LispValue * result = NULL;
+    gc_protect(frame);
+    if ( frame->parent_lambda->value->bytecode ) {
+        result = vm_run(frame);
+        if ( result == TAIL_CALL )
+            result = run_pending_tail_call();
+    } else {
+        LispValue * form = eval_all_but_last(frame->parent_lambda->value->code, frame);
+        result = trampoline(form, frame, NULL, NULL);
+    }
+    gc_pop_frames(frame_mark);
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Calls a lambda or native with evaluated arguments in an array, which the caller protects.
+LispValue * call_procedure(LispValue * procedure, LispValue ** argv, size_t argc) {
+    if ( value_type(procedure) == kLambdaValue )
+        return call_lambda(procedure, argv, argc);
+    if ( value_type(procedure) == kNativeValue )
+        return call_native(procedure, argv, argc);
+    exit_message("Encountered value other than lambda or native called as a procedure.", -1);
+    return NULL;
+}
+
+// Returns the expansion of a macro call, built in a frame chained to the caller's context.
+LispValue * expand_macro(LispMacro * macro, LispCell * args, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    gc_protect(macro);
     LispContext * macro_ctx = new_context_from_args(args, macro->value->params, ctx, NULL);
-    return eval(eval_seq(macro->value->template, macro_ctx), ctx);
+    LispValue * expansion = eval_seq(macro->value->template, macro_ctx);
+    gc_restore_roots(roots);
+    return expansion;
 }
 
 LispValue * eval_cell(LispCell * cell, LispContext * ctx) {
     if ( !cell )
         return NULL;
-    LispValue * first_val = eval(cell->head, ctx);
-    LispValue * other_vals = cell->tail;
-    if ( first_val->type == kLambdaValue ) {
-        return eval_lambda(first_val, other_vals, ctx);
-    } else if ( first_val->type == kMacroValue ) {
-        return eval_macro(first_val, other_vals, ctx);
-    } else if ( first_val->type == kPrimitiveValue ) {
-        PrimitiveFunPtr prim_ptr = first_val->value;
-        return (*prim_ptr)(other_vals, ctx);
-    }
-    printf("HEAD OF LIST: ");
-    print_value(eval(cell->head, ctx)->value);
-    printf("\n");
-    exit_message("Encountered value other than lambda, macro, or primitive at head of list.", -1);
+    return trampoline(cell, ctx, NULL, NULL);
 }
 
-LispValue * eval_seq(LispCell * cell, LispContext * ctx) {
-    ctx->tco_buf = calloc(sizeof(jmp_buf), 1);
-    int return_val = setjmp(ctx->tco_buf);
-    //printf("TCO ENV HAS BEEN SET: 0x%x\n", ctx->tco_buf);
-    //printf("SETJMP RETURN VALUE: 0x%x\n\n", return_val);
-    if ( return_val ) {
-        //printf("NESTED TAIL CALL!!!\n");
-        //print_value(return_val);
-        LispContext * new_ctx = new_context_from_args(convert_from_jump_val(return_val), ctx->parent_lambda->value->params, ctx->parent_lambda->ctx, ctx->parent_lambda);
-        new_ctx->next = ctx;
-        new_ctx->tco_buf = ctx->tco_buf;
-        ctx = new_ctx;
-        //printf("\n");
-    }
-    //printf("EVAL SEQ\n");
-    //printf("TCO ENV: 0x%x\n", ctx->tco_buf);
-    //printf("PARENT LAMBDA: ");
-    //print_value_raw(ctx->parent_lambda);
-    //printf("\n");
-    tail_call_goto:;
-    LispCell * current_cell = cell;
-    LispValue * last_value = NULL;
-    while ( current_cell ) {
-        LispLambda * current_cell_head = eval(current_cell->head->value, ctx);
-        if ( !current_cell->tail && current_cell_head == ctx->parent_lambda ) {
-            //printf("TAIL CALL!\n");
-            LispContext * new_ctx = new_context_from_args(eval_args(((LispCell *)current_cell->head)->tail, ctx), ctx->parent_lambda->value->params, ctx->parent_lambda->ctx, ctx->parent_lambda);
-            current_cell = cell;
-            new_ctx->next = ctx;
-            ctx = new_ctx;
-            goto tail_call_goto;
+// Evaluates a call node. Calls of primitives through a variable reference, by far
+// the most common, are made directly; the trampoline only takes over if the
+// primitive hands back a tail call, or for any other kind of call.
+static LispValue * eval_call_node(LispCallNode * node, LispContext * ctx) {
+    ValueType head_type = value_type(node->head);
+    if ( head_type == kGlobalRefValue || head_type == kLexicalRefValue ) {
+        LispValue * head = eval(node->head, ctx);
+        if ( value_type(head) == kNativeValue )
+            return eval_native_call(head, node->args, node->argc, ctx);
+        if ( value_type(head) == kPrimitiveValue ) {
+            PrimitiveFunPtr prim_ptr = head->value;
+            LispValue * result = (*prim_ptr)(node->args, ctx);
+            if ( result != TAIL_CALL )
+                return result;
+            return run_pending_tail_call();
         }
-        last_value = eval(current_cell->head, ctx);
-        current_cell = current_cell->tail;
     }
-    return last_value;
+    return trampoline(node, ctx, NULL, NULL);
+}
+
+// Evaluates every expression of a body except the last one, which is returned for the
+// caller to evaluate in tail position.
+LispValue * eval_all_but_last(LispCell * cell, LispContext * ctx) {
+    if ( !cell )
+        return NULL;
+    size_t roots = gc_save_roots();
+    LispCell * current_cell = cell;
+    gc_protect(current_cell);
+    gc_protect(ctx);
+    for ( ; current_cell->tail ; current_cell = current_cell->tail )
+        eval(current_cell->head, ctx);
+    gc_restore_roots(roots);
+    return current_cell->head;
+}
+
+// Evaluates a body of expressions and returns the value of the last one.
+LispValue * eval_seq(LispCell * cell, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispValue * last_form = eval_all_but_last(cell, ctx);
+    LispValue * result = eval(last_form, ctx);
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Evaluates the forms of a file one by one as they are read, and returns the value
+// of the last. The forms are read from the file's FASL cache if it is up to date, and
+// the cache is written as they are read from the file otherwise.
+LispValue * eval_file(char * filename, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    LispValue * form = NULL;
+    LispValue * result = NULL;
+    gc_protect(ctx);
+    gc_protect(form);
+    gc_protect(result);
+    FaslReader * fasl_reader = fasl_enabled ? open_fasl_reader(filename) : NULL;
+    if ( fasl_reader ) {
+        while ( read_fasl_form(fasl_reader, &form) )
+            result = eval(form, ctx);
+        close_fasl_reader(fasl_reader);
+        gc_restore_roots(roots);
+        return result;
+    }
+    Reader * reader = open_reader(filename);
+    FaslWriter * fasl_writer = fasl_enabled ? open_fasl_writer(filename) : NULL;
+    while ( construct_next_form(reader, &form) ) {
+        if ( fasl_writer )
+            write_fasl_form(fasl_writer, form);
+        result = eval(form, ctx);
+    }
+    if ( fasl_writer )
+        close_fasl_writer(fasl_writer);
+    close_reader(reader);
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lookup_symbol(LispSymbol * symbol, LispContext * ctx) {
+    size_t slot = 0;
+    LispContext * found_ctx = find_context_slot_all(ctx, symbol->value, &slot);
+    if ( found_ctx )
+        return context_value(found_ctx, slot);
+    SymbolTableEntry * global = find_global(symbol->value);
+    if ( !global ) {
+        print_context(ctx);
+        printf("UNFOUND: %s\n", symbol->value);
+        exit_message("Undefined symbol.", -1);
+    }
+    return global->value;
+}
+
+// Returns the frame holding the binding a lexical reference points to, or NULL if
+// that slot doesn't hold the referenced symbol, e.g. because it was defined out of
+// the order the resolver expected.
+LispContext * lexical_ref_frame(LispLexicalRef * ref, LispContext * ctx) {
+    LispContext * frame = ctx;
+    for ( unsigned int depth = ref->depth ; frame && depth ; depth-- )
+        frame = frame->next;
+    if ( frame && ref->slot < context_entry_count(frame) && context_name(frame, ref->slot) == ref->symbol->value )
+        return frame;
+    return NULL;
 }
 
 LispValue * eval(LispValue * value, LispContext * ctx) {
     if (!value)
         return NULL;
-    LispContextEntry * found_entry = NULL;
-    switch (value->type) {
+    switch (value_type(value)) {
         case kCellValue:
             return eval_cell(value, ctx);
+        case kCallNodeValue:
+            return eval_call_node(value, ctx);
+        case kIfNodeValue:
+            return trampoline(value, ctx, NULL, NULL);
+        case kConstantValue:
+            return ((LispConstant *)value)->value;
+        case kLambdaNodeValue:
+            return new_lisp_closure(((LispLambdaNode *)value)->info, ctx);
         case kSymbolValue:
-            found_entry = find_context_entry_all(ctx, value->value);
-            if ( !found_entry ) {
-                print_context(ctx);
-                printf("UNFOUND: %s\n", value->value);
-                exit_message("Undefined symbol.", -1);
-            }
-            return found_entry->value;
+            return lookup_symbol(value, ctx);
+        case kLexicalRefValue: {
+            LispLexicalRef * ref = value;
+            LispContext * frame = lexical_ref_frame(ref, ctx);
+            if ( frame )
+                return context_value(frame, ref->slot);
+            return lookup_symbol(ref->symbol, ctx);
+        }
+        case kGlobalRefValue: {
+            SymbolTableEntry * global = symbol_entry_of(((LispGlobalRef *)value)->symbol->value);
+            if ( global->bound )
+                return global->value;
+            return lookup_symbol(((LispGlobalRef *)value)->symbol, ctx);
+        }
         default:
             return value;
     }
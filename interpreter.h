@@ -4,14 +4,34 @@
 #include "./constructor.h"
 #include "./context.h"
 
-LispValue * convert_to_jump_val(LispValue * val);
-LispValue * convert_from_jump_val(LispValue * val);
+// Calls of natives with up to this many arguments evaluate them into an array on the C stack.
+#define NATIVE_STACK_ARGS 16
 
 LispContext * new_context_from_args(LispCell * args, LispCell * params, LispContext * parent_ctx, LispLambda * lam);
 LispValue * eval_cell(LispCell * cell, LispContext * ctx);
 LispValue * eval_seq(LispCell * cell, LispContext * ctx);
-LispValue * eval_lambda(LispLambda * lambda, LispCell * args, LispContext * ctx);
+LispValue * eval_file(char * filename, LispContext * ctx);
+LispValue * eval_all_but_last(LispCell * cell, LispContext * ctx);
+LispValue * expand_macro(LispMacro * macro, LispCell * args, LispContext * ctx);
+LispValue * apply_lambda(LispLambda * lambda, LispCell * evaled_args);
+LispValue * call_native(LispNative * native, LispValue ** argv, size_t argc);
+LispValue * call_lambda(LispLambda * lambda, LispValue ** argv, size_t argc);
+LispValue * call_procedure(LispValue * procedure, LispValue ** argv, size_t argc);
 LispValue * eval_args(LispCell * args, LispContext * ctx);
 LispValue * eval(LispValue * value, LispContext * ctx);
+LispValue * lookup_symbol(LispSymbol * symbol, LispContext * ctx);
+LispContext * lexical_ref_frame(LispLexicalRef * ref, LispContext * ctx);
+void resolve_lambda(LispLambda * lambda);
+LispContext * new_lambda_frame(LispLambda * lambda);
+LispContext * replace_frames(LispContext * frame, size_t frame_mark);
+
+// Special forms evaluate their tail position through the trampoline rather than
+// recursively: they return the result of one of these, which records what is left to
+// evaluate and returns TAIL_CALL. Only the trampoline that called the special form
+// ever sees TAIL_CALL, so no other caller of a special form needs to check for it.
+extern LispValue * const TAIL_CALL;
+LispValue * tail_eval(LispValue * form, LispContext * ctx);
+LispValue * tail_apply(LispLambda * lambda, LispCell * evaled_args);
+LispValue * run_pending_tail_call();
 
 #endif // INTERPRETER_H
@@ -3,39 +3,81 @@
 #include "./context.h"
 #include "./primitive.h"
 #include "./interpreter.h"
+#include "./vm.h"
+#include "./fasl.h"
+#include "./image.h"
+#include "./compiler.h"
 #include <stdio.h>
 
-LispValue * run_file(char * filename, LispContext * ctx) {
-  FILE * code_file = fopen(filename, "r");
-  fseek(code_file, 0, SEEK_END);
-  long code_size = ftell(code_file);
-  fseek(code_file, 0, SEEK_SET);
-  char * code_content = malloc(code_size + 1);
-  if ( !code_content ) {
-    exit_message("Error while allocating memory for code.", -1);
-  }
-  size_t chars_read = fread(code_content, 1, code_size, code_file);
-  if ( chars_read != code_size ) {
-    printf("Expected read characters: %d\n", code_size);
-    printf("Actual read characters: %d\n", chars_read);
-    fclose(code_file);
-    exit_message("File read error.", -1);
+typedef struct Options {
+  GCAllocator allocator;
+  char * filename;
+  char * output_filename;
+  char * image_filename;
+  char * save_image_filename;
+  bool compile;
+} Options;
+
+static void exit_usage() {
+  exit_message("Usage: psxlisp [--alloc=pool|--alloc=malloc] [--vm] [--no-fasl] [--image image] [--save-image image] file\n       psxlisp --compile file -o output.c", -1);
+}
+
+// Parses the options, which may come before or after the file. The file is - to read
+// the program from standard input.
+Options parse_options(int argc, char ** argv) {
+  Options options = { kGCPoolAllocator, NULL, NULL, NULL, NULL, false };
+  for ( int arg_index = 1 ; arg_index < argc ; arg_index++ ) {
+    if ( strcmp(argv[arg_index], "--alloc=pool") == 0 ) {
+      options.allocator = kGCPoolAllocator;
+    } else if ( strcmp(argv[arg_index], "--alloc=malloc") == 0 ) {
+      options.allocator = kGCMallocAllocator;
+    } else if ( strcmp(argv[arg_index], "--vm") == 0 ) {
+      vm_enabled = true;
+    } else if ( strcmp(argv[arg_index], "--no-fasl") == 0 ) {
+      fasl_enabled = false;
+    } else if ( strcmp(argv[arg_index], "--compile") == 0 ) {
+      options.compile = true;
+    } else if ( strcmp(argv[arg_index], "-o") == 0 && arg_index + 1 < argc ) {
+      options.output_filename = argv[++arg_index];
+    } else if ( strcmp(argv[arg_index], "--image") == 0 && arg_index + 1 < argc ) {
+      options.image_filename = argv[++arg_index];
+    } else if ( strcmp(argv[arg_index], "--save-image") == 0 && arg_index + 1 < argc ) {
+      options.save_image_filename = argv[++arg_index];
+    } else if ( (argv[arg_index][0] == '-' && argv[arg_index][1]) || options.filename ) {
+      printf("Unknown option: %s\n", argv[arg_index]);
+      exit_usage();
+    } else {
+      options.filename = argv[arg_index];
+    }
   }
-  fclose(code_file);
-  TokenList * code_tokens = tokenize(code_content);
-  LispCell * code_ast = construct_ast(code_tokens, NULL);
-  return eval_seq(code_ast, ctx);
+  if ( options.compile && !options.output_filename )
+    exit_usage();
+  return options;
 }
 
 int main (int argc, char ** argv) {
-  if (argc < 2)
+  Options options = parse_options(argc, argv);
+  if ( !options.filename )
     exit_message("No code provided.", -1);
+  gc_init(options.allocator);
+  if ( vm_enabled )
+    vm_init();
   init_global_symbol_table(200);
-  LispContext * ctx = new_context();
+  LispContext * ctx = NULL;
+  gc_register_root(&ctx);
+  ctx = new_context();
   init_primitive_defs(ctx);
-  LispValue * result = run_file(argv[1], ctx);
+  if ( options.image_filename )
+    load_image(options.image_filename, ctx);
+  if ( options.compile ) {
+    compile_file(options.filename, options.output_filename, ctx);
+    return 0;
+  }
+  LispValue * result = eval_file(options.filename, ctx);
   printf("=> ");
   print_value(result);
   printf("\n");
+  if ( options.save_image_filename )
+    save_image(options.save_image_filename, ctx);
   return 0;
 }
@@ -0,0 +1 @@
+gcc -Wno-format -Wno-incompatible-pointer-types -g -I. helper.c gc.c pool.c symbols.c tokenizer.c constructor.c context.c hashtable.c typedvector.c fasl.c image.c primitive.c interpreter.c resolver.c vm.c aot.c "$1" -o "${1%.c}"
@@ -1 +1 @@
-gcc -Wno-format -Wno-incompatible-pointer-types -g helper.c symbols.c tokenizer.c constructor.c context.c primitive.c interpreter.c repl.c -o psxlisp-repl
+gcc -Wno-format -Wno-incompatible-pointer-types -g helper.c gc.c pool.c symbols.c tokenizer.c constructor.c context.c hashtable.c typedvector.c fasl.c image.c primitive.c interpreter.c resolver.c vm.c repl.c -o psxlisp-repl
@@ -0,0 +1 @@
+gcc -O2 -Wno-format -Wno-incompatible-pointer-types -g helper.c tokenizer.c tokenizer-bench.c -o tokenizer-bench
@@ -0,0 +1,52 @@
+#include "./helper.h"
+#include "./pool.h"
+
+#define free_link(slot) (((void ***)(slot))[1])
+
+void init_pool(Pool * pool, size_t slot_size) {
+    if ( slot_size < 2 * sizeof(void *) )
+        exit_message("Pool slots must be able to hold a free list link.", -1);
+    pool->slot_size = slot_size;
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->slab_count = 0;
+}
+
+// Allocates a new zeroed slab and threads all of its slots onto the pool's free list.
+PoolSlab * new_pool_slab(Pool * pool) {
+    PoolSlab * slab = calloc(POOL_SLAB_SIZE, 1);
+    if ( !slab )
+        exit_message("Error while allocating pool slab.", -1);
+    slab->slot_count = (POOL_SLAB_SIZE - sizeof(PoolSlab)) / pool->slot_size;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    for ( size_t i = slab->slot_count ; i > 0 ; i-- )
+        pool_free(pool, pool_slot(pool, slab, i - 1));
+    return slab;
+}
+
+// Unlinks the slab from the pool and returns its memory. None of its slots may be
+// on the free list.
+void release_pool_slab(Pool * pool, PoolSlab * slab, PoolSlab * prev_slab) {
+    if ( prev_slab ) {
+        prev_slab->next = slab->next;
+    } else {
+        pool->slabs = slab->next;
+    }
+    pool->slab_count--;
+    free(slab);
+}
+
+void * pool_alloc(Pool * pool) {
+    if ( !pool->free_list )
+        new_pool_slab(pool);
+    void ** slot = pool->free_list;
+    pool->free_list = free_link(slot);
+    return slot;
+}
+
+void pool_free(Pool * pool, void * slot) {
+    free_link(slot) = pool->free_list;
+    pool->free_list = slot;
+}
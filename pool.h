@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdlib.h>
+
+// Size of every slab handed out by a pool, including the slab header.
+#define POOL_SLAB_SIZE (64 * 1024)
+
+typedef struct PoolSlab {
+    struct PoolSlab * next;
+    size_t slot_count;
+    char slots[];
+} PoolSlab;
+
+// A pool carves fixed-size slots out of slabs. Free slots are threaded through
+// their second word, so the first word stays available for the owner to tag
+// the slot as free.
+typedef struct Pool {
+    size_t slot_size;
+    PoolSlab * slabs;
+    void ** free_list;
+    size_t slab_count;
+} Pool;
+
+void init_pool(Pool * pool, size_t slot_size);
+void * pool_alloc(Pool * pool);
+void pool_free(Pool * pool, void * slot);
+PoolSlab * new_pool_slab(Pool * pool);
+void release_pool_slab(Pool * pool, PoolSlab * slab, PoolSlab * prev_slab);
+
+#define pool_slot(pool, slab, i) ((void *)((slab)->slots + (i) * (pool)->slot_size))
+
+#endif // POOL_H
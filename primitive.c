@@ -3,93 +3,121 @@
 #include "./constructor.h"
 #include "./context.h"
 #include "./interpreter.h"
+#include "./hashtable.h"
+#include "./typedvector.h"
 #include <math.h>
-#include <setjmp.h>
+#include <limits.h>
 
-#define for_each_cell(init_cell_name, init_cell) \
-    for ( LispCell * init_cell_name = init_cell ; init_cell_name ; init_cell_name = init_cell_name->tail )
+LispBool * TRUE_VALUE;
+LispBool * FALSE_VALUE;
 
 void define_primitive(char * name, PrimitiveFunPtr prim, LispContext * ctx) {
-    insert_context_entry_by_name(ctx, name, new_lisp_primitive(prim));
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispPrimitive * primitive = new_lisp_primitive(prim, name);
+    define_context_value_by_name(ctx, name, primitive);
+    gc_restore_roots(roots);
+}
+
+void define_native(char * name, NativeFunPtr function, int arity, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispNative * native = new_lisp_native(function, name, arity);
+    define_context_value_by_name(ctx, name, native);
+    gc_restore_roots(roots);
 }
 
 void define_symbol(char * name, LispValue * value, LispContext * ctx) {
-    insert_context_entry_by_name(ctx, name, value);
+    define_context_value_by_name(ctx, name, value);
 }
 
-LispValue * add(LispCell * args, LispContext * ctx) {
+LispValue * add(LispValue ** argv, size_t argc) {
     int total = 0;
-    for_each_cell(current_cell, args) {
-        LispNumber * current_number = eval(current_cell->head, ctx);
-        if ( current_number->type != kNumberValue )
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        if ( value_type(argv[i]) != kNumberValue )
             exit_message("Attempt to add non-number.", -1);
-        total += current_number->value;
+        total += fixnum_value(argv[i]);
     }
     return new_lisp_number(total);
 }
 
-LispValue * multiply(LispCell * args, LispContext * ctx) {
+LispValue * multiply(LispValue ** argv, size_t argc) {
     int total = 1;
-    for_each_cell(current_cell, args) {
-        LispNumber * current_number = eval(current_cell->head, ctx);
-        if ( current_number->type != kNumberValue )
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        if ( value_type(argv[i]) != kNumberValue )
             exit_message("Attempt to add non-number.", -1);
-        total *= current_number->value;
+        total *= fixnum_value(argv[i]);
     }
     return new_lisp_number(total);
 }
 
-LispValue * lisp_print(LispCell * args, LispContext * ctx) {
-    for_each_cell(current_cell, args) {
-        print_value(eval(current_cell->head, ctx));
+LispValue * lisp_print(LispValue ** argv, size_t argc) {
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        print_value(argv[i]);
         printf(" ");
     }
     printf("\n");
     return NULL;
 }
 
+LispValue * lisp_gc(LispValue ** argv, size_t argc) {
+    return new_lisp_number(gc_collect());
+}
+
 LispValue * lisp_define(LispCell * args, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
     LispSymbol * name_val = args->head;
     LispValue * def_val = eval(args->tail->value, ctx);
-    if ( name_val->type != kSymbolValue )
+    if ( value_type(name_val) != kSymbolValue )
         exit_message("Cannot define value of non-symbol.", -1);
-    LispContextEntry * found_entry = find_context_entry(ctx, name_val->value);
-    if ( found_entry ) {
-        found_entry->value = def_val;
-    } else {
-        insert_context_entry_by_name(ctx, name_val->value, def_val);
-    }
+    define_context_value(ctx, name_val->value, def_val);
+    gc_restore_roots(roots);
     return NULL;
 }
 
 LispValue * lisp_set(LispCell * args, LispContext * ctx) {
-    LispSymbol * name_val = args->head;
+    size_t roots = gc_save_roots();
+    gc_protect(args);
+    gc_protect(ctx);
     LispValue * set_val = eval(args->tail->value, ctx);
-    if ( name_val->type != kSymbolValue )
+    LispSymbol * name_val = args->head;
+    size_t found_slot = 0;
+    LispContext * found_ctx = NULL;
+    if ( value_type(name_val) == kLexicalRefValue ) {
+        LispLexicalRef * ref = (LispLexicalRef *)name_val;
+        found_ctx = lexical_ref_frame(ref, ctx);
+        found_slot = ref->slot;
+        name_val = ref->symbol;
+    } else if ( value_type(name_val) == kGlobalRefValue ) {
+        name_val = ((LispGlobalRef *)name_val)->symbol;
+    }
+    if ( value_type(name_val) != kSymbolValue )
         exit_message("Cannot set the value of non-symbol.", -1);
-    LispContextEntry * found_entry = find_context_entry_all(ctx, name_val->value);
-    if ( found_entry ) {
-        found_entry->value = set_val;
+    if ( !found_ctx )
+        found_ctx = find_context_slot_all(ctx, name_val->value, &found_slot);
+    if ( found_ctx ) {
+        set_context_value(found_ctx, found_slot, set_val);
     } else {
-        exit_message("Cannot set the value of variable that has not been defined.", -1);
+        SymbolTableEntry * global = find_global(name_val->value);
+        if ( !global )
+            exit_message("Cannot set the value of variable that has not been defined.", -1);
+        set_global_value(global, set_val);
     }
+    gc_restore_roots(roots);
     return NULL;
 }
 
-LispValue * lisp_eq(LispCell * args, LispContext * ctx) {
-    LispValue * a = eval(args->head, ctx);
-    LispValue * b = eval(args->tail->value, ctx);
-    return valueify_bool(a == b);
+LispValue * lisp_eq(LispValue ** argv, size_t argc) {
+    return valueify_bool(argv[0] == argv[1]);
+}
+
+LispValue * lisp_eqv(LispValue ** argv, size_t argc) {
+    return valueify_bool(values_eqv(argv[0], argv[1]));
 }
 
-LispValue * lisp_eqv(LispCell * args, LispContext * ctx) {
-    LispValue * a = eval(args->head, ctx);
-    LispValue * b = eval(args->tail->value, ctx);
-    if ( (!a && b) || (a && !b) )
-        return FALSE_VALUE;
-    if ( !a && !b )
-        return TRUE_VALUE;
-    return valueify_bool(a->value == b->value);
+LispValue * lisp_equal_p(LispValue ** argv, size_t argc) {
+    return valueify_bool(values_equal(argv[0], argv[1]));
 }
 
 LispValue * lisp_defun(LispCell * args, LispContext * ctx) {
@@ -97,60 +125,41 @@ LispValue * lisp_defun(LispCell * args, LispContext * ctx) {
     LispCell * def_body = args->tail;
     LispSymbol * name_val = name_and_params->head;
     LispCell * params = name_and_params->tail;
-    if ( name_val->type != kSymbolValue )
+    if ( value_type(name_val) != kSymbolValue )
         exit_message("Cannot define value of non-symbol.", -1);
-    if ( params && params->type != kCellValue )
+    if ( params && value_type(params) != kCellValue )
         exit_message("Invalid parameter list.", -1);
+    if ( context_on_frame_stack(ctx) )
+        exit_message("Cannot define a function inside a stack allocated frame.", -1);
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
     LispLambda * defun_lambda = new_lisp_lambda(def_body, params, ctx);
-    LispContextEntry * found_entry = find_context_entry(ctx, name_val->value);
-    if ( found_entry ) {
-        found_entry->value = defun_lambda;
-    } else {
-        insert_context_entry_by_name(ctx, name_val->value, defun_lambda);
-    }
+    define_context_value(ctx, name_val->value, defun_lambda);
+    gc_restore_roots(roots);
     return NULL;
 }
 
+// The last expression is evaluated in tail position.
 LispValue * lisp_begin(LispCell * args, LispContext * ctx) {
-    LispCell * last_expr = NULL;
-    for_each_cell(current_cell, args) {
-        if ( current_cell->tail ) {
-            eval(current_cell->head, ctx);
-        } else if ( !current_cell->tail ) {
-            last_expr = current_cell;
-        }
-    }
-    LispSymbol * last_lam = eval(last_expr->head->value, ctx);
-    if ( last_lam && last_lam == ctx->parent_lambda ) {
-        LispValue * jmpval = eval_args(((LispCell *)last_expr->head)->tail, ctx);
-        longjmp(ctx->tco_buf, convert_to_jump_val(jmpval));
-    }
-    return eval(last_expr->head, ctx);
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispValue * last_form = eval_all_but_last(args, ctx);
+    gc_restore_roots(roots);
+    return tail_eval(last_form, ctx);
 }
 
+// Whichever branch is taken is evaluated in tail position.
 LispValue * lisp_if(LispCell * args, LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(args);
+    gc_protect(ctx);
     LispValue * condition_value = eval(args->head, ctx);
+    gc_restore_roots(roots);
     LispCell * true_cell = args->tail;
-    LispLambda * true_cell_lam = NULL;
-    if ( true_cell->head->type == kCellValue )
-        true_cell_lam = eval(((LispCell * )true_cell->head)->head, ctx);
     LispCell * false_cell = true_cell->tail;
-    LispLambda * false_cell_lam = NULL;
-    if ( false_cell->head->type == kCellValue )
-        false_cell_lam = eval(((LispCell * )false_cell->head)->head, ctx);
-    if ( boolify_value(condition_value) ) {
-        if ( true_cell_lam && true_cell_lam == ctx->parent_lambda ) {
-            LispValue * jmpval = eval_args(((LispCell *)true_cell->head)->tail, ctx);
-            longjmp(ctx->tco_buf, convert_to_jump_val(jmpval));
-        }
-        return eval(true_cell->head, ctx);
-    } else {
-        if ( false_cell_lam && false_cell_lam == ctx->parent_lambda ) {
-            LispValue * jmpval = eval_args(((LispCell *)false_cell->head)->tail, ctx);
-            longjmp(ctx->tco_buf, convert_to_jump_val(jmpval));
-        }
-        return eval(false_cell->head, ctx);
-    }
+    if ( boolify_value(condition_value) )
+        return tail_eval(true_cell->head, ctx);
+    return tail_eval(false_cell ? false_cell->head : NULL, ctx);
 }
 
 LispValue * lisp_quote(LispCell * args, LispContext * ctx) {
@@ -159,49 +168,156 @@ LispValue * lisp_quote(LispCell * args, LispContext * ctx) {
     return args->head;
 }
 
-LispCell * eval_unquotes(LispCell * args, LispContext * ctx) {
-    LispCell * new_root = new_lisp_cell(NULL, NULL);
-    LispCell * new_current_cell = new_root;
-    for_each_cell(current_cell, args) {
-        LispValue * current_head = current_cell->head;
-        if ( current_head->type == kCellValue ) {
-            if ( strcmp(((LispCell *)current_head)->head->value, "unquote") == 0 ) {
-                new_current_cell->head = eval(((LispCell *)current_head)->tail->value, ctx);
-            } else if ( strcmp(((LispCell *)current_head)->head->value, "unquote-flatten") == 0) {
-                LispCell * flattened = eval(((LispCell *)current_head)->tail->value, ctx);
-                if ( flattened->type != kCellValue )
-                    exit_message("Non-list value passed to UNQUOTE-FLATTEN.", -1);
-                new_current_cell->head = flattened->head;
-                new_current_cell->tail = flattened->tail;
-                if ( flattened->tail ) {
-                    for_each_cell(current_flat_cell, flattened) {
-                        if ( !current_flat_cell->tail )
-                            new_current_cell = current_flat_cell;
-                    }
-                }
-            } else {
-                new_current_cell->head = eval_unquotes(current_head, ctx);
-            }
-        } else {
-            new_current_cell->head = current_head;
+// Quasiquote templates are compiled once into a plan, which is kept in an eq? table
+// keyed by the template. A plan is one of:
+//   (constant . datum), for a part of the template without unquotes, which is shared;
+//   (unquote . form), for a form whose value goes in its place;
+//   (list items . tail), for a list with unquotes in it, where each item is the plan
+//   of an element or (splice . form), and the tail is the rest of the template after
+//   the last item that isn't constant, which is shared.
+// Only the spine of a list up to its last unquote is consed when a plan is run.
+typedef enum QuasiquotePlanKind {
+    kPlanConstant,
+    kPlanUnquote,
+    kPlanSplice,
+    kPlanList
+} QuasiquotePlanKind;
+
+// The table of plans is replaced once it holds this many, so templates of code that
+// was generated and thrown away don't pile up.
+#define QUASIQUOTE_PLAN_LIMIT 4096
+
+static LispHashTable * quasiquote_plans = NULL;
+static char * unquote_name = NULL;
+static char * unquote_flatten_name = NULL;
+
+#define plan_kind(plan) fixnum_value(((LispCell *)(plan))->head)
+
+static void append_value(LispCell ** first_cell, LispCell ** last_cell, LispValue * value);
+
+static LispCell * new_plan(QuasiquotePlanKind kind, LispValue * value) {
+    return new_lisp_cell(make_fixnum(kind), value);
+}
+
+// Returns the interned name of the head of an unquote form, or NULL for any other value.
+static char * unquote_form_name(LispValue * value) {
+    if ( value_type(value) != kCellValue )
+        return NULL;
+    LispCell * form = value;
+    if ( value_type(form->head) != kSymbolValue || value_type(form->tail) != kCellValue )
+        return NULL;
+    char * name = ((LispSymbol *)form->head)->value;
+    return name == unquote_name || name == unquote_flatten_name ? name : NULL;
+}
+
+static LispCell * compile_quasiquote(LispValue * template) {
+    if ( value_type(template) != kCellValue )
+        return new_plan(kPlanConstant, template);
+    if ( unquote_form_name(template) == unquote_name )
+        return new_plan(kPlanUnquote, ((LispCell *)((LispCell *)template)->tail)->head);
+    size_t roots = gc_save_roots();
+    LispCell * current_cell = template;
+    LispCell * items = NULL;
+    LispCell * last_item = NULL;
+    LispCell * last_dynamic_item = NULL;
+    LispValue * tail = NULL;
+    LispCell * item = NULL;
+    gc_protect(template);
+    gc_protect(current_cell);
+    gc_protect(items);
+    gc_protect(last_item);
+    gc_protect(last_dynamic_item);
+    gc_protect(tail);
+    gc_protect(item);
+    for ( ; value_type(current_cell) == kCellValue ; current_cell = current_cell->tail ) {
+        LispValue * element = current_cell->head;
+        if ( unquote_form_name(element) == unquote_flatten_name )
+            item = new_plan(kPlanSplice, ((LispCell *)((LispCell *)element)->tail)->head);
+        else
+            item = compile_quasiquote(element);
+        append_value(&items, &last_item, item);
+        if ( plan_kind(item) != kPlanConstant ) {
+            last_dynamic_item = last_item;
+            tail = current_cell->tail;
         }
-        if ( current_cell->tail ) {
-            new_current_cell->tail = new_lisp_cell(NULL, NULL);
-            new_current_cell = new_current_cell->tail;
+    }
+    LispCell * plan = NULL;
+    if ( last_dynamic_item ) {
+        last_dynamic_item->tail = NULL;
+        plan = new_plan(kPlanList, new_lisp_cell(items, tail));
+    } else {
+        plan = new_plan(kPlanConstant, template);
+    }
+    gc_restore_roots(roots);
+    return plan;
+}
+
+static LispValue * run_quasiquote_plan(LispCell * plan, LispContext * ctx) {
+    if ( plan_kind(plan) == kPlanConstant )
+        return plan->tail;
+    if ( plan_kind(plan) == kPlanUnquote )
+        return eval(plan->tail, ctx);
+    size_t roots = gc_save_roots();
+    LispCell * items = ((LispCell *)plan->tail)->head;
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    LispValue * value = NULL;
+    LispValue * tail = ((LispCell *)plan->tail)->tail;
+    gc_protect(plan);
+    gc_protect(ctx);
+    gc_protect(items);
+    gc_protect(result);
+    gc_protect(last_cell);
+    gc_protect(value);
+    gc_protect(tail);
+    for ( ; items ; items = items->tail ) {
+        LispCell * item = items->head;
+        if ( plan_kind(item) != kPlanSplice ) {
+            value = run_quasiquote_plan(item, ctx);
+            append_value(&result, &last_cell, value);
+            continue;
         }
+        value = eval(item->tail, ctx);
+        if ( value && value_type(value) != kCellValue )
+            exit_message("Non-list value passed to UNQUOTE-FLATTEN.", -1);
+        // A list spliced in at the very end becomes the tail of the result as it is.
+        if ( !items->tail && !((LispCell *)plan->tail)->tail ) {
+            tail = value;
+            break;
+        }
+        for ( ; value_type(value) == kCellValue ; value = ((LispCell *)value)->tail )
+            append_value(&result, &last_cell, ((LispCell *)value)->head);
     }
-    return new_root;
+    gc_restore_roots(roots);
+    if ( !last_cell )
+        return tail;
+    last_cell->tail = tail;
+    gc_write_barrier(last_cell, tail);
+    return result;
 }
 
 LispValue * lisp_quasiquote(LispCell * args, LispContext * ctx) {
-    if ( args->head->type != kCellValue )
+    if ( value_type(args->head) != kCellValue )
         return lisp_quote(args, ctx);
-    return eval_unquotes(args->head, ctx);
+    size_t roots = gc_save_roots();
+    LispValue * plan = NULL;
+    gc_protect(args);
+    gc_protect(ctx);
+    gc_protect(plan);
+    if ( !hash_table_lookup(quasiquote_plans, args->head, &plan) ) {
+        plan = compile_quasiquote(args->head);
+        if ( quasiquote_plans->count >= QUASIQUOTE_PLAN_LIMIT )
+            quasiquote_plans = new_lisp_hash_table(kHashEq);
+        hash_table_insert(quasiquote_plans, args->head, plan);
+    }
+    LispValue * result = run_quasiquote_plan(plan, ctx);
+    gc_restore_roots(roots);
+    return result;
 }
 
-LispValue * lisp_car(LispCell * args, LispContext * ctx) {
-    LispCell * cell = eval(args->head, ctx);
-    if ( cell->type != kCellValue ) {
+LispValue * lisp_car(LispValue ** argv, size_t argc) {
+    LispCell * cell = argv[0];
+    if ( value_type(cell) != kCellValue ) {
         printf("ERROR VALUE: ");
         print_value(cell);
         printf("\n");
@@ -210,41 +326,42 @@ LispValue * lisp_car(LispCell * args, LispContext * ctx) {
     return cell->head;
 }
 
-LispValue * lisp_cdr(LispCell * args, LispContext * ctx) {
-    LispCell * cell = eval(args->head, ctx);
-    if ( cell->type != kCellValue )
+LispValue * lisp_cdr(LispValue ** argv, size_t argc) {
+    LispCell * cell = argv[0];
+    if ( value_type(cell) != kCellValue )
         exit_message("Non-list value passed to CDR.", -1);
     return cell->tail;
 }
 
-LispValue * lisp_cons(LispCell * args, LispContext * ctx) {
-    LispCell * new_cell = new_lisp_cell(NULL, NULL);
-    new_cell->head = eval(args->head, ctx);
-    new_cell->tail = eval(args->tail->value, ctx);
-    return new_cell;
+LispValue * lisp_cons(LispValue ** argv, size_t argc) {
+    return new_lisp_cell(argv[0], argv[1]);
 }
 
-LispValue * lisp_set_car(LispCell * args, LispContext * ctx) {
-    LispCell * pair = eval(args->head, ctx);
-    LispValue * new_car = eval(args->tail->value, ctx);
-    if ( pair->type != kCellValue )
+LispValue * lisp_set_car(LispValue ** argv, size_t argc) {
+    LispCell * pair = argv[0];
+    LispValue * new_car = argv[1];
+    if ( value_type(pair) != kCellValue )
         exit_message("Invalid pair or list passed to SET-CAR!", -1);
     pair->head = new_car;
+    gc_write_barrier(pair, new_car);
     return NULL;
 }
 
-LispValue * lisp_set_cdr(LispCell * args, LispContext * ctx) {
-    LispCell * pair = eval(args->head, ctx);
-    LispValue * new_cdr = eval(args->tail->value, ctx);
-    if ( pair->type != kCellValue )
+LispValue * lisp_set_cdr(LispValue ** argv, size_t argc) {
+    LispCell * pair = argv[0];
+    LispValue * new_cdr = argv[1];
+    if ( value_type(pair) != kCellValue )
         exit_message("Invalid pair or list passed to SET-CDR!", -1);
     pair->tail = new_cdr;
+    gc_write_barrier(pair, new_cdr);
     return NULL;
 }
 
 LispValue * lisp_lambda_func(LispCell * args, LispContext * ctx) {
     LispCell * lambda_params = args->head;
     LispCell * lambda_code = args->tail;
+    if ( context_on_frame_stack(ctx) )
+        exit_message("Cannot create a closure over a stack allocated frame.", -1);
     return new_lisp_lambda(lambda_code, lambda_params, ctx);
 }
 
@@ -252,214 +369,915 @@ LispValue * lisp_defmacro(LispCell * args, LispContext * ctx) {
     LispSymbol * macro_name = args->head->value;
     LispCell * macro_params = ((LispCell *)args->head)->tail;
     LispCell * macro_template = args->tail;
-    insert_context_entry(ctx, macro_name->value, new_lisp_macro(macro_template, macro_params, ctx));
+    if ( context_on_frame_stack(ctx) )
+        exit_message("Cannot define a macro inside a stack allocated frame.", -1);
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispMacro * macro = new_lisp_macro(macro_template, macro_params, ctx);
+    define_context_value(ctx, macro_name->value, macro);
+    gc_restore_roots(roots);
     return NULL;
 }
 
 // Splits the given list into two lists, one containing keys and the other containing values.
 // The returned cell's head contains the key list and the tail contains the value list.
 LispCell * split_assoc_list(LispCell * list) {
+    size_t roots = gc_save_roots();
     LispCell * current_cell = list;
-    LispCell * key_root = new_lisp_cell(NULL, NULL);
-    LispCell * key_list = key_root;
-    LispCell * val_root = new_lisp_cell(NULL, NULL);
-    LispCell * val_list = val_root;
+    LispCell * key_root = NULL;
+    LispCell * key_list = NULL;
+    LispCell * val_root = NULL;
+    LispCell * val_list = NULL;
+    gc_protect(current_cell);
+    gc_protect(key_root);
+    gc_protect(key_list);
+    gc_protect(val_root);
+    gc_protect(val_list);
+    LispValue * key = NULL;
+    LispValue * val = NULL;
+    gc_protect(val);
+    key_root = new_lisp_cell(NULL, NULL);
+    key_list = key_root;
+    val_root = new_lisp_cell(NULL, NULL);
+    val_list = val_root;
     while ( current_cell ) {
         LispCell * current_assoc = current_cell->head;
-        if ( !current_assoc || current_assoc->type != kCellValue )
+        if ( !current_assoc || value_type(current_assoc) != kCellValue )
             exit_message("Invalid assoc list.", -1);
+        key = current_assoc->head;
+        val = current_assoc->tail->value;
         if ( current_cell->tail ) {
-            key_list = extend_cell(key_list, current_assoc->head);
-            val_list = extend_cell(val_list, current_assoc->tail->value);
+            key_list = extend_cell(key_list, key);
+            val_list = extend_cell(val_list, val);
         } else {
-            key_list->head = current_assoc->head;
-            val_list->head = current_assoc->tail->value;
+            key_list->head = key;
+            val_list->head = val;
+            gc_write_barrier(key_list, key);
+            gc_write_barrier(val_list, val);
         }
         current_cell = current_cell->tail;
     }
-    return new_lisp_cell(key_root, val_root);
+    LispCell * pair_list = new_lisp_cell(key_root, val_root);
+    gc_restore_roots(roots);
+    return pair_list;
 }
 
 LispValue * lisp_let(LispCell * args, LispContext * ctx) {
     LispSymbol * let_name = NULL;
     LispCell * arg_list = NULL;
     LispCell * let_body = NULL;
-    if ( args->head->type == kSymbolValue ) {
+    if ( value_type(args->head) == kSymbolValue ) {
         let_name = args->head;
         arg_list = args->tail->value;
         let_body = ((LispCell*)args->tail)->tail;
-        if ( !arg_list || arg_list->type != kCellValue )
+        if ( !arg_list || value_type(arg_list) != kCellValue )
             exit_message("Invalid argument list in LET.", -1);
-    } else if ( args->head->type == kCellValue ) {
+    } else if ( value_type(args->head) == kCellValue ) {
         arg_list = args->head;
         let_body = args->tail;
     } else {
         exit_message("LET takes either a symbol or a list for the first argument.", -1);
     }
-    LispCell * pair_list = split_assoc_list(arg_list);
-    LispContext * let_ctx = new_context_from_args(eval_args(pair_list->tail, ctx), pair_list->head, ctx, NULL);
-    let_ctx->parent_lambda = ctx->parent_lambda;
+    if ( let_name && context_on_frame_stack(ctx) )
+        exit_message("Cannot create a named LET inside a stack allocated frame.", -1);
+    size_t roots = gc_save_roots();
+    LispContext * let_ctx = NULL;
+    gc_protect(ctx);
+    gc_protect(let_body);
+    gc_protect(let_ctx);
     if ( let_name ) {
+        LispCell * pair_list = split_assoc_list(arg_list);
+        gc_protect(pair_list);
+        LispCell * let_args = eval_args(pair_list->tail, ctx);
+        gc_protect(let_args);
+        // A named let calls a lambda bound to the name in a frame of its own, so
+        // its body runs in the same kind of frame on every iteration.
+        let_ctx = new_sized_context(1);
+        let_ctx->next = ctx;
+        gc_write_barrier(let_ctx, ctx);
         LispLambda * let_lam = new_lisp_lambda(let_body, pair_list->head, let_ctx);
-        insert_context_entry(let_ctx, let_name->value, let_lam);
-        let_ctx->parent_lambda = let_lam;
-        //return eval_lambda(let_lam, pair_list->tail, let_ctx);
+        size_t let_slot = insert_context_entry(let_ctx, let_name->value, let_lam);
+        gc_restore_roots(roots);
+        return tail_apply(context_value(let_ctx, let_slot), let_args);
+    }
+    // The values are evaluated straight into the let's frame, in the outer context.
+    LispCell * current_binding = arg_list;
+    gc_protect(current_binding);
+    let_ctx = new_sized_context(cells_length(arg_list));
+    let_ctx->next = ctx;
+    gc_write_barrier(let_ctx, ctx);
+    for ( ; current_binding ; current_binding = current_binding->tail ) {
+        LispCell * binding = current_binding->head;
+        if ( !binding || value_type(binding) != kCellValue || value_type(binding->tail) != kCellValue )
+            exit_message("Invalid assoc list.", -1);
+        if ( value_type(binding->head) != kSymbolValue )
+            exit_message("Encountered non-symbol value in parameter list.", -1);
+        LispValue * value = eval(binding->tail->value, ctx);
+        binding = current_binding->head;
+        insert_context_entry(let_ctx, ((LispSymbol *)binding->head)->value, value);
     }
-    return eval_seq(let_body, let_ctx);
+    LispValue * last_form = eval_all_but_last(let_body, let_ctx);
+    gc_restore_roots(roots);
+    return tail_eval(last_form, let_ctx);
 }
 
 LispValue * lisp_eval(LispCell * args, LispContext * ctx) {
     LispCell * eval_code = args->head;
     if ( args->tail )
         exit_message("EVAL takes only one argument.", -1);
-    return eval(eval(eval_code, ctx), ctx);
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    LispValue * evaled_code = eval(eval_code, ctx);
+    gc_restore_roots(roots);
+    return tail_eval(evaled_code, ctx);
 }
 
-LispValue * lisp_is_null(LispCell * args, LispContext * ctx) {
-    return valueify_bool(eval(args->head, ctx) == NULL);
+LispValue * lisp_is_null(LispValue ** argv, size_t argc) {
+    return valueify_bool(argv[0] == NULL);
 }
 
-LispValue * lisp_logical_not(LispCell * args, LispContext * ctx) {
-    if ( args->tail )
-        exit_message("NOT requires one argument.", -1);
-    return valueify_bool(!boolify_value(eval(args->head, ctx)));
-}
-
-LispValue * lisp_vector(LispCell * args, LispContext * ctx) {
-   size_t vector_len =  cells_length(args);
-   LispVector * new_vec = new_lisp_vector(vector_len);
-   int i = 0;
-   for_each_cell(current_cell, args) {
-        LispValue * evaled_arg = eval(current_cell->head, ctx);
-        new_vec->value[i].value = evaled_arg->value;
-        new_vec->value[i].type = evaled_arg->type;
-        new_vec->value[i].extra_value = evaled_arg->extra_value;
-        new_vec->value[i].refs = evaled_arg->refs;
-        i++;
-   }
-   return new_vec;
-}
-
-LispValue * lisp_vector_ref(LispCell * args, LispContext * ctx) {
-    LispVector * vec = eval(args->head, ctx);
-    LispNumber * idx = eval(args->tail->value, ctx);
-    if ( vec->type != kVectorValue )
+LispValue * lisp_logical_not(LispValue ** argv, size_t argc) {
+    return valueify_bool(!boolify_value(argv[0]));
+}
+
+LispValue * lisp_vector(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    for ( size_t i = 0 ; i < argc ; i++ )
+        gc_protect(argv[i]);
+    LispVector * new_vec = new_lisp_vector(argc);
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        new_vec->value[i] = argv[i];
+        gc_write_barrier(new_vec, argv[i]);
+    }
+    gc_restore_roots(roots);
+    return new_vec;
+}
+
+LispValue * lisp_vector_ref(LispValue ** argv, size_t argc) {
+    LispVector * vec = argv[0];
+    LispNumber * idx = argv[1];
+    if ( value_type(vec) != kVectorValue )
         exit_message("Non-vector value passed to VECTOR-REF.", -1);
-    if ( idx->type != kNumberValue )
+    if ( value_type(idx) != kNumberValue )
         exit_message("Non-number index passed to VECTOR-REF.", -1);
-    if ( idx->value >= vec->length || idx->value < 0 )
+    if ( fixnum_value(idx) >= vec->length || fixnum_value(idx) < 0 )
         exit_message("Index out of range passed to VECTOR-REF.", -1);
-    return &(vec->value[idx->value]);
+    return vec->value[fixnum_value(idx)];
 }
 
-LispValue * lisp_vector_set(LispCell * args, LispContext * ctx) {
-    LispVector * vec = eval(args->head, ctx);
-    LispNumber * idx = eval(args->tail->value, ctx);
-    LispValue * val = eval(((LispCell *)args->tail)->tail->value, ctx);
-    if ( vec->type != kVectorValue )
+LispValue * lisp_vector_set(LispValue ** argv, size_t argc) {
+    LispVector * vec = argv[0];
+    LispNumber * idx = argv[1];
+    LispValue * val = argv[2];
+    if ( value_type(vec) != kVectorValue )
         exit_message("Non-vector value passed to VECTOR-SET.", -1);
-    if ( idx->type != kNumberValue )
+    if ( value_type(idx) != kNumberValue )
         exit_message("Non-number index passed to VECTOR-SET.", -1);
-    if ( idx->value > vec->length || idx->value < 0 )
+    if ( fixnum_value(idx) >= vec->length || fixnum_value(idx) < 0 )
         exit_message("Index out of range passed to VECTOR-SET.", -1);
     if ( !val )
         exit_message("Cannot set vector element to NULL.", -1);
-    vec->value[idx->value].value = val->value;
-    vec->value[idx->value].type = val->type;
-    vec->value[idx->value].extra_value = val->extra_value;
-    vec->value[idx->value].refs = val->refs;
+    vec->value[fixnum_value(idx)] = val;
+    gc_write_barrier(vec, val);
     return NULL;
 }
 
-LispValue * lisp_vector_len(LispCell * args, LispContext * ctx) {
-    LispVector * vec = eval(args->head, ctx);
-    if ( vec->type != kVectorValue )
+LispValue * lisp_vector_len(LispValue ** argv, size_t argc) {
+    LispVector * vec = argv[0];
+    if ( value_type(vec) != kVectorValue )
         exit_message("Non-vector value passed to VECTOR-LENGTH.", -1);
     return new_lisp_number(vec->length);
 }
 
+// Adds a value to the end of the list whose first and last cells are given, which the
+// caller protects.
+static void append_value(LispCell ** first_cell, LispCell ** last_cell, LispValue * value) {
+    LispCell * cell = new_lisp_cell(value, NULL);
+    if ( *last_cell ) {
+        (*last_cell)->tail = cell;
+        gc_write_barrier(*last_cell, cell);
+    } else {
+        *first_cell = cell;
+    }
+    *last_cell = cell;
+}
+
+static size_t list_length(LispCell * list, char * message) {
+    size_t length = 0;
+    for ( ; list ; list = list->tail, length++ ) {
+        if ( value_type(list) != kCellValue )
+            exit_message(message, -1);
+    }
+    return length;
+}
+
+static LispCell * reverse_list(LispCell * list, char * message) {
+    size_t roots = gc_save_roots();
+    LispCell * result = NULL;
+    gc_protect(list);
+    gc_protect(result);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message(message, -1);
+        result = new_lisp_cell(list->head, result);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Calls the function with the value so far and each element in turn, from the left.
+static LispValue * fold_list(LispValue * function, LispCell * list, LispValue * initial, char * message) {
+    size_t roots = gc_save_roots();
+    LispValue * call_args[2] = { initial, NULL };
+    gc_protect(function);
+    gc_protect(list);
+    gc_protect(call_args[0]);
+    gc_protect(call_args[1]);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message(message, -1);
+        call_args[1] = list->head;
+        call_args[0] = call_procedure(function, call_args, 2);
+    }
+    gc_restore_roots(roots);
+    return call_args[0];
+}
+
+// Returns whether the function returns the given truth value for some element,
+// without calling it for the elements after that one.
+static bool find_truth_value(LispValue * function, LispCell * list, bool value, char * message) {
+    size_t roots = gc_save_roots();
+    LispValue * element = NULL;
+    gc_protect(function);
+    gc_protect(list);
+    gc_protect(element);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message(message, -1);
+        element = list->head;
+        if ( boolify_value(call_procedure(function, &element, 1)) == value ) {
+            gc_restore_roots(roots);
+            return true;
+        }
+    }
+    gc_restore_roots(roots);
+    return false;
+}
+
+static LispCell * drop_cells(LispCell * list, LispValue * count, char * number_message, char * range_message) {
+    if ( value_type(count) != kNumberValue )
+        exit_message(number_message, -1);
+    if ( fixnum_value(count) < 0 )
+        exit_message(range_message, -1);
+    for ( int i = fixnum_value(count) ; i > 0 ; i-- ) {
+        if ( value_type(list) != kCellValue )
+            exit_message(range_message, -1);
+        list = list->tail;
+    }
+    return list;
+}
+
+LispValue * lisp_map(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispValue * function = argv[0];
+    LispCell * list = argv[1];
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    LispValue * element = NULL;
+    gc_protect(function);
+    gc_protect(list);
+    gc_protect(result);
+    gc_protect(last_cell);
+    gc_protect(element);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message("Non-list value passed to MAP.", -1);
+        element = list->head;
+        element = call_procedure(function, &element, 1);
+        append_value(&result, &last_cell, element);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_filter(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispValue * function = argv[0];
+    LispCell * list = argv[1];
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    LispValue * element = NULL;
+    gc_protect(function);
+    gc_protect(list);
+    gc_protect(result);
+    gc_protect(last_cell);
+    gc_protect(element);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message("Non-list value passed to FILTER.", -1);
+        element = list->head;
+        if ( boolify_value(call_procedure(function, &element, 1)) )
+            append_value(&result, &last_cell, list->head);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_reduce(LispValue ** argv, size_t argc) {
+    return fold_list(argv[0], argv[1], argv[2], "Non-list value passed to REDUCE.");
+}
+
+// Like reduce, but from the right: the function is called with the fold of the rest
+// of the list first and the element second.
+LispValue * lisp_foldr(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispValue * function = argv[0];
+    LispValue * initial = argv[2];
+    gc_protect(function);
+    gc_protect(initial);
+    LispCell * reversed = reverse_list(argv[1], "Non-list value passed to FOLDR.");
+    LispValue * result = fold_list(function, reversed, initial, "Non-list value passed to FOLDR.");
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_length(LispValue ** argv, size_t argc) {
+    return new_lisp_number(list_length(argv[0], "Non-list value passed to LENGTH."));
+}
+
+LispValue * lisp_reverse(LispValue ** argv, size_t argc) {
+    return reverse_list(argv[0], "Non-list value passed to REVERSE.");
+}
+
+// Copies the first list, and shares the second as the tail of the result.
+LispValue * lisp_append(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispCell * list = argv[0];
+    LispValue * tail = argv[1];
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    gc_protect(list);
+    gc_protect(tail);
+    gc_protect(result);
+    gc_protect(last_cell);
+    for ( ; list ; list = list->tail ) {
+        if ( value_type(list) != kCellValue )
+            exit_message("Non-list value passed to APPEND.", -1);
+        append_value(&result, &last_cell, list->head);
+    }
+    gc_restore_roots(roots);
+    if ( !last_cell )
+        return tail;
+    last_cell->tail = tail;
+    gc_write_barrier(last_cell, tail);
+    return result;
+}
+
+LispValue * lisp_list_tail(LispValue ** argv, size_t argc) {
+    return drop_cells(argv[0], argv[1], "Non-number index passed to LIST-TAIL.", "Index out of range passed to LIST-TAIL.");
+}
+
+LispValue * lisp_list_ref(LispValue ** argv, size_t argc) {
+    LispCell * cell = drop_cells(argv[0], argv[1], "Non-number index passed to LIST-REF.", "Index out of range passed to LIST-REF.");
+    if ( value_type(cell) != kCellValue )
+        exit_message("Index out of range passed to LIST-REF.", -1);
+    return cell->head;
+}
+
+LispValue * lisp_last_pair(LispValue ** argv, size_t argc) {
+    LispCell * list = argv[0];
+    if ( value_type(list) != kCellValue )
+        exit_message("Non-list value passed to LAST-PAIR.", -1);
+    while ( value_type(list->tail) == kCellValue )
+        list = list->tail;
+    return list;
+}
+
+LispValue * lisp_andmap(LispValue ** argv, size_t argc) {
+    return valueify_bool(!find_truth_value(argv[0], argv[1], false, "Non-list value passed to ANDMAP."));
+}
+
+LispValue * lisp_ormap(LispValue ** argv, size_t argc) {
+    return valueify_bool(find_truth_value(argv[0], argv[1], true, "Non-list value passed to ORMAP."));
+}
+
+// Pairs up the elements of two lists in two-element lists, up to the end of the shorter.
+LispValue * lisp_zip(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispCell * keys = argv[0];
+    LispCell * values = argv[1];
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    LispCell * pair = NULL;
+    gc_protect(keys);
+    gc_protect(values);
+    gc_protect(result);
+    gc_protect(last_cell);
+    gc_protect(pair);
+    for ( ; keys && values ; keys = keys->tail, values = values->tail ) {
+        if ( value_type(keys) != kCellValue || value_type(values) != kCellValue )
+            exit_message("Non-list value passed to ZIP.", -1);
+        pair = new_lisp_cell(values->head, NULL);
+        pair = new_lisp_cell(keys->head, pair);
+        append_value(&result, &last_cell, pair);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Calls the function with the arguments between it and the last one, followed by the
+// elements of the last one, which is a list.
+LispValue * lisp_apply(LispValue ** argv, size_t argc) {
+    if ( argc < 2 )
+        exit_message("Wrong number of arguments passed to APPLY.", -1);
+    LispCell * list = argv[argc - 1];
+    size_t call_argc = argc - 2 + list_length(list, "Non-list value passed to APPLY.");
+    LispValue * stack_argv[NATIVE_STACK_ARGS];
+    LispValue ** call_argv = stack_argv;
+    if ( call_argc > NATIVE_STACK_ARGS ) {
+        call_argv = malloc(sizeof(LispValue *) * call_argc);
+        if ( !call_argv )
+            exit_message("Error while allocating memory for arguments.", -1);
+    }
+    for ( size_t i = 1 ; i < argc - 1 ; i++ )
+        call_argv[i - 1] = argv[i];
+    for ( size_t i = argc - 2 ; list ; list = list->tail, i++ )
+        call_argv[i] = list->head;
+    size_t roots = gc_save_roots();
+    LispValue * function = argv[0];
+    gc_protect(function);
+    for ( size_t i = 0 ; i < call_argc ; i++ )
+        gc_protect(call_argv[i]);
+    LispValue * result = call_procedure(function, call_argv, call_argc);
+    if ( call_argv != stack_argv )
+        free(call_argv);
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_equal_hash(LispValue ** argv, size_t argc) {
+    return new_lisp_number((int)(equal_hash(argv[0]) & 0x3fffffff));
+}
+
+// Makes a table comparing keys with equal?, or with eq? or eqv? if given that symbol.
+LispValue * lisp_make_hash_table(LispValue ** argv, size_t argc) {
+    if ( argc > 1 )
+        exit_message("Wrong number of arguments passed to MAKE-HASH-TABLE.", -1);
+    HashTableKind kind = kHashEqual;
+    if ( argc == 1 ) {
+        LispSymbol * kind_sym = argv[0];
+        if ( value_type(kind_sym) != kSymbolValue )
+            exit_message("Non-symbol value passed to MAKE-HASH-TABLE.", -1);
+        if ( strcmp(kind_sym->value, "eq") == 0 )
+            kind = kHashEq;
+        else if ( strcmp(kind_sym->value, "eqv") == 0 )
+            kind = kHashEqv;
+        else if ( strcmp(kind_sym->value, "equal") != 0 )
+            exit_message("Unknown kind of hash table passed to MAKE-HASH-TABLE.", -1);
+    }
+    return new_lisp_hash_table(kind);
+}
+
+static LispHashTable * expect_hash_table(LispValue * value, char * message) {
+    if ( value_type(value) != kHashTableValue )
+        exit_message(message, -1);
+    return (LispHashTable *)value;
+}
+
+// Returns the value for the key, or the default if given one and null otherwise.
+LispValue * lisp_hash_ref(LispValue ** argv, size_t argc) {
+    if ( argc != 2 && argc != 3 )
+        exit_message("Wrong number of arguments passed to HASH-REF.", -1);
+    size_t roots = gc_save_roots();
+    LispValue * default_value = argc == 3 ? argv[2] : NULL;
+    LispValue * value = NULL;
+    gc_protect(default_value);
+    if ( !hash_table_lookup(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-REF."), argv[1], &value) )
+        value = default_value;
+    gc_restore_roots(roots);
+    return value;
+}
+
+LispValue * lisp_hash_contains(LispValue ** argv, size_t argc) {
+    LispValue * value = NULL;
+    return valueify_bool(hash_table_lookup(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-CONTAINS?."), argv[1], &value));
+}
+
+LispValue * lisp_hash_set(LispValue ** argv, size_t argc) {
+    hash_table_insert(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-SET!."), argv[1], argv[2]);
+    return NULL;
+}
+
+LispValue * lisp_hash_remove(LispValue ** argv, size_t argc) {
+    hash_table_delete(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-REMOVE!."), argv[1]);
+    return NULL;
+}
+
+LispValue * lisp_hash_count(LispValue ** argv, size_t argc) {
+    return new_lisp_number(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-COUNT.")->count);
+}
+
+typedef enum HashListPart {
+    kHashKeys,
+    kHashValues,
+    kHashPairs
+} HashListPart;
+
+// Lists the keys, the values, or (key . value) pairs of the entries, in slot order.
+// The slots are read through the table every time, since consing moves them if
+// they are young.
+static LispCell * hash_table_list(LispHashTable * table, HashListPart part) {
+    size_t roots = gc_save_roots();
+    LispCell * result = NULL;
+    LispCell * last_cell = NULL;
+    LispValue * item = NULL;
+    gc_protect(table);
+    gc_protect(result);
+    gc_protect(last_cell);
+    gc_protect(item);
+    for ( size_t i = 0 ; i < table->entries->capacity ; i++ ) {
+        LispHashEntry * slot = &table->entries->items[i];
+        if ( slot->key == HASH_EMPTY_KEY || slot->key == HASH_DELETED_KEY )
+            continue;
+        if ( part == kHashKeys )
+            item = slot->key;
+        else if ( part == kHashValues )
+            item = slot->value;
+        else
+            item = new_lisp_cell(slot->key, slot->value);
+        append_value(&result, &last_cell, item);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_hash_keys(LispValue ** argv, size_t argc) {
+    return hash_table_list(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-KEYS."), kHashKeys);
+}
+
+LispValue * lisp_hash_values(LispValue ** argv, size_t argc) {
+    return hash_table_list(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-VALUES."), kHashValues);
+}
+
+LispValue * lisp_hash_to_list(LispValue ** argv, size_t argc) {
+    return hash_table_list(expect_hash_table(argv[0], "Non-hash-table value passed to HASH->LIST."), kHashPairs);
+}
+
+// Calls the function with each key and value. The entries are listed first, so the
+// function may change the table.
+LispValue * lisp_hash_for_each(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispValue * function = argv[1];
+    LispCell * pairs = NULL;
+    LispValue * call_args[2] = { NULL, NULL };
+    gc_protect(function);
+    gc_protect(pairs);
+    gc_protect(call_args[0]);
+    gc_protect(call_args[1]);
+    pairs = hash_table_list(expect_hash_table(argv[0], "Non-hash-table value passed to HASH-FOR-EACH."), kHashPairs);
+    for ( ; pairs ; pairs = pairs->tail ) {
+        call_args[0] = ((LispCell *)pairs->head)->head;
+        call_args[1] = ((LispCell *)pairs->head)->tail;
+        call_procedure(function, call_args, 2);
+    }
+    gc_restore_roots(roots);
+    return NULL;
+}
+
+static char * typed_vector_kind_names[] = { "u8", "s32", "s64" };
+
+static TypedVectorKind expect_typed_vector_kind(LispValue * value, char * message) {
+    if ( value_type(value) != kSymbolValue )
+        exit_message(message, -1);
+    for ( TypedVectorKind kind = kU8Vector ; kind <= kS64Vector ; kind++ ) {
+        if ( strcmp(((LispSymbol *)value)->value, typed_vector_kind_names[kind]) == 0 )
+            return kind;
+    }
+    exit_message("Unknown kind of typed vector.", -1);
+    return kU8Vector;
+}
+
+static LispTypedVector * expect_typed_vector(LispValue * value, char * message) {
+    if ( value_type(value) != kTypedVectorValue )
+        exit_message(message, -1);
+    return (LispTypedVector *)value;
+}
+
+// Checks that the second vector has the kind and length of the first.
+static LispTypedVector * expect_matching_typed_vector(LispTypedVector * vec, LispValue * other, char * message) {
+    LispTypedVector * other_vec = expect_typed_vector(other, message);
+    if ( other_vec->kind != vec->kind || other_vec->length != vec->length )
+        exit_message("Typed vectors of different kinds or lengths passed to a typed vector operation.", -1);
+    return other_vec;
+}
+
+static int64_t expect_element(TypedVectorKind kind, LispValue * value) {
+    if ( value_type(value) != kNumberValue )
+        exit_message("Non-number element for typed vector.", -1);
+    if ( !typed_vector_fits(kind, fixnum_value(value)) )
+        exit_message("Element out of range for typed vector.", -1);
+    return fixnum_value(value);
+}
+
+static size_t expect_typed_vector_index(LispTypedVector * vec, LispValue * idx, char * message) {
+    if ( value_type(idx) != kNumberValue )
+        exit_message(message, -1);
+    if ( fixnum_value(idx) >= vec->length || fixnum_value(idx) < 0 )
+        exit_message("Index out of range for typed vector.", -1);
+    return fixnum_value(idx);
+}
+
+// Elements and results that don't fit a number are an error.
+static LispValue * typed_vector_number(int64_t value) {
+    if ( value < INT_MIN || value > INT_MAX )
+        exit_message("Typed vector value too large for a number.", -1);
+    return new_lisp_number((int)value);
+}
+
+// Makes a typed vector of the given kind and length, filled with zeros or the value given.
+LispValue * lisp_make_typed_vector(LispValue ** argv, size_t argc) {
+    if ( argc != 2 && argc != 3 )
+        exit_message("Wrong number of arguments passed to MAKE-TYPED-VECTOR.", -1);
+    TypedVectorKind kind = expect_typed_vector_kind(argv[0], "Non-symbol kind passed to MAKE-TYPED-VECTOR.");
+    if ( value_type(argv[1]) != kNumberValue || fixnum_value(argv[1]) < 0 )
+        exit_message("Invalid length passed to MAKE-TYPED-VECTOR.", -1);
+    int64_t fill = argc == 3 ? expect_element(kind, argv[2]) : 0;
+    LispTypedVector * vec = new_lisp_typed_vector(kind, fixnum_value(argv[1]));
+    if ( fill )
+        typed_vector_fill(vec, fill);
+    return vec;
+}
+
+static LispTypedVector * array_to_typed_vector(TypedVectorKind kind, LispValue ** elements, size_t count) {
+    for ( size_t i = 0 ; i < count ; i++ )
+        expect_element(kind, elements[i]);
+    LispTypedVector * vec = new_lisp_typed_vector(kind, count);
+    for ( size_t i = 0 ; i < count ; i++ )
+        typed_vector_set(vec, i, fixnum_value(elements[i]));
+    return vec;
+}
+
+// The elements are numbers, which don't move, so they need no protecting.
+LispValue * lisp_typed_vector(LispValue ** argv, size_t argc) {
+    if ( argc < 1 )
+        exit_message("Wrong number of arguments passed to TYPED-VECTOR.", -1);
+    TypedVectorKind kind = expect_typed_vector_kind(argv[0], "Non-symbol kind passed to TYPED-VECTOR.");
+    return array_to_typed_vector(kind, argv + 1, argc - 1);
+}
+
+LispValue * lisp_list_to_typed_vector(LispValue ** argv, size_t argc) {
+    TypedVectorKind kind = expect_typed_vector_kind(argv[0], "Non-symbol kind passed to LIST->TYPED-VECTOR.");
+    LispCell * list = argv[1];
+    size_t length = 0;
+    for ( ; list ; list = list->tail, length++ ) {
+        if ( value_type(list) != kCellValue )
+            exit_message("Non-list value passed to LIST->TYPED-VECTOR.", -1);
+        expect_element(kind, list->head);
+    }
+    size_t roots = gc_save_roots();
+    list = argv[1];
+    gc_protect(list);
+    LispTypedVector * vec = new_lisp_typed_vector(kind, length);
+    for ( size_t i = 0 ; list ; list = list->tail, i++ )
+        typed_vector_set(vec, i, fixnum_value(list->head));
+    gc_restore_roots(roots);
+    return vec;
+}
+
+LispValue * lisp_typed_vector_kind(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-KIND.");
+    return new_interned_symbol(typed_vector_kind_names[vec->kind]);
+}
+
+LispValue * lisp_typed_vector_length(LispValue ** argv, size_t argc) {
+    return new_lisp_number(expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-LENGTH.")->length);
+}
+
+LispValue * lisp_typed_vector_ref(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-REF.");
+    size_t index = expect_typed_vector_index(vec, argv[1], "Non-number index passed to TYPED-VECTOR-REF.");
+    return typed_vector_number(typed_vector_ref(vec, index));
+}
+
+LispValue * lisp_typed_vector_set(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-SET!.");
+    size_t index = expect_typed_vector_index(vec, argv[1], "Non-number index passed to TYPED-VECTOR-SET!.");
+    typed_vector_set(vec, index, expect_element(vec->kind, argv[2]));
+    return NULL;
+}
+
+// Conses from the end, reading each element through the protected vector.
+LispValue * lisp_typed_vector_to_list(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR->LIST.");
+    LispCell * result = NULL;
+    gc_protect(vec);
+    gc_protect(result);
+    for ( size_t i = vec->length ; i > 0 ; i-- )
+        result = new_lisp_cell(typed_vector_number(typed_vector_ref(vec, i - 1)), result);
+    gc_restore_roots(roots);
+    return result;
+}
+
+LispValue * lisp_typed_vector_fill(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-FILL!.");
+    typed_vector_fill(vec, expect_element(vec->kind, argv[1]));
+    return NULL;
+}
+
+LispValue * lisp_typed_vector_copy(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-COPY.");
+    gc_protect(vec);
+    LispTypedVector * copy = new_lisp_typed_vector(vec->kind, vec->length);
+    typed_vector_copy(copy, vec);
+    gc_restore_roots(roots);
+    return copy;
+}
+
+// Copies the elements of the second vector into the first.
+LispValue * lisp_typed_vector_copy_into(LispValue ** argv, size_t argc) {
+    LispTypedVector * to = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-COPY!.");
+    typed_vector_copy(to, expect_matching_typed_vector(to, argv[1], "Non-typed-vector value passed to TYPED-VECTOR-COPY!."));
+    return NULL;
+}
+
+// Adds the elements of the second vector to those of the first.
+LispValue * lisp_typed_vector_add(LispValue ** argv, size_t argc) {
+    LispTypedVector * to = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-ADD!.");
+    typed_vector_add(to, expect_matching_typed_vector(to, argv[1], "Non-typed-vector value passed to TYPED-VECTOR-ADD!."));
+    return NULL;
+}
+
+// Multiplies the elements of the first vector by those of the second.
+LispValue * lisp_typed_vector_mul(LispValue ** argv, size_t argc) {
+    LispTypedVector * to = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-MUL!.");
+    typed_vector_mul(to, expect_matching_typed_vector(to, argv[1], "Non-typed-vector value passed to TYPED-VECTOR-MUL!."));
+    return NULL;
+}
+
+LispValue * lisp_typed_vector_equal(LispValue ** argv, size_t argc) {
+    LispTypedVector * a = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR=?.");
+    LispTypedVector * b = expect_typed_vector(argv[1], "Non-typed-vector value passed to TYPED-VECTOR=?.");
+    return valueify_bool(a->kind == b->kind && a->length == b->length && typed_vector_equal(a, b));
+}
+
+LispValue * lisp_typed_vector_dot(LispValue ** argv, size_t argc) {
+    LispTypedVector * a = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-DOT.");
+    return typed_vector_number(typed_vector_dot(a, expect_matching_typed_vector(a, argv[1], "Non-typed-vector value passed to TYPED-VECTOR-DOT.")));
+}
+
+LispValue * lisp_typed_vector_sum(LispValue ** argv, size_t argc) {
+    return typed_vector_number(typed_vector_sum(expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-SUM.")));
+}
+
+LispValue * lisp_typed_vector_min(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-MIN.");
+    if ( !vec->length )
+        exit_message("Empty typed vector passed to TYPED-VECTOR-MIN.", -1);
+    return typed_vector_number(typed_vector_min(vec));
+}
+
+LispValue * lisp_typed_vector_max(LispValue ** argv, size_t argc) {
+    LispTypedVector * vec = expect_typed_vector(argv[0], "Non-typed-vector value passed to TYPED-VECTOR-MAX.");
+    if ( !vec->length )
+        exit_message("Empty typed vector passed to TYPED-VECTOR-MAX.", -1);
+    return typed_vector_number(typed_vector_max(vec));
+}
+
 LispValue * lisp_include_file(LispCell * args, LispContext * ctx) {
     LispString * filename = args->head;
-    if ( filename->type != kStringValue )
+    if ( value_type(filename) != kStringValue )
         exit_message("Filename must be a string.", -1);
-    char * filename_str = filename->value;
-    FILE * code_file = fopen(filename_str, "r");
-    fseek(code_file, 0, SEEK_END);
-    long code_size = ftell(code_file);
-    fseek(code_file, 0, SEEK_SET);
-    char * code_content = malloc(code_size + 1);
-    if ( !code_content ) {
-        exit_message("Error while allocating memory for code.", -1);
-    }
-    size_t chars_read = fread(code_content, 1, code_size, code_file);
-    if ( chars_read != code_size ) {
-        printf("Expected read characters: %d\n", code_size);
-        printf("Actual read characters: %d\n", chars_read);
-        fclose(code_file);
-        exit_message("File read error.", -1);
-    }
-    fclose(code_file);
-    TokenList * code_tokens = tokenize(code_content);
-    LispCell * code_ast = construct_ast(code_tokens, NULL);
-    return eval_seq(code_ast, ctx);
-}
-
-LispValue * lisp_string_conc(LispCell * args, LispContext * ctx) {
-    char * str_buf = NULL;
-    size_t str_buf_len = 0;
-    for_each_cell(current_cell, args) {
-        LispString * current_head = eval(current_cell->head, ctx);
-        if ( current_head->type != kStringValue )
+    return eval_file(filename->value, ctx);
+}
+
+// Sizes the result from the lengths of the arguments, so that it is copied together once.
+LispValue * lisp_string_conc(LispValue ** argv, size_t argc) {
+    size_t str_len = 0;
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        if ( value_type(argv[i]) != kStringValue )
             exit_message("Non-string value(s) passed to STRING-APPEND.", -1);
-        size_t current_head_len = strlen(current_head->value);
-        if ( !str_buf ) {
-            str_buf_len = current_head_len;
-            str_buf = calloc(current_head_len, 1);
-            memcpy(str_buf, current_head->value, current_head_len);
-        } else {
-            size_t old_str_buf_len = str_buf_len;
-            str_buf_len += current_head_len;
-            str_buf = realloc(str_buf, str_buf_len);
-            memcpy(str_buf+old_str_buf_len, current_head->value, current_head_len);
-        }
+        str_len += ((LispString *)argv[i])->length;
     }
-    str_buf = realloc(str_buf, str_buf_len+1);
-    str_buf[str_buf_len] = 0;
-    return new_lisp_string(str_buf);
+    char * str_buf = malloc(str_len + 1);
+    if ( !str_buf )
+        exit_message("Error while allocating memory for string.", -1);
+    char * current_end = str_buf;
+    for ( size_t i = 0 ; i < argc ; i++ ) {
+        LispString * current_str = argv[i];
+        memcpy(current_end, current_str->value, current_str->length);
+        current_end += current_str->length;
+    }
+    *current_end = 0;
+    gc_note_allocation(str_len + 1);
+    return new_lisp_string_of_length(str_buf, str_len, str_len + 1);
 }
 
-LispValue * lisp_string_ref(LispCell * args, LispContext * ctx) {
-    LispString * str = eval(args->head, ctx);
-    LispNumber * idx = eval(args->tail->value, ctx);
-    if ( str->type != kStringValue )
+// Characters are returned as their codes, which are fixnums and never allocated.
+LispValue * lisp_string_ref(LispValue ** argv, size_t argc) {
+    LispString * str = argv[0];
+    LispNumber * idx = argv[1];
+    if ( value_type(str) != kStringValue )
         exit_message("Non-string value passed to STRING-REF.", -1);
-    if ( idx->type != kNumberValue )
+    if ( value_type(idx) != kNumberValue )
         exit_message("Non-number value passed as index to STRING-REF.", -1);
-    return new_lisp_number(str->value[idx->value]);
+    if ( fixnum_value(idx) < 0 || fixnum_value(idx) >= str->length )
+        exit_message("Index out of range passed to STRING-REF.", -1);
+    return new_lisp_number((unsigned char)str->value[fixnum_value(idx)]);
 }
 
-LispValue * lisp_string_len(LispCell * args, LispContext * ctx) {
-    LispString * str = eval(args->head, ctx);
-    if ( str->type != kStringValue )
+LispValue * lisp_string_len(LispValue ** argv, size_t argc) {
+    LispString * str = argv[0];
+    if ( value_type(str) != kStringValue )
         exit_message("Non-string value passed to STRING-LENGTH.", -1);
-    return new_lisp_number(strlen(str->value));
+    return new_lisp_number(str->length);
 }
 
-LispValue * lisp_sym_to_str(LispCell * args, LispContext * ctx) {
-    LispSymbol * sym = eval(args->head, ctx);
-    if ( sym->type != kSymbolValue )
+LispValue * lisp_sym_to_str(LispValue ** argv, size_t argc) {
+    LispSymbol * sym = argv[0];
+    if ( value_type(sym) != kSymbolValue )
         exit_message("Non-symbol value passed to SYMBOL->STRING.", -1);
-    char * new_str_value = malloc(strlen(sym->value)+1);
-    strcpy(new_str_value, sym->value);
-    return new_lisp_string(new_str_value);
+    size_t str_len = symbol_entry_of(sym->value)->length;
+    char * new_str_value = malloc(str_len + 1);
+    memcpy(new_str_value, sym->value, str_len + 1);
+    gc_note_allocation(str_len + 1);
+    return new_lisp_string_of_length(new_str_value, str_len, str_len + 1);
+}
+
+LispValue * lisp_make_string_builder(LispValue ** argv, size_t argc) {
+    return new_lisp_string_builder();
 }
 
-LispValue * lisp_str_to_sym(LispCell * args, LispContext * ctx) {
-    LispString * str = eval(args->head, ctx);
-    if ( str->type != kStringValue )
+// Makes room for a string of the given length and its NUL, doubling the buffer.
+static void reserve_string_builder(LispStringBuilder * builder, size_t length) {
+    if ( length < builder->capacity )
+        return;
+    size_t capacity = builder->capacity ? builder->capacity : 16;
+    while ( capacity <= length )
+        capacity *= 2;
+    char * value = realloc(builder->value, capacity);
+    if ( !value )
+        exit_message("Error while allocating memory for string builder.", -1);
+    gc_note_allocation(capacity - builder->capacity);
+    builder->value = value;
+    builder->capacity = capacity;
+}
+
+// Appends strings, and characters given as their codes, to the builder.
+LispValue * lisp_string_builder_append(LispValue ** argv, size_t argc) {
+    LispStringBuilder * builder = argc ? argv[0] : NULL;
+    if ( value_type(builder) != kStringBuilderValue )
+        exit_message("Non-string-builder value passed to STRING-BUILDER-APPEND!.", -1);
+    for ( size_t i = 1 ; i < argc ; i++ ) {
+        if ( value_type(argv[i]) == kStringValue ) {
+            LispString * str = argv[i];
+            reserve_string_builder(builder, builder->length + str->length);
+            memcpy(builder->value + builder->length, str->value, str->length);
+            builder->length += str->length;
+        } else if ( value_type(argv[i]) == kNumberValue ) {
+            int code = fixnum_value(argv[i]);
+            if ( code < 0 || code > 255 )
+                exit_message("Character code out of range passed to STRING-BUILDER-APPEND!.", -1);
+            reserve_string_builder(builder, builder->length + 1);
+            builder->value[builder->length++] = (char)code;
+        } else {
+            exit_message("Non-string value passed to STRING-BUILDER-APPEND!.", -1);
+        }
+        builder->value[builder->length] = 0;
+    }
+    return builder;
+}
+
+LispValue * lisp_string_builder_len(LispValue ** argv, size_t argc) {
+    LispStringBuilder * builder = argv[0];
+    if ( value_type(builder) != kStringBuilderValue )
+        exit_message("Non-string-builder value passed to STRING-BUILDER-LENGTH.", -1);
+    return new_lisp_number(builder->length);
+}
+
+// Hands the builder's buffer over to a new string, and leaves the builder empty.
+LispValue * lisp_string_builder_to_str(LispValue ** argv, size_t argc) {
+    size_t roots = gc_save_roots();
+    LispStringBuilder * builder = argv[0];
+    if ( value_type(builder) != kStringBuilderValue )
+        exit_message("Non-string-builder value passed to STRING-BUILDER->STRING.", -1);
+    gc_protect(builder);
+    reserve_string_builder(builder, builder->length);
+    builder->value[builder->length] = 0;
+    LispString * str = new_lisp_string_of_length(builder->value, builder->length, builder->capacity);
+    builder->value = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+    gc_restore_roots(roots);
+    return str;
+}
+
+LispValue * lisp_str_to_sym(LispValue ** argv, size_t argc) {
+    LispString * str = argv[0];
+    if ( value_type(str) != kStringValue )
         exit_message("Non-string value passed to STRING->SYMBOL.", -1);
-    SymbolTableEntry * new_sym_entry = insert_symbol_if_not_found(GLOBAL_SYM_TABLE, str->value);
-    return new_lisp_symbol(new_sym_entry->name);
+    return new_interned_symbol_of_length(str->value, str->length);
 }
 
 PRIMITIVE_COMPARISON_OPERATOR(lisp_greater_than, >)
@@ -484,9 +1302,16 @@ PRIMITIVE_TYPE_PREDICATE(lisp_symbol_p, kSymbolValue)
 PRIMITIVE_TYPE_PREDICATE(lisp_string_p, kStringValue)
 PRIMITIVE_TYPE_PREDICATE(lisp_number_p, kNumberValue)
 PRIMITIVE_TYPE_PREDICATE(lisp_lambda_p, kLambdaValue)
-PRIMITIVE_TYPE_PREDICATE(lisp_primitive_p, kPrimitiveValue)
 PRIMITIVE_TYPE_PREDICATE(lisp_macro_p, kMacroValue)
 PRIMITIVE_TYPE_PREDICATE(lisp_vector_p, kVectorValue);
+PRIMITIVE_TYPE_PREDICATE(lisp_hash_table_p, kHashTableValue);
+PRIMITIVE_TYPE_PREDICATE(lisp_typed_vector_p, kTypedVectorValue);
+PRIMITIVE_TYPE_PREDICATE(lisp_string_builder_p, kStringBuilderValue);
+
+// Natives are primitives as much as special forms are.
+LispValue * lisp_primitive_p(LispValue ** argv, size_t argc) {
+    return valueify_bool(value_type(argv[0]) == kPrimitiveValue || value_type(argv[0]) == kNativeValue);
+}
 
 LispValue * valueify_bool(bool b) {
   if ( b ) {
@@ -497,18 +1322,26 @@ LispValue * valueify_bool(bool b) {
 }
 
 void init_primitive_defs(LispContext * ctx) {
+    size_t roots = gc_save_roots();
+    gc_protect(ctx);
+    gc_register_root(&TRUE_VALUE);
+    gc_register_root(&FALSE_VALUE);
     TRUE_VALUE = new_lisp_bool(true);
     FALSE_VALUE = new_lisp_bool(false);
+    gc_register_root(&quasiquote_plans);
+    quasiquote_plans = new_lisp_hash_table(kHashEq);
+    unquote_name = new_interned_symbol("unquote")->value;
+    unquote_flatten_name = new_interned_symbol("unquote-flatten")->value;
     define_symbol("true", TRUE_VALUE, ctx);
     define_symbol("false", FALSE_VALUE, ctx);
-    define_primitive("or", lisp_logical_or, ctx);
-    define_primitive("and", lisp_logical_and, ctx);
-    define_primitive("not", lisp_logical_not, ctx);
+    define_native("or", lisp_logical_or, 2, ctx);
+    define_native("and", lisp_logical_and, 2, ctx);
+    define_native("not", lisp_logical_not, 1, ctx);
     define_symbol("null", NULL, ctx);
-    define_primitive("+", add, ctx);
-    define_primitive("-", lisp_subtract, ctx);
-    define_primitive("*", multiply, ctx);
-    define_primitive("print", lisp_print, ctx);
+    define_native("+", add, -1, ctx);
+    define_native("-", lisp_subtract, 2, ctx);
+    define_native("*", multiply, -1, ctx);
+    define_native("print", lisp_print, -1, ctx);
     define_primitive("define", lisp_define, ctx);
     define_primitive("set!", lisp_set, ctx);
     define_primitive("defmacro", lisp_defmacro, ctx);
@@ -517,44 +1350,97 @@ void init_primitive_defs(LispContext * ctx) {
     define_primitive("if", lisp_if, ctx);
     define_primitive("quote", lisp_quote, ctx);
     define_primitive("quasiquote", lisp_quasiquote, ctx);
-    define_primitive("car", lisp_car, ctx);
-    define_primitive("cdr", lisp_cdr, ctx);
-    define_primitive("set-car!", lisp_set_car, ctx);
-    define_primitive("set-cdr!", lisp_set_cdr, ctx);
-    define_primitive("cons", lisp_cons, ctx);
-    define_primitive(">", lisp_greater_than, ctx);
-    define_primitive("<", lisp_less_than, ctx);
-    define_primitive("=", lisp_equal, ctx);
-    define_primitive("!=", lisp_not_equal, ctx);
-    define_primitive(">=", lisp_greater_or_equal, ctx);
-    define_primitive("<=", lisp_less_or_equal, ctx);
-    define_primitive("/", lisp_divide, ctx);
-    define_primitive("%", lisp_modulo, ctx);
-    define_primitive("|", lisp_bitwise_or, ctx);
-    define_primitive("&", lisp_bitwise_and, ctx);
-    define_primitive("^", lisp_bitwise_xor, ctx);
+    define_native("car", lisp_car, 1, ctx);
+    define_native("cdr", lisp_cdr, 1, ctx);
+    define_native("set-car!", lisp_set_car, 2, ctx);
+    define_native("set-cdr!", lisp_set_cdr, 2, ctx);
+    define_native("cons", lisp_cons, 2, ctx);
+    define_native(">", lisp_greater_than, 2, ctx);
+    define_native("<", lisp_less_than, 2, ctx);
+    define_native("=", lisp_equal, 2, ctx);
+    define_native("!=", lisp_not_equal, 2, ctx);
+    define_native(">=", lisp_greater_or_equal, 2, ctx);
+    define_native("<=", lisp_less_or_equal, 2, ctx);
+    define_native("/", lisp_divide, 2, ctx);
+    define_native("%", lisp_modulo, 2, ctx);
+    define_native("|", lisp_bitwise_or, 2, ctx);
+    define_native("&", lisp_bitwise_and, 2, ctx);
+    define_native("^", lisp_bitwise_xor, 2, ctx);
     define_primitive("lambda", lisp_lambda_func, ctx);
     define_primitive("eval", lisp_eval, ctx);
-    define_primitive("null?", lisp_is_null, ctx);
-    define_primitive("number?", lisp_number_p, ctx);
-    define_primitive("string?", lisp_string_p, ctx);
-    define_primitive("symbol?", lisp_symbol_p, ctx);
-    define_primitive("lambda?", lisp_lambda_p, ctx);
-    define_primitive("primitive?", lisp_primitive_p, ctx);
-    define_primitive("macro?", lisp_macro_p, ctx);
-    define_primitive("vector?", lisp_vector_p, ctx);
-    define_primitive("list?", lisp_list_p, ctx);
-    define_primitive("eq?", lisp_eq, ctx);
-    define_primitive("eqv?", lisp_eqv, ctx);
+    define_native("null?", lisp_is_null, 1, ctx);
+    define_native("number?", lisp_number_p, 1, ctx);
+    define_native("string?", lisp_string_p, 1, ctx);
+    define_native("symbol?", lisp_symbol_p, 1, ctx);
+    define_native("lambda?", lisp_lambda_p, 1, ctx);
+    define_native("primitive?", lisp_primitive_p, 1, ctx);
+    define_native("macro?", lisp_macro_p, 1, ctx);
+    define_native("vector?", lisp_vector_p, 1, ctx);
+    define_native("list?", lisp_list_p, 1, ctx);
+    define_native("eq?", lisp_eq, 2, ctx);
+    define_native("eqv?", lisp_eqv, 2, ctx);
+    define_native("equal?", lisp_equal_p, 2, ctx);
+    define_native("equal-hash", lisp_equal_hash, 1, ctx);
     define_primitive("let", lisp_let, ctx);
     define_primitive("include", lisp_include_file, ctx);
-    define_primitive("vector", lisp_vector, ctx);
-    define_primitive("vector-ref", lisp_vector_ref, ctx);
-    define_primitive("vector-set!", lisp_vector_set, ctx);
-    define_primitive("vector-length", lisp_vector_len, ctx);
-    define_primitive("conc", lisp_string_conc, ctx);
-    define_primitive("string-ref", lisp_string_ref, ctx);
-    define_primitive("string-length", lisp_string_len, ctx);
-    define_primitive("string->symbol", lisp_str_to_sym, ctx);
-    define_primitive("symbol->string", lisp_sym_to_str, ctx);
+    define_native("vector", lisp_vector, -1, ctx);
+    define_native("vector-ref", lisp_vector_ref, 2, ctx);
+    define_native("vector-set!", lisp_vector_set, 3, ctx);
+    define_native("vector-length", lisp_vector_len, 1, ctx);
+    define_native("conc", lisp_string_conc, -1, ctx);
+    define_native("string-ref", lisp_string_ref, 2, ctx);
+    define_native("string-length", lisp_string_len, 1, ctx);
+    define_native("string->symbol", lisp_str_to_sym, 1, ctx);
+    define_native("symbol->string", lisp_sym_to_str, 1, ctx);
+    define_native("make-string-builder", lisp_make_string_builder, 0, ctx);
+    define_native("string-builder?", lisp_string_builder_p, 1, ctx);
+    define_native("string-builder-append!", lisp_string_builder_append, -1, ctx);
+    define_native("string-builder-length", lisp_string_builder_len, 1, ctx);
+    define_native("string-builder->string", lisp_string_builder_to_str, 1, ctx);
+    define_native("gc", lisp_gc, 0, ctx);
+    define_native("map", lisp_map, 2, ctx);
+    define_native("filter", lisp_filter, 2, ctx);
+    define_native("reduce", lisp_reduce, 3, ctx);
+    define_native("foldr", lisp_foldr, 3, ctx);
+    define_native("length", lisp_length, 1, ctx);
+    define_native("reverse", lisp_reverse, 1, ctx);
+    define_native("append", lisp_append, 2, ctx);
+    define_native("list-ref", lisp_list_ref, 2, ctx);
+    define_native("list-tail", lisp_list_tail, 2, ctx);
+    define_native("last-pair", lisp_last_pair, 1, ctx);
+    define_native("andmap", lisp_andmap, 2, ctx);
+    define_native("ormap", lisp_ormap, 2, ctx);
+    define_native("zip", lisp_zip, 2, ctx);
+    define_native("apply", lisp_apply, -1, ctx);
+    define_native("make-hash-table", lisp_make_hash_table, -1, ctx);
+    define_native("hash-table?", lisp_hash_table_p, 1, ctx);
+    define_native("hash-ref", lisp_hash_ref, -1, ctx);
+    define_native("hash-contains?", lisp_hash_contains, 2, ctx);
+    define_native("hash-set!", lisp_hash_set, 3, ctx);
+    define_native("hash-remove!", lisp_hash_remove, 2, ctx);
+    define_native("hash-count", lisp_hash_count, 1, ctx);
+    define_native("hash-keys", lisp_hash_keys, 1, ctx);
+    define_native("hash-values", lisp_hash_values, 1, ctx);
+    define_native("hash->list", lisp_hash_to_list, 1, ctx);
+    define_native("hash-for-each", lisp_hash_for_each, 2, ctx);
+    define_native("make-typed-vector", lisp_make_typed_vector, -1, ctx);
+    define_native("typed-vector", lisp_typed_vector, -1, ctx);
+    define_native("list->typed-vector", lisp_list_to_typed_vector, 2, ctx);
+    define_native("typed-vector?", lisp_typed_vector_p, 1, ctx);
+    define_native("typed-vector-kind", lisp_typed_vector_kind, 1, ctx);
+    define_native("typed-vector-length", lisp_typed_vector_length, 1, ctx);
+    define_native("typed-vector-ref", lisp_typed_vector_ref, 2, ctx);
+    define_native("typed-vector-set!", lisp_typed_vector_set, 3, ctx);
+    define_native("typed-vector->list", lisp_typed_vector_to_list, 1, ctx);
+    define_native("typed-vector-fill!", lisp_typed_vector_fill, 2, ctx);
+    define_native("typed-vector-copy", lisp_typed_vector_copy, 1, ctx);
+    define_native("typed-vector-copy!", lisp_typed_vector_copy_into, 2, ctx);
+    define_native("typed-vector-add!", lisp_typed_vector_add, 2, ctx);
+    define_native("typed-vector-mul!", lisp_typed_vector_mul, 2, ctx);
+    define_native("typed-vector=?", lisp_typed_vector_equal, 2, ctx);
+    define_native("typed-vector-dot", lisp_typed_vector_dot, 2, ctx);
+    define_native("typed-vector-sum", lisp_typed_vector_sum, 1, ctx);
+    define_native("typed-vector-min", lisp_typed_vector_min, 1, ctx);
+    define_native("typed-vector-max", lisp_typed_vector_max, 1, ctx);
+    gc_restore_roots(roots);
 }
@@ -6,42 +6,51 @@
 #include "./constructor.h"
 #include "./context.h"
 
-LispBool * TRUE_VALUE;
-LispBool * FALSE_VALUE;
+extern LispBool * TRUE_VALUE;
+extern LispBool * FALSE_VALUE;
 LispValue * valueify_bool(bool b);
 
 #define PRIMITIVE_TYPE_PREDICATE(name, lisp_type) \
-    LispValue * name(LispCell * args, LispContext * ctx) { \
-        return valueify_bool(eval(args->head, ctx)->type == lisp_type); \
+    LispValue * name(LispValue ** argv, size_t argc) { \
+        return valueify_bool(value_type(argv[0]) == lisp_type); \
     }
 
 
 #define PRIMITIVE_COMPARISON_OPERATOR(name, op) \
-    LispValue * name(LispCell * args, LispContext * ctx) { \
-        LispNumber * a = eval(args->head, ctx); \
-        LispNumber * b = eval(args->tail->value, ctx); \
-        if ( a->type != kNumberValue || b->type != kNumberValue ) \
+    LispValue * name(LispValue ** argv, size_t argc) { \
+        if ( value_type(argv[0]) != kNumberValue || value_type(argv[1]) != kNumberValue ) \
             exit_message("Operator arguments must be numbers.", -1); \
-        return valueify_bool(a->value op b->value); \
+        return valueify_bool(fixnum_value(argv[0]) op fixnum_value(argv[1])); \
     }
 
 #define PRIMITIVE_ARITHMETIC_OPERATOR(name, op) \
-    LispValue * name(LispCell * args, LispContext * ctx) { \
-        LispNumber * a = eval(args->head, ctx); \
-        LispNumber * b = eval(args->tail->value, ctx); \
-        if ( a->type != kNumberValue || b->type != kNumberValue ) \
+    LispValue * name(LispValue ** argv, size_t argc) { \
+        if ( value_type(argv[0]) != kNumberValue || value_type(argv[1]) != kNumberValue ) \
             exit_message("Operator arguments must be numbers.", -1); \
-        return new_lisp_number(a->value op b->value); \
+        return new_lisp_number(fixnum_value(argv[0]) op fixnum_value(argv[1])); \
     }
 
 #define PRIMITIVE_BOOL_OPERATOR(name, op) \
-    LispValue * name(LispCell * args, LispContext * ctx) { \
-        LispValue * a = eval(args->head, ctx); \
-        LispValue * b = eval(args->tail->value, ctx); \
-        return valueify_bool(boolify_value(a) op boolify_value(b)); \
+    LispValue * name(LispValue ** argv, size_t argc) { \
+        return valueify_bool(boolify_value(argv[0]) op boolify_value(argv[1])); \
     }
 
+// Special forms, which the resolver recognizes by their primitive function.
+LispValue * lisp_quote(LispCell * args, LispContext * ctx);
+LispValue * lisp_quasiquote(LispCell * args, LispContext * ctx);
+LispValue * lisp_if(LispCell * args, LispContext * ctx);
+LispValue * lisp_lambda_func(LispCell * args, LispContext * ctx);
+LispValue * lisp_define(LispCell * args, LispContext * ctx);
+LispValue * lisp_set(LispCell * args, LispContext * ctx);
+LispValue * lisp_defun(LispCell * args, LispContext * ctx);
+LispValue * lisp_defmacro(LispCell * args, LispContext * ctx);
+LispValue * lisp_let(LispCell * args, LispContext * ctx);
+LispValue * lisp_begin(LispCell * args, LispContext * ctx);
+LispValue * lisp_eval(LispCell * args, LispContext * ctx);
+LispValue * lisp_include_file(LispCell * args, LispContext * ctx);
+
 void define_primitive(char * name, PrimitiveFunPtr prim, LispContext * ctx);
+void define_native(char * name, NativeFunPtr function, int arity, LispContext * ctx);
 void init_primitive_defs(LispContext * ctx);
 
 #endif // PRIMITIVE_H
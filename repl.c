@@ -3,34 +3,40 @@
 #include "./context.h"
 #include "./primitive.h"
 #include "./interpreter.h"
+#include "./vm.h"
+#include "./fasl.h"
+#include "./image.h"
 #include <stdio.h>
 
-LispValue * run_file(char * filename, LispContext * ctx) {
-  FILE * code_file = fopen(filename, "r");
-  fseek(code_file, 0, SEEK_END);
-  long code_size = ftell(code_file);
-  fseek(code_file, 0, SEEK_SET);
-  char * code_content = malloc(code_size + 1);
-  if ( !code_content ) {
-    exit_message("Error while allocating memory for code.", -1);
-  }
-  size_t chars_read = fread(code_content, 1, code_size, code_file);
-  if ( chars_read != code_size ) {
-    printf("Expected read characters: %d\n", code_size);
-    printf("Actual read characters: %d\n", chars_read);
-    fclose(code_file);
-    exit_message("File read error.", -1);
-  }
-  fclose(code_file);
-  TokenList * code_tokens = tokenize(code_content);
-  LispCell * code_ast = construct_ast(code_tokens, NULL);
-  return eval_seq(code_ast, ctx);
-}
-
 int main (int argc, char ** argv) {
+  GCAllocator allocator = kGCPoolAllocator;
+  char * image_filename = NULL;
+  for ( int arg_index = 1 ; arg_index < argc ; arg_index++ ) {
+    if ( strcmp(argv[arg_index], "--alloc=pool") == 0 ) {
+      allocator = kGCPoolAllocator;
+    } else if ( strcmp(argv[arg_index], "--alloc=malloc") == 0 ) {
+      allocator = kGCMallocAllocator;
+    } else if ( strcmp(argv[arg_index], "--vm") == 0 ) {
+      vm_enabled = true;
+    } else if ( strcmp(argv[arg_index], "--no-fasl") == 0 ) {
+      fasl_enabled = false;
+    } else if ( strcmp(argv[arg_index], "--image") == 0 && arg_index + 1 < argc ) {
+      image_filename = argv[++arg_index];
+    } else {
+      printf("Unknown option: %s\n", argv[arg_index]);
+      exit_message("Usage: psxlisp-repl [--alloc=pool|--alloc=malloc] [--vm] [--no-fasl] [--image image]", -1);
+    }
+  }
+  gc_init(allocator);
+  if ( vm_enabled )
+    vm_init();
   init_global_symbol_table(200);
-  LispContext * ctx = new_context();
+  LispContext * ctx = NULL;
+  gc_register_root(&ctx);
+  ctx = new_context();
   init_primitive_defs(ctx);
+  if ( image_filename )
+    load_image(image_filename, ctx);
   char in_buf[65535];
   while (true) {
     printf("$ ");
@@ -39,7 +45,13 @@ int main (int argc, char ** argv) {
       printf("\n");
       exit(-1);
     }
-    LispValue * result = eval_seq(construct_ast(tokenize(console_code), NULL), ctx);
+    size_t roots = gc_save_roots();
+    TokenList * code_tokens = tokenize(console_code);
+    LispCell * code_ast = construct_ast(code_tokens, NULL);
+    free_token_list(code_tokens);
+    gc_protect(code_ast);
+    LispValue * result = eval_seq(code_ast, ctx);
+    gc_restore_roots(roots);
     printf("=> ");
     print_value(result);
     printf("\n\n");
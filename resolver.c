@@ -0,0 +1,450 @@
+#include "./helper.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./primitive.h"
+#include "./interpreter.h"
+#include "./resolver.h"
+#include <string.h>
+
+// The names a frame created by the body being resolved will hold, in slot order.
+typedef struct StaticScope {
+    char ** names;
+    size_t count;
+    size_t capacity;
+    struct StaticScope * outer;
+} StaticScope;
+
+// Scopes the body creates itself are described statically; past the outermost of
+// them, names are looked up in the frames the lambda closes over, which already exist,
+// and then among the globals. The resolver also notes whether the body may keep a
+// reference to its frame after the call returns, and whether it expanded macro calls.
+typedef struct Resolver {
+    StaticScope * scope;
+    LispContext * ctx;
+    bool captures;
+    bool expanded;
+} Resolver;
+
+// How the resolver treats a form, decided by what its head is bound to. Quoted forms
+// are left as they are: their arguments are data, code that is resolved on its own
+// first call, or code a macro will transform. Only literals are known not to close
+// over the frame. Eval forms run code the resolver can't see in the frame. Literals,
+// IFs and calls are compiled into nodes the evaluator runs without looking at the head.
+// Calls of global macros are expanded once, here, rather than on every evaluation.
+typedef enum FormKind {
+    kCallForm,
+    kMacroForm,
+    kIfForm,
+    kLambdaForm,
+    kLiteralForm,
+    kQuotedForm,
+    kEvalForm,
+    kDefineForm,
+    kDefinitionForm,
+    kLetForm,
+    kBeginForm
+} FormKind;
+
+// Where a name is bound, as far as the resolver can tell.
+typedef enum AddressKind {
+    kUnboundAddress,
+    kStaticAddress,
+    kFrameAddress,
+    kGlobalAddress
+} AddressKind;
+
+static LispValue * resolve_form(Resolver * resolver, LispValue * form);
+static LispCell * resolve_body(Resolver * resolver, LispCell * body, StaticScope * scope);
+
+static void add_scope_name(StaticScope * scope, char * name) {
+    for ( size_t i = 0 ; i < scope->count ; i++ )
+        if ( scope->names[i] == name )
+            return;
+    if ( scope->count == scope->capacity ) {
+        scope->capacity = scope->capacity ? scope->capacity * 2 : 4;
+        scope->names = realloc(scope->names, sizeof(char *) * scope->capacity);
+        if ( !scope->names )
+            exit_message("Error while allocating memory for resolver scope.", -1);
+    }
+    scope->names[scope->count++] = name;
+}
+
+// Finds the binding of the name, first in the static scopes, then in the closed over
+// frames and finally among the globals. Stores the lexical address of static and frame
+// bindings, and the current value of bindings that already exist.
+static AddressKind find_address(Resolver * resolver, char * name, unsigned int * depth, size_t * slot, LispValue ** current_value) {
+    unsigned int current_depth = 0;
+    for ( StaticScope * scope = resolver->scope ; scope ; scope = scope->outer, current_depth++ ) {
+        for ( size_t i = 0 ; i < scope->count ; i++ ) {
+            if ( scope->names[i] == name ) {
+                *depth = current_depth;
+                *slot = i;
+                return kStaticAddress;
+            }
+        }
+    }
+    for ( LispContext * frame = resolver->ctx ; frame ; frame = frame->next, current_depth++ ) {
+        long found_slot = find_context_slot(frame, name);
+        if ( found_slot >= 0 ) {
+            *depth = current_depth;
+            *slot = found_slot;
+            *current_value = context_value(frame, found_slot);
+            return kFrameAddress;
+        }
+    }
+    SymbolTableEntry * global = find_global(name);
+    if ( !global )
+        return kUnboundAddress;
+    *current_value = global->value;
+    return kGlobalAddress;
+}
+
+static bool is_proper_list(LispCell * list) {
+    for ( ; list ; list = list->tail )
+        if ( value_type(list) != kCellValue )
+            return false;
+    return true;
+}
+
+static FormKind form_kind(Resolver * resolver, LispCell * form) {
+    LispSymbol * head = form->head;
+    if ( value_type(head) != kSymbolValue )
+        return kCallForm;
+    unsigned int depth = 0;
+    size_t slot = 0;
+    LispValue * head_value = NULL;
+    AddressKind address = find_address(resolver, head->value, &depth, &slot, &head_value);
+    if ( address == kUnboundAddress )
+        return kQuotedForm;
+    if ( address == kStaticAddress )
+        return kCallForm;
+    if ( value_type(head_value) == kMacroValue )
+        return address == kGlobalAddress ? kMacroForm : kQuotedForm;
+    if ( value_type(head_value) != kPrimitiveValue )
+        return kCallForm;
+    PrimitiveFunPtr prim = head_value->value;
+    if ( prim == lisp_quote )
+        return kLiteralForm;
+    if ( prim == lisp_if )
+        return kIfForm;
+    if ( prim == lisp_lambda_func )
+        return kLambdaForm;
+    if ( prim == lisp_quasiquote )
+        return kQuotedForm;
+    if ( prim == lisp_eval || prim == lisp_include_file )
+        return kEvalForm;
+    if ( prim == lisp_defun || prim == lisp_defmacro )
+        return kDefinitionForm;
+    if ( prim == lisp_define )
+        return kDefineForm;
+    if ( prim == lisp_let )
+        return kLetForm;
+    if ( prim == lisp_begin )
+        return kBeginForm;
+    return kCallForm;
+}
+
+// Adds the names the body defines in its own frame, in the order they appear.
+static void add_defined_names(Resolver * resolver, LispCell * body, StaticScope * scope) {
+    for ( LispCell * current_cell = body ; current_cell && value_type(current_cell) == kCellValue ; current_cell = current_cell->tail ) {
+        LispCell * form = current_cell->head;
+        if ( value_type(form) != kCellValue || value_type(form->tail) != kCellValue )
+            continue;
+        LispCell * form_args = form->tail;
+        switch ( form_kind(resolver, form) ) {
+            case kDefineForm:
+                if ( value_type(form_args->head) == kSymbolValue )
+                    add_scope_name(scope, ((LispSymbol *)form_args->head)->value);
+                break;
+            case kDefinitionForm:
+                if ( value_type(form_args->head) == kCellValue && value_type(((LispCell *)form_args->head)->head) == kSymbolValue )
+                    add_scope_name(scope, ((LispSymbol *)((LispCell *)form_args->head)->head)->value);
+                break;
+            case kBeginForm:
+                add_defined_names(resolver, form_args, scope);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Resolves every element of a proper list into a new list. Improper lists are returned as is.
+static LispCell * resolve_list(Resolver * resolver, LispCell * list) {
+    if ( !is_proper_list(list) )
+        return list;
+    size_t roots = gc_save_roots();
+    LispCell * current_cell = list;
+    LispCell * first_cell = NULL;
+    LispCell * last_cell = NULL;
+    gc_protect(current_cell);
+    gc_protect(first_cell);
+    gc_protect(last_cell);
+    for ( ; current_cell ; current_cell = current_cell->tail ) {
+        LispValue * resolved = resolve_form(resolver, current_cell->head);
+        LispCell * new_cell = new_lisp_cell(resolved, NULL);
+        if ( last_cell ) {
+            last_cell->tail = new_cell;
+            gc_write_barrier(last_cell, new_cell);
+        } else {
+            first_cell = new_cell;
+        }
+        last_cell = new_cell;
+    }
+    gc_restore_roots(roots);
+    return first_cell;
+}
+
+// Resolves the initial values of LET bindings, keeping the bound names.
+static LispCell * resolve_bindings(Resolver * resolver, LispCell * bindings) {
+    if ( !is_proper_list(bindings) )
+        return bindings;
+    size_t roots = gc_save_roots();
+    LispCell * current_cell = bindings;
+    LispCell * first_cell = NULL;
+    LispCell * last_cell = NULL;
+    LispCell * binding = NULL;
+    gc_protect(current_cell);
+    gc_protect(first_cell);
+    gc_protect(last_cell);
+    gc_protect(binding);
+    for ( ; current_cell ; current_cell = current_cell->tail ) {
+        binding = current_cell->head;
+        if ( value_type(binding) == kCellValue && value_type(binding->tail) == kCellValue ) {
+            LispValue * init = resolve_form(resolver, binding->tail->value);
+            binding = new_lisp_cell(binding->head, new_lisp_cell(init, ((LispCell *)binding->tail)->tail));
+        }
+        LispCell * new_cell = new_lisp_cell(binding, NULL);
+        if ( last_cell ) {
+            last_cell->tail = new_cell;
+            gc_write_barrier(last_cell, new_cell);
+        } else {
+            first_cell = new_cell;
+        }
+        last_cell = new_cell;
+    }
+    gc_restore_roots(roots);
+    return first_cell;
+}
+
+// Resolves (define name value), keeping the name.
+static LispValue * resolve_define(Resolver * resolver, LispCell * form) {
+    LispCell * form_args = form->tail;
+    if ( !form_args || !is_proper_list(form_args) || value_type(form_args->head) != kSymbolValue )
+        return form;
+    size_t roots = gc_save_roots();
+    gc_protect(form);
+    LispCell * resolved_values = resolve_list(resolver, ((LispCell *)form->tail)->tail);
+    form_args = form->tail;
+    LispCell * result = new_lisp_cell(form->head, new_lisp_cell(form_args->head, resolved_values));
+    gc_restore_roots(roots);
+    return result;
+}
+
+// A named LET runs its body as a lambda, which is resolved when it is first called,
+// so only the initial values are resolved here. An unnamed LET's body runs in a frame
+// of its own, holding the bindings followed by whatever the body defines.
+static LispValue * resolve_let(Resolver * resolver, LispCell * form) {
+    if ( !form->tail || !is_proper_list(form) )
+        return form;
+    size_t roots = gc_save_roots();
+    LispCell * result = NULL;
+    gc_protect(form);
+    gc_protect(result);
+    LispCell * form_args = form->tail;
+    if ( value_type(form_args->head) == kSymbolValue && value_type(form_args->tail) == kCellValue ) {
+        resolver->captures = true;
+        result = resolve_bindings(resolver, form_args->tail->value);
+        form_args = form->tail;
+        result = new_lisp_cell(form_args->head, new_lisp_cell(result, ((LispCell *)form_args->tail)->tail));
+    } else if ( value_type(form_args->head) == kCellValue ) {
+        StaticScope let_scope = { NULL, 0, 0, NULL };
+        for ( LispCell * binding = form_args->head ; binding ; binding = binding->tail ) {
+            LispCell * binding_pair = binding->head;
+            if ( value_type(binding_pair) != kCellValue || value_type(binding_pair->head) != kSymbolValue ) {
+                free(let_scope.names);
+                gc_restore_roots(roots);
+                return form;
+            }
+            add_scope_name(&let_scope, ((LispSymbol *)binding_pair->head)->value);
+        }
+        result = resolve_bindings(resolver, form_args->head);
+        LispCell * let_body = resolve_body(resolver, ((LispCell *)form->tail)->tail, &let_scope);
+        result = new_lisp_cell(result, let_body);
+        free(let_scope.names);
+    } else {
+        gc_restore_roots(roots);
+        return form;
+    }
+    result = new_lisp_cell(form->head, result);
+    gc_restore_roots(roots);
+    return result;
+}
+
+// Compiles a call into a call node, or returns an improper list as it is.
+static LispValue * resolve_call(Resolver * resolver, LispCell * form) {
+    LispCell * resolved = resolve_list(resolver, form);
+    if ( resolved == form )
+        return form;
+    return new_lisp_call_node(resolved->head, resolved->tail);
+}
+
+// Compiles (if test consequent [alternative]) into an if node.
+static LispValue * resolve_if(Resolver * resolver, LispCell * form) {
+    size_t arg_count = 0;
+    if ( is_proper_list(form) ) {
+        for ( LispCell * arg = form->tail ; arg ; arg = arg->tail )
+            arg_count++;
+    }
+    if ( arg_count < 2 || arg_count > 3 )
+        return resolve_call(resolver, form);
+    size_t roots = gc_save_roots();
+    LispCell * resolved_args = resolve_list(resolver, form->tail);
+    gc_protect(resolved_args);
+    LispCell * branches = resolved_args->tail;
+    LispValue * alternative = branches->tail ? ((LispCell *)branches->tail)->head : NULL;
+    LispIfNode * node = new_lisp_if_node(resolved_args->head, branches->head, alternative);
+    gc_restore_roots(roots);
+    return node;
+}
+
+// Compiles (lambda params body...) into a lambda node. The body is left for the
+// closures' first call to resolve, as the frames it closes over don't exist yet.
+static LispValue * resolve_lambda_form(LispCell * form) {
+    LispCell * form_args = form->tail;
+    if ( value_type(form_args) != kCellValue )
+        return form;
+    return new_lisp_lambda_node(form_args->tail, form_args->head);
+}
+
+// Compiles (quote datum) into a constant node.
+static LispValue * resolve_literal(LispCell * form) {
+    LispCell * form_args = form->tail;
+    if ( value_type(form_args) != kCellValue || form_args->tail )
+        return form;
+    return new_lisp_constant(form_args->head);
+}
+
+static bool mentions_eval(LispValue * value) {
+    for ( ; value_type(value) == kCellValue ; value = ((LispCell *)value)->tail ) {
+        if ( mentions_eval(((LispCell *)value)->head) )
+            return true;
+    }
+    return value_type(value) == kSymbolValue && strcmp(((LispSymbol *)value)->value, "eval") == 0;
+}
+
+// Expands a macro call and resolves the expansion in its place. The expansion is built
+// in the frames the lambda closes over instead of the frame of each call, so macros that
+// evaluate their arguments with EVAL are left to be expanded when the call is evaluated.
+static LispValue * resolve_macro_call(Resolver * resolver, LispCell * form) {
+    LispMacro * macro = find_global(((LispSymbol *)form->head)->value)->value;
+    if ( !resolver->ctx || !is_proper_list(form) || mentions_eval(macro->value->template) ) {
+        resolver->captures = true;
+        return form;
+    }
+    size_t roots = gc_save_roots();
+    gc_protect(form);
+    gc_protect(macro);
+    LispValue * expansion = expand_macro(macro, form->tail, resolver->ctx);
+    gc_protect(expansion);
+    resolver->expanded = true;
+    LispValue * result = resolve_form(resolver, expansion);
+    gc_restore_roots(roots);
+    return result;
+}
+
+static LispValue * resolve_form(Resolver * resolver, LispValue * form) {
+    switch ( value_type(form) ) {
+        case kSymbolValue: {
+            LispSymbol * symbol = form;
+            unsigned int depth = 0;
+            size_t slot = 0;
+            LispValue * current_value = NULL;
+            switch ( find_address(resolver, symbol->value, &depth, &slot, &current_value) ) {
+                case kStaticAddress:
+                case kFrameAddress:
+                    return new_lisp_lexical_ref(symbol, depth, slot);
+                case kGlobalAddress:
+                    return new_lisp_global_ref(symbol);
+                default:
+                    return symbol;
+            }
+        }
+        case kCellValue:
+            switch ( form_kind(resolver, form) ) {
+                case kLiteralForm:
+                    return resolve_literal(form);
+                case kIfForm:
+                    return resolve_if(resolver, form);
+                case kLambdaForm:
+                    resolver->captures = true;
+                    return resolve_lambda_form(form);
+                case kMacroForm:
+                    return resolve_macro_call(resolver, form);
+                case kQuotedForm:
+                case kDefinitionForm:
+                    resolver->captures = true;
+                    return form;
+                case kEvalForm:
+                    resolver->captures = true;
+                    return resolve_call(resolver, form);
+                case kDefineForm:
+                    return resolve_define(resolver, form);
+                case kLetForm:
+                    return resolve_let(resolver, form);
+                default:
+                    return resolve_call(resolver, form);
+            }
+        default:
+            return form;
+    }
+}
+
+// Resolves a body that runs in a new frame described by the given scope. The names
+// the body defines are added to the scope first, since they end up in the same frame.
+static LispCell * resolve_body(Resolver * resolver, LispCell * body, StaticScope * scope) {
+    size_t roots = gc_save_roots();
+    gc_protect(body);
+    add_defined_names(resolver, body, scope);
+    scope->outer = resolver->scope;
+    resolver->scope = scope;
+    LispCell * resolved_body = resolve_list(resolver, body);
+    resolver->scope = scope->outer;
+    gc_restore_roots(roots);
+    return resolved_body;
+}
+
+LispCell * resolve_lambda_body(LispLambda * lambda) {
+    LispCell * params = lambda->value->params;
+    if ( params && value_type(params) != kCellValue )
+        return lambda->value->code;
+    Resolver resolver = { NULL, lambda->ctx, false, false };
+    StaticScope lambda_scope = { NULL, 0, 0, NULL };
+    for ( LispCell * current_param = params ; current_param ; current_param = current_param->tail ) {
+        if ( value_type(current_param) != kCellValue ) {
+            add_scope_name(&lambda_scope, ((LispSymbol *)current_param)->value);
+            break;
+        }
+        if ( value_type(current_param->head) != kSymbolValue ) {
+            free(lambda_scope.names);
+            return lambda->value->code;
+        }
+        add_scope_name(&lambda_scope, ((LispSymbol *)current_param->head)->value);
+    }
+    size_t roots = gc_save_roots();
+    LispCell * source = lambda->value->code;
+    gc_protect(lambda);
+    gc_protect(resolver.ctx);
+    gc_protect(source);
+    LispCell * resolved_body = resolve_body(&resolver, source, &lambda_scope);
+    lambda->value->frame_size = lambda_scope.count;
+    lambda->value->stack_frame = !resolver.captures;
+    if ( resolver.expanded ) {
+        lambda->value->source = source;
+        lambda->value->macro_epoch = macro_epoch;
+        gc_write_barrier(lambda->value, source);
+    }
+    free(lambda_scope.names);
+    gc_restore_roots(roots);
+    return resolved_body;
+}
@@ -0,0 +1,14 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "./constructor.h"
+
+// Returns a copy of the lambda's body in which variable references are replaced by
+// lexical addresses, so they can be evaluated without searching frames by name. Also
+// records in the lambda how many slots its frames need, and whether they can be
+// allocated on the frame stack because nothing in the body can capture them. Calls of
+// global macros are expanded in the copy; the lambda then keeps its source, and the
+// macro epoch its expansions are valid for.
+LispCell * resolve_lambda_body(LispLambda * lambda);
+
+#endif // RESOLVER_H
@@ -1,23 +1,7 @@
-(defun (reduce f l a)
-    (if (null? l)
-        a
-        (reduce f (cdr l) (f a (car l)))))
-
 (define foldl reduce)
 
 (define L lambda)
 
-(defun (foldr f l a)
-    (if (null? l)
-        a
-        (f (foldr f (cdr l) a) (car l))))
-
-(defun (map f l)
-    (if (null? l)
-        l
-        (cons (f (car l))
-              (map f (cdr l)))))
-
 (defun (for-each f l)
     (if (null? l)
         null
@@ -28,13 +12,6 @@
     (cons (filter f l)
           (remove f l)))
 
-(defun (filter f l)
-    (if (null? l)
-        l
-        (if (f (car l))
-            (cons (car l) (filter f (cdr l)))
-            (filter f (cdr l)))))
-
 (defun (remove f l)
     (filter (L (x) (not (f x))) l))
 
@@ -84,12 +61,6 @@
 (defun (cadr l)
     (car (cdr l)))
 
-(defun (reverse l)
-    (foldl (lambda (a e)
-               (cons e a))
-        (cdr l)
-        (cons (car l) null)))
-
 (defmacro (let* args . body)
     (foldr (lambda (a e)
                 `(let ([,(car e) ,(cadr e)])
@@ -103,41 +74,11 @@
         (cons (cons (car ks) (car vs))
               (zip (cdr ks) (cdr vs)))))
 
-(defun (zip ks vs)
-    (if (or (null? ks)
-            (null? vs))
-        null
-        (cons (list (car ks) (car vs))
-              (zip (cdr ks) (cdr vs)))))
-
 (defmacro (when cond . body)
     `(if ,cond
          (begin ,(car body))
          null))
 
-(defun (length l)
-    (reduce (lambda (a e)
-                (+ a 1))
-            l 0))
-
-(defmacro (apply f args)
-    `(,f ,@(eval args)))
-
-(defun (andmap f l)
-    (reduce (lambda (a e)
-                (and (f e) a))
-            l true))
-
-(defun (ormap f l)
-    (reduce (lambda (a e)
-                (or (f e) a))
-            l false))
-
-(defun (last-pair p)
-    (if (null? (cdr p))
-        p
-        (last-pair (cdr p))))
-
 (defun (last p)
     (car (last-pair p)))
 
@@ -167,16 +108,6 @@
                      `(define ,@x))
                    (zip names (eval l)))))
 
-(defun (list-tail l n)
-    (if (= n 0)
-        l
-        (list-tail (cdr l) (- n 1))))
-
-(defun (list-ref l n)
-    (if (= n 0)
-        (car l)
-        (list-ref (cdr l) (- n 1))))
-
 (defmacro (unless cond body)
     `(if (not ,cond)
          ,body
@@ -225,17 +156,6 @@
 (defun (copy-list l)
     (map (L (x) x) l))
 
-(defun (append l1 l2)
-    (define new-l1 (copy-list l1))
-    (define new-l2 (copy-list l2))
-    (cond [(and (null? new-l1) (null? new-l2))
-                null]
-          [(and (null? new-l1) (not (null? new-l2)))
-                new-l2]
-          [(and (not (null? new-l1)) (null? new-l2))
-                new-l1]
-          [true `(,@new-l1 ,@new-l2)]))
-
 (defun (concatenate ls)
     (reduce append ls null))
 
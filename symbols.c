@@ -5,63 +5,127 @@
 #include "./symbols.h"
 #include "./helper.h"
 
+#define SYMBOL_TABLE_MAX_LOAD_PERCENT 70
+
 SymbolTable * new_symbol_table(size_t size) {
     SymbolTable * new_table = calloc(sizeof(SymbolTable), 1);
-    new_table->size = size;
-    new_table->entries = calloc(sizeof(SymbolTableEntry *), size);
+    size_t table_size = 16;
+    while ( table_size < size )
+        table_size *= 2;
+    new_table->size = table_size;
+    new_table->count = 0;
+    new_table->entries = calloc(sizeof(SymbolTableEntry *), table_size);
+    if ( !new_table->entries ) {
+        exit_message("Error while allocating memory for symbol table.", -1);
+    }
     return new_table;
 }
 
-SymbolTableEntry * new_symbol_entry(char * name, SymbolTableEntry * next) {
-    SymbolTableEntry * new_entry = calloc(sizeof(SymbolTableEntry), 1);
+SymbolTableEntry * new_symbol_entry(char * name, size_t length, uint64_t hash) {
+    SymbolTableEntry * new_entry = calloc(sizeof(SymbolTableEntry) + length + 1, 1);
     if ( !new_entry ) {
         exit_message("Error while allocating memory for new symbol entry.", -1);
     }
-    new_entry->name = name;
-    new_entry->next = next;
+    new_entry->name = (char *)(new_entry + 1);
+    memcpy(new_entry->name, name, length);
+    new_entry->length = length;
+    new_entry->symbol = NULL;
+    new_entry->value = NULL;
+    new_entry->bound = false;
+    new_entry->hash = hash;
     return new_entry;
 }
 
-// Computes the hash of the given string.
-unsigned int hash_symbol(char * name, size_t modulo) {
-    unsigned int hash_value = 0;
-    for ( int i = 0 ; name[i] != 0 ; i++ ) {
-        hash_value += ((i + 1) * 7) * (int)(name[i]);
+// Computes the hash of the given string: 64-bit FNV-1a, followed by a final mix so
+// that the low bits used to pick a slot depend on every character.
+uint64_t hash_symbol(char * name) {
+    return hash_symbol_of_length(name, strlen(name));
+}
+
+uint64_t hash_symbol_of_length(char * name, size_t length) {
+    uint64_t hash_value = 0xcbf29ce484222325ULL;
+    for ( unsigned char * c = (unsigned char *)name ; c < (unsigned char *)name + length ; c++ ) {
+        hash_value ^= *c;
+        hash_value *= 0x100000001b3ULL;
     }
-    return hash_value % modulo;
+    hash_value ^= hash_value >> 33;
+    hash_value *= 0xff51afd7ed558ccdULL;
+    hash_value ^= hash_value >> 33;
+    return hash_value;
 }
 
-// Inserts a new symbol into the given table. Does not check for duplicates.
-SymbolTableEntry * insert_symbol(SymbolTable * table, char * name) {
-    size_t entry_index = hash_symbol(name, table->size);
-    SymbolTableEntry * current_entry = table->entries[entry_index];
-    if ( !current_entry ) {
-        table->entries[entry_index] = new_symbol_entry(name, NULL);
-        return table->entries[entry_index];
+// Returns the slot holding the entry with the given name, or the empty slot where it would go.
+static size_t find_symbol_slot(SymbolTable * table, char * name, size_t length, uint64_t hash) {
+    size_t mask = table->size - 1;
+    size_t slot = hash & mask;
+    while ( table->entries[slot] ) {
+        SymbolTableEntry * entry = table->entries[slot];
+        if ( entry->hash == hash && entry->length == length && memcmp(entry->name, name, length) == 0 )
+            break;
+        slot = (slot + 1) & mask;
     }
-    while ( current_entry->next ) {
-        current_entry = current_entry->next;
+    return slot;
+}
+
+// Moves every entry into a table twice the size. The entries themselves don't move.
+static void grow_symbol_table(SymbolTable * table) {
+    size_t old_size = table->size;
+    SymbolTableEntry ** old_entries = table->entries;
+    table->size = old_size * 2;
+    table->entries = calloc(sizeof(SymbolTableEntry *), table->size);
+    if ( !table->entries ) {
+        exit_message("Error while allocating memory for symbol table.", -1);
     }
-    current_entry->next = new_symbol_entry(name, NULL);
-    return current_entry->next;
+    size_t mask = table->size - 1;
+    for ( size_t i = 0 ; i < old_size ; i++ ) {
+        SymbolTableEntry * entry = old_entries[i];
+        if ( !entry )
+            continue;
+        size_t slot = entry->hash & mask;
+        while ( table->entries[slot] )
+            slot = (slot + 1) & mask;
+        table->entries[slot] = entry;
+    }
+    free(old_entries);
+}
+
+// Places a new entry in the given empty slot, growing the table if it gets too full.
+static SymbolTableEntry * insert_symbol_at(SymbolTable * table, size_t slot, char * name, size_t length, uint64_t hash) {
+    SymbolTableEntry * new_entry = new_symbol_entry(name, length, hash);
+    table->entries[slot] = new_entry;
+    table->count++;
+    if ( table->count * 100 > table->size * SYMBOL_TABLE_MAX_LOAD_PERCENT )
+        grow_symbol_table(table);
+    return new_entry;
+}
+
+// Inserts a new symbol into the given table. Does not check for duplicates.
+SymbolTableEntry * insert_symbol(SymbolTable * table, char * name) {
+    size_t length = strlen(name);
+    uint64_t hash = hash_symbol_of_length(name, length);
+    size_t mask = table->size - 1;
+    size_t slot = hash & mask;
+    while ( table->entries[slot] )
+        slot = (slot + 1) & mask;
+    return insert_symbol_at(table, slot, name, length, hash);
 }
 
 // Searches for symbol entry with name. Returns NULL if it can't be found.
 SymbolTableEntry * find_symbol(SymbolTable * table, char * name) {
-    size_t entry_index = hash_symbol(name, table->size);
-    SymbolTableEntry * current_entry = table->entries[entry_index];
-    while ( current_entry ) {
-        if ( strcmp(name, current_entry->name) == 0 )
-            return current_entry;
-        current_entry = current_entry->next;
-    }
-    return NULL;
+    size_t length = strlen(name);
+    return table->entries[find_symbol_slot(table, name, length, hash_symbol_of_length(name, length))];
 }
 
 // Inserts a new symbol entry with name and returns it if it's not found. Returns the existing entry otherwise.
 SymbolTableEntry * insert_symbol_if_not_found(SymbolTable * table, char * name) {
-    SymbolTableEntry * entry = find_symbol(table, name);
-    if ( entry )
-        return entry;
-    return insert_symbol(table, name);
+    return insert_symbol_of_length_if_not_found(table, name, strlen(name));
+}
+
+// The same, for a name that isn't NUL-terminated. The entry gets its own copy of it.
+SymbolTableEntry * insert_symbol_of_length_if_not_found(SymbolTable * table, char * name, size_t length) {
+    uint64_t hash = hash_symbol_of_length(name, length);
+    size_t slot = find_symbol_slot(table, name, length, hash);
+    if ( table->entries[slot] )
+        return table->entries[slot];
+    return insert_symbol_at(table, slot, name, length, hash);
 }
@@ -2,22 +2,43 @@
 #define SYMBOLS_H
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
+struct LispSymbol;
+struct LispValue;
+
+// Besides the symbol itself, an entry holds the symbol's global binding, so
+// reading or defining a global doesn't depend on how many globals there are. A
+// name made from a string may hold NUL characters, so its length is kept too.
 typedef struct SymbolTableEntry {
     char * name;
-    struct SymbolTableEntry * next;
+    size_t length;
+    struct LispSymbol * symbol;
+    struct LispValue * value;
+    bool bound;
+    uint64_t hash;
 } SymbolTableEntry;
 
+// An entry's name is stored right after the entry, so the entry of an interned
+// name can be found without hashing it again.
+#define symbol_entry_of(interned_name) ((SymbolTableEntry *)(interned_name) - 1)
+
+// An open addressing table with linear probing. The size is always a power of two,
+// and the table doubles once it is more than 70% full. Empty slots are NULL.
 typedef struct {
     SymbolTableEntry ** entries;
     size_t size;
+    size_t count;
 } SymbolTable;
 
 SymbolTable * new_symbol_table(size_t size);
-SymbolTableEntry * new_symbol_entry(char * name, SymbolTableEntry * next);
+SymbolTableEntry * new_symbol_entry(char * name, size_t length, uint64_t hash);
 SymbolTableEntry * insert_symbol(SymbolTable * table, char * name);
 SymbolTableEntry * find_symbol(SymbolTable * table, char * name);
 SymbolTableEntry * insert_symbol_if_not_found(SymbolTable * table, char * name);
-unsigned int hash_symbol(char * name, size_t modulo);
+SymbolTableEntry * insert_symbol_of_length_if_not_found(SymbolTable * table, char * name, size_t length);
+uint64_t hash_symbol(char * name);
+uint64_t hash_symbol_of_length(char * name, size_t length);
 
 #endif // SYMBOLS_H
@@ -0,0 +1,115 @@
+#include "./tokenizer.h"
+#include "./helper.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures the throughput of the tokenizer: tokenizes the given files, or generated
+// S-expression records if none are given, several times over and prints the best
+// time. Build it with make-tokenizer-bench.sh.
+//   tokenizer-bench [--size megabytes] [--passes count] [file ...]
+
+#define DEFAULT_SIZE_MB 16
+#define DEFAULT_PASSES 5
+
+typedef struct {
+  char * data;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+static void append(Buffer * buffer, char * data, size_t length) {
+  if ( buffer->length + length > buffer->capacity ) {
+    while ( buffer->length + length > buffer->capacity )
+      buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+    if ( !buffer->data )
+      exit_message("Error while allocating memory for benchmark data.", -1);
+  }
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void append_file(Buffer * buffer, char * filename) {
+  FILE * file = fopen(filename, "rb");
+  if ( !file ) {
+    printf("Could not open %s\n", filename);
+    exit_message("File read error.", -1);
+  }
+  char chunk[65536];
+  size_t chars_read;
+  while ( (chars_read = fread(chunk, 1, sizeof(chunk), file)) > 0 )
+    append(buffer, chunk, chars_read);
+  fclose(file);
+}
+
+// A data file of records, each a nested list of symbols, numbers and strings.
+static void append_record(Buffer * buffer, size_t index) {
+  char record[256];
+  int length = snprintf(record, sizeof(record),
+    "(record %zu \"item number %zu\"\n  (tags alpha-%zu beta gamma-delta)\n  (point %zu %zu) (weight %zu))\n",
+    index, index, index % 97, index * 7 % 1000, index * 13 % 1000, index % 50000);
+  append(buffer, record, length);
+}
+
+static double seconds_since(struct timespec * start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char ** argv) {
+  size_t size = (size_t)DEFAULT_SIZE_MB << 20;
+  int passes = DEFAULT_PASSES;
+  Buffer source = { NULL, 0, 0 };
+  for ( int arg_index = 1 ; arg_index < argc ; arg_index++ ) {
+    if ( strcmp(argv[arg_index], "--size") == 0 && arg_index + 1 < argc ) {
+      size = (size_t)atol(argv[++arg_index]) << 20;
+    } else if ( strcmp(argv[arg_index], "--passes") == 0 && arg_index + 1 < argc ) {
+      passes = atoi(argv[++arg_index]);
+    } else if ( argv[arg_index][0] == '-' ) {
+      printf("Unknown option: %s\n", argv[arg_index]);
+      exit_message("Usage: tokenizer-bench [--size megabytes] [--passes count] [file ...]", -1);
+    } else {
+      append_file(&source, argv[arg_index]);
+    }
+  }
+  // The files are repeated, or records generated, up to the size asked for. Each copy
+  // of the files starts on a new line, so a trailing comment doesn't swallow the next.
+  Buffer data = { NULL, 0, 0 };
+  for ( size_t index = 0 ; data.length < size ; index++ ) {
+    if ( source.length ) {
+      append(&data, source.data, source.length);
+      append(&data, "\n", 1);
+    } else {
+      append_record(&data, index);
+    }
+  }
+  // The data is read back from a file the way the interpreter reads source, a datum
+  // at a time into the same token list.
+  char path[] = "/tmp/tokenizer-bench-XXXXXX";
+  int fd = mkstemp(path);
+  if ( fd < 0 || write(fd, data.data, data.length) != (ssize_t)data.length )
+    exit_message("Error while writing benchmark data.", -1);
+  close(fd);
+  double best = 0;
+  size_t token_count = 0;
+  for ( int pass = 0 ; pass < passes ; pass++ ) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Reader * reader = open_reader(path);
+    token_count = 0;
+    while ( tokenize_next_datum(reader) )
+      token_count += reader->tokens->current - reader->tokens->tokens;
+    close_reader(reader);
+    double elapsed = seconds_since(&start);
+    if ( pass == 0 || elapsed < best )
+      best = elapsed;
+  }
+  unlink(path);
+  printf("%zu bytes, %zu tokens: best of %d passes %.3f s, %.1f MB/s, %.1f M tokens/s\n",
+    data.length, token_count, passes, best, data.length / best / 1e6, token_count / best / 1e6);
+  free(data.data);
+  free(source.data);
+  return 0;
+}
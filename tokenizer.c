@@ -2,56 +2,64 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "./tokenizer.h"
 #include "./helper.h"
 
-Token * new_token(char * value, TokenType type) {
-  Token * new_token = malloc(sizeof(Token));
-  if ( !new_token )
-    exit_message("Error while allocating memory for new token.", -1);
-  new_token->value = malloc(strlen(value) + 1);
-  strcpy(new_token->value, value);
-  new_token->type = type;
-  return new_token;
-}
-
-TokenList * new_token_list(size_t init_size) {
+TokenList * new_token_list(char * source, size_t init_size) {
   TokenList * new_list = malloc(sizeof(TokenList));
-  new_list->tokens = malloc(sizeof(Token *) * init_size);
+  if ( !new_list )
+    exit_message("Error while allocating memory for token list.", -1);
+  new_list->source = source;
+  new_list->tokens = malloc(sizeof(Token) * init_size);
+  if ( !new_list->tokens )
+    exit_message("Error while allocating memory for token list.", -1);
   new_list->current = new_list->tokens;
   new_list->size = init_size;
   return new_list;
 }
 
+void free_token_list(TokenList * token_list) {
+  free(token_list->tokens);
+  free(token_list);
+}
+
+// Doubles the list when it is full, so that tokenizing a large file reallocates it
+// only a few times.
 TokenList * adjust_token_list(TokenList * list) {
   if ( list->current - list->tokens >= list->size ) {
     size_t current_position = list->current - list->tokens;
-    list->tokens = realloc(list->tokens, sizeof(Token *) * (list->size + 256));
+    list->tokens = realloc(list->tokens, sizeof(Token) * list->size * 2);
     if ( !list->tokens )
       exit_message("Error encountered while expanding token list.", -1);
-    list->size += 256;
+    list->size *= 2;
     list->current = list->tokens + current_position; // adjust current pointer in case list pointer changes
   }
   return list;
 }
 
-TokenList * add_token(TokenList * list, Token * token) {
+TokenList * add_token(TokenList * list, char * begin_char, size_t length, TokenType type) {
   list = adjust_token_list(list);
-  (*list->current) = token;
+  list->current->offset = begin_char - list->source;
+  list->current->length = length;
+  list->current->type = type;
   list->current++;
   return list;
 }
 
-void print_token(Token * token) {
+void print_token(TokenList * token_list, Token * token) {
   switch(token->type) {
     case kNumber:
-    printf("NUMBER: %s\n", token->value);
+    printf("NUMBER: %.*s\n", (int)token->length, token_text(token_list, token));
     break;
     case kString:
-    printf("STRING: %s\n", token->value);
+    printf("STRING: %.*s\n", (int)token->length, token_text(token_list, token));
     break;
     case kIdentifier:
-    printf("IDENTIFIER: %s\n", token->value);
+    printf("IDENTIFIER: %.*s\n", (int)token->length, token_text(token_list, token));
     break;
     case kLeftParen:
     printf("LEFT PAREN\n");
@@ -106,164 +114,343 @@ bool is_alpha(char c) {
   return false;
 }
 
+// Classes of characters, looked up in a table rather than compared one by one. A
+// delimiter ends an atom; NUL is one too, though it isn't special.
+enum {
+  kCharDelimiter = 1,
+  kCharSpecial = 2,
+  kCharDigit = 4,
+  kCharSpace = 8
+};
+
+#define SPECIAL_CHAR (kCharDelimiter | kCharSpecial)
+
+static const unsigned char char_classes[256] = {
+  ['\0'] = kCharDelimiter,
+  ['('] = SPECIAL_CHAR, ['['] = SPECIAL_CHAR, ['{'] = SPECIAL_CHAR,
+  [')'] = SPECIAL_CHAR, [']'] = SPECIAL_CHAR, ['}'] = SPECIAL_CHAR,
+  ['"'] = SPECIAL_CHAR, ['#'] = SPECIAL_CHAR, ['.'] = SPECIAL_CHAR,
+  ['`'] = SPECIAL_CHAR, [','] = SPECIAL_CHAR, ['@'] = SPECIAL_CHAR,
+  ['\''] = SPECIAL_CHAR,
+  [' '] = SPECIAL_CHAR | kCharSpace, ['\n'] = SPECIAL_CHAR | kCharSpace,
+  ['\t'] = SPECIAL_CHAR | kCharSpace, ['\r'] = kCharSpace,
+  ['0'] = kCharDigit, ['1'] = kCharDigit, ['2'] = kCharDigit, ['3'] = kCharDigit,
+  ['4'] = kCharDigit, ['5'] = kCharDigit, ['6'] = kCharDigit, ['7'] = kCharDigit,
+  ['8'] = kCharDigit, ['9'] = kCharDigit
+};
+
+#define char_class(c) (char_classes[(unsigned char)(c)])
+
 bool is_numeric(char c) {
-  if ( c >= '0' && c <= '9' )
-    return true;
-  return false;
+  return char_class(c) & kCharDigit;
 }
 
 bool is_special(char c) {
-  switch (c) {
+  return char_class(c) & kCharSpecial;
+}
+
+// The classes of pairs of characters, so that atoms are scanned two characters per
+// lookup. A pair is looked up by its first character plus its second shifted left by
+// eight. The table is filled in from the character classes before anything is
+// tokenized.
+enum {
+  kPairFirstDelimiter = 1,
+  kPairSecondDelimiter = 2,
+  kPairFirstDigit = 4,
+  kPairSecondDigit = 8
+};
+
+#define PAIR_DELIMITER (kPairFirstDelimiter | kPairSecondDelimiter)
+#define PAIR_DIGITS (kPairFirstDigit | kPairSecondDigit)
+
+static unsigned char pair_classes[1 << 16];
+static bool pair_classes_filled = false;
+
+static void fill_pair_classes() {
+  if ( pair_classes_filled )
+    return;
+  for ( size_t pair = 0 ; pair < sizeof(pair_classes) ; pair++ ) {
+    unsigned char first = char_classes[pair & 0xff];
+    unsigned char second = char_classes[pair >> 8];
+    pair_classes[pair] = (first & kCharDelimiter ? kPairFirstDelimiter : 0) |
+      (second & kCharDelimiter ? kPairSecondDelimiter : 0) |
+      (first & kCharDigit ? kPairFirstDigit : 0) |
+      (second & kCharDigit ? kPairSecondDigit : 0);
+  }
+  pair_classes_filled = true;
+}
+
+#define pair_class(c) (pair_classes[(unsigned char)(c)[0] | (unsigned char)(c)[1] << 8])
+
+// Returns the end of the atom starting at the character, stepping two characters at a
+// time. Whether it is a number is noted on the way, so that it isn't scanned twice.
+static char * scan_atom(char * cur_char, char * end_char, bool * all_digits) {
+  unsigned char digits = PAIR_DIGITS;
+  for ( ; end_char - cur_char >= 2 ; cur_char += 2 ) {
+    unsigned char classes = pair_class(cur_char);
+    if ( classes & PAIR_DELIMITER ) {
+      if ( !(classes & kPairFirstDelimiter) ) {
+        digits &= classes | kPairSecondDigit;
+        cur_char++;
+      }
+      *all_digits = digits == PAIR_DIGITS;
+      return cur_char;
+    }
+    digits &= classes;
+  }
+  if ( cur_char < end_char && !(char_class(*cur_char) & kCharDelimiter) ) {
+    if ( !(char_class(*cur_char) & kCharDigit) )
+      digits = 0;
+    cur_char++;
+  }
+  *all_digits = digits == PAIR_DIGITS;
+  return cur_char;
+}
+
+TokenList * tokenize_non_special(char ** cur_char, char * end_char, TokenList * token_list) {
+  char * begin_char = *cur_char;
+  if (is_special(**cur_char))
+    exit_message("Attempt to tokenize non special token with opening special character.", -1);
+  bool all_digits = false;
+  *cur_char = scan_atom(*cur_char, end_char, &all_digits);
+  const size_t token_size = *cur_char - begin_char;
+  if ( !token_size )
+    exit_message("Unexpected NUL character in code.", -1);
+  return add_token(token_list, begin_char, token_size, all_digits ? kNumber : kIdentifier);
+}
+
+// The token of a string is its contents, without the quotes. The closing quote is
+// found with memchr, which checks many characters at a time.
+TokenList * tokenize_string(char ** cur_char, char * end_char, TokenList * token_list) {
+  char * begin_char = *cur_char;
+  if (**cur_char != '"')
+    exit_message("Attempt to tokenize string without opening quote.", -1);
+  char * closing_quote = memchr(begin_char + 1, '"', end_char - begin_char - 1);
+  if ( !closing_quote )
+    exit_message("Reached end of code while tokenizing string.", -1);
+  token_list = add_token(token_list, begin_char + 1, closing_quote - begin_char - 1, kString);
+  *cur_char = closing_quote + 1;
+  return token_list;
+}
+
+// Adds the token starting at the character, if it isn't whitespace or a comment, and
+// returns the character after it.
+static char * tokenize_token(TokenList * token_list, char * cur_char, char * end_char) {
+  switch (*cur_char) {
+    case ' ':
+    case '\n':
+    case '\t':
+    case '\r':
+      while ( cur_char < end_char && (char_class(*cur_char) & kCharSpace) )
+        cur_char++;
+      return cur_char;
     case '(':
+      add_token(token_list, cur_char, 1, kLeftParen);
+      return cur_char + 1;
     case '[':
+      add_token(token_list, cur_char, 1, kLeftBracket);
+      return cur_char + 1;
     case '{':
+      add_token(token_list, cur_char, 1, kLeftBrace);
+      return cur_char + 1;
     case ')':
+      add_token(token_list, cur_char, 1, kRightParen);
+      return cur_char + 1;
     case ']':
+      add_token(token_list, cur_char, 1, kRightBracket);
+      return cur_char + 1;
     case '}':
-    case '"':
-    case ' ':
+      add_token(token_list, cur_char, 1, kRightBrace);
+      return cur_char + 1;
     case '#':
-    case '.':
+      add_token(token_list, cur_char, 1, kHash);
+      return cur_char + 1;
+    case '\'':
+      add_token(token_list, cur_char, 1, kSingleQuote);
+      return cur_char + 1;
     case '`':
+      add_token(token_list, cur_char, 1, kBacktick);
+      return cur_char + 1;
     case ',':
+      add_token(token_list, cur_char, 1, kComma);
+      return cur_char + 1;
+    case '.':
+      add_token(token_list, cur_char, 1, kPeriod);
+      return cur_char + 1;
     case '@':
-    case '\'':
-    case '\n':
-    case '\t':
-      return true;
+      add_token(token_list, cur_char, 1, kAtSign);
+      return cur_char + 1;
+    case ';': {
+      char * newline = memchr(cur_char, '\n', end_char - cur_char);
+      return newline ? newline : end_char;
+    }
+    case '"':
+      tokenize_string(&cur_char, end_char, token_list);
+      return cur_char;
     default:
-      return false;
+      tokenize_non_special(&cur_char, end_char, token_list);
+      return cur_char;
   }
 }
 
-bool is_number_token(const char * token_val) {
-  const size_t token_size = strlen(token_val);
-  if (strspn(token_val, "0123456789") == token_size)
-    return true;
-  return false;
+TokenList * tokenize(char * code) {
+  return tokenize_source(code, strlen(code));
 }
 
-TokenType identify_non_special(const char * token_val) {
-  if (is_number_token(token_val)) {
-    return kNumber;
-  } else {
-    return kIdentifier;
+// Tokenizes the given number of characters of the source, which needn't end in a NUL.
+TokenList * tokenize_source(char * source, size_t length) {
+  fill_pair_classes();
+  TokenList * token_list = new_token_list(source, 256);
+  char * cur_char = source;
+  char * end_char = source + length;
+  while (cur_char < end_char)
+    cur_char = tokenize_token(token_list, cur_char, end_char);
+  return token_list;
+}
+
+// Returns whether the token starting at the character ends before the end of what
+// has been read so far, so that more of a stream needn't be read to tokenize it.
+static bool token_complete(char * cur_char, char * end_char) {
+  switch (*cur_char) {
+    case '"':
+      return memchr(cur_char + 1, '"', end_char - cur_char - 1) != NULL;
+    case ';':
+      return memchr(cur_char, '\n', end_char - cur_char) != NULL;
+    case '\r':
+      return true;
+    default: {
+      if ( is_special(*cur_char) )
+        return true;
+      bool all_digits = false;
+      return scan_atom(cur_char, end_char, &all_digits) < end_char;
+    }
   }
 }
 
-TokenList * tokenize_non_special(char ** cur_char, TokenList * token_list) {
-  char * token_val = NULL;
-  const char * begin_char = *cur_char;
-  if (is_special(**cur_char))
-    exit_message("Attempt to tokenize non special token with opening special character.", -1);
-  while (!is_special(**cur_char)) {
-    if (**cur_char == '\0')
-      break;
-    (*cur_char)++;
+Reader * open_reader(char * filename) {
+  fill_pair_classes();
+  Reader * reader = calloc(sizeof(Reader), 1);
+  if ( !reader )
+    exit_message("Error while allocating memory for reader.", -1);
+  reader->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+  if ( reader->fd < 0 ) {
+    printf("Could not open %s\n", filename);
+    exit_message("File read error.", -1);
   }
-  const size_t token_size = *cur_char - begin_char;
-  token_val = malloc(token_size + 1);
-  if ( !token_val ) {
-    exit_message("Error while allocating memory for non-special token.", -1);
+  struct stat file_stat;
+  if ( fstat(reader->fd, &file_stat) < 0 )
+    exit_message("File read error.", -1);
+  // A regular file is mapped whole. An empty one can't be mapped, and has nothing to
+  // read anyway.
+  if ( S_ISREG(file_stat.st_mode) ) {
+    reader->length = file_stat.st_size;
+    reader->buffer = "";
+    if ( reader->length ) {
+      reader->buffer = mmap(NULL, reader->length, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+      if ( reader->buffer == MAP_FAILED )
+        exit_message("Error while mapping source file.", -1);
+    }
+    if ( reader->fd != STDIN_FILENO )
+      close(reader->fd);
+    reader->fd = -1;
+  } else {
+    reader->capacity = READER_BUFFER_SIZE;
+    reader->buffer = malloc(reader->capacity);
+    if ( !reader->buffer )
+      exit_message("Error while allocating memory for reader.", -1);
   }
-  strncpy(token_val, begin_char, token_size);
-  token_val[token_size] = 0;
-  token_list = add_token(token_list, new_token(token_val, identify_non_special(token_val)));
-  return token_list;
+  reader->tokens = new_token_list(reader->buffer, 256);
+  return reader;
 }
 
-TokenList * tokenize_string(char ** cur_char, TokenList * token_list) {
-  char * string_val = NULL;
-  const char * begin_char = *cur_char;
-  if (**cur_char != '"')
-    exit_message("Attempt to tokenize string without opening quote.", -1);
-  (*cur_char)++;
-  while (**cur_char != '"') {
-    if (**cur_char == '\0')
-      exit_message("Reached end of code while tokenizing string.", -1);
-    (*cur_char)++;
+void close_reader(Reader * reader) {
+  if ( reader->fd < 0 ) {
+    if ( reader->length )
+      munmap(reader->buffer, reader->length);
+  } else {
+    if ( reader->fd != STDIN_FILENO )
+      close(reader->fd);
+    free(reader->buffer);
   }
-  const size_t string_size = *cur_char - begin_char - 1;
-  string_val = malloc(string_size + 1);
-  if ( !string_val )
-    exit_message("Error while allocating memory for string token.", -1);
-  strncpy(string_val, begin_char + 1, string_size);
-  string_val[string_size] = 0;
-  token_list = add_token(token_list, new_token(string_val, kString));
-  (*cur_char)++;
-  return token_list;
+  free_token_list(reader->tokens);
+  free(reader);
 }
 
-TokenList * tokenize(char * code) {
-  TokenList * token_list = new_token_list(256);
-  char * cur_char = code;
-  while (*cur_char) {
-    switch (*cur_char) {
-      case ' ':
-      case '\n':
-      case '\t':
-      case '\r':
-        cur_char++;
-        break;
-      case '(':
-        add_token(token_list, new_token("(", kLeftParen));
-        cur_char++;
-        break;
-      case '[':
-        add_token(token_list, new_token("[", kLeftBracket));
-        cur_char++;
-        break;
-      case '{':
-        add_token(token_list, new_token("{", kLeftBrace));
-        cur_char++;
-        break;
-      case ')':
-        add_token(token_list, new_token(")", kRightParen));
-        cur_char++;
-        break;
-      case ']':
-        add_token(token_list, new_token("]", kRightBracket));
-        cur_char++;
-        break;
-      case '}':
-        add_token(token_list, new_token("}", kRightBrace));
-        cur_char++;
-        break;
-      case '#':
-        add_token(token_list, new_token("#", kHash));
-        cur_char++;
-        break;
-      case '\'':
-        add_token(token_list, new_token("'", kSingleQuote));
-        cur_char++;
-        break;
-      case '`':
-        add_token(token_list, new_token("`", kBacktick));
-        cur_char++;
-        break;
-      case ',':
-        add_token(token_list, new_token("`", kComma));
-        cur_char++;
-        break;
-      case '.':
-        add_token(token_list, new_token(".", kPeriod));
-        cur_char++;
-        break;
-      case '@':
-        add_token(token_list, new_token("@", kAtSign));
-        cur_char++;
-        break;
-      case ';':
-        while ( *cur_char != '\n' )
-          cur_char++;
-        break;
-      case '"':
-        token_list = tokenize_string(&cur_char, token_list);
+// Reads more of a stream into the buffer, and returns false at its end. What comes
+// before the datum being read is dropped first, and the buffer only grows when that
+// datum doesn't leave room to read into.
+static bool refill_reader(Reader * reader, size_t * datum_start) {
+  if ( reader->fd < 0 || reader->at_end )
+    return false;
+  if ( *datum_start ) {
+    memmove(reader->buffer, reader->buffer + *datum_start, reader->length - *datum_start);
+    for ( Token * token = reader->tokens->tokens ; token < reader->tokens->current ; token++ )
+      token->offset -= *datum_start;
+    reader->length -= *datum_start;
+    reader->position -= *datum_start;
+    *datum_start = 0;
+  }
+  if ( reader->length == reader->capacity ) {
+    reader->capacity *= 2;
+    reader->buffer = realloc(reader->buffer, reader->capacity);
+    if ( !reader->buffer )
+      exit_message("Error while allocating memory for reader.", -1);
+  }
+  reader->tokens->source = reader->buffer;
+  ssize_t chars_read = read(reader->fd, reader->buffer + reader->length, reader->capacity - reader->length);
+  if ( chars_read < 0 )
+    exit_message("File read error.", -1);
+  if ( chars_read == 0 )
+    reader->at_end = true;
+  reader->length += chars_read;
+  return chars_read > 0;
+}
+
+bool tokenize_next_datum(Reader * reader) {
+  TokenList * token_list = reader->tokens;
+  token_list->current = token_list->tokens;
+  size_t datum_start = reader->position;
+  int depth = 0;
+  while (true) {
+    char * cur_char = reader->buffer + reader->position;
+    char * end_char = reader->buffer + reader->length;
+    if ( cur_char == end_char || (reader->fd >= 0 && !token_complete(cur_char, end_char)) ) {
+      if ( refill_reader(reader, &datum_start) )
+        continue;
+      // Even at the end of the stream, the buffer may have been moved.
+      cur_char = reader->buffer + reader->position;
+      end_char = reader->buffer + reader->length;
+      if ( cur_char == end_char ) {
+        if ( token_list->current == token_list->tokens )
+          return false;
+        exit_message("Reached end of code while reading a form.", -1);
+      }
+    }
+    Token * previous_end = token_list->current;
+    reader->position = tokenize_token(token_list, cur_char, end_char) - reader->buffer;
+    if ( token_list->current == previous_end )
+      continue;
+    switch ( (token_list->current - 1)->type ) {
+      case kLeftParen:
+      case kLeftBracket:
+      case kLeftBrace:
+        depth++;
+        continue;
+      case kRightParen:
+      case kRightBracket:
+      case kRightBrace:
+        depth--;
         break;
+      case kSingleQuote:
+      case kBacktick:
+      case kComma:
+      case kAtSign:
+      case kHash:
+        continue;
       default:
-        token_list = tokenize_non_special(&cur_char, token_list);
         break;
     }
+    if ( depth <= 0 )
+      return true;
   }
-  return token_list;
 }
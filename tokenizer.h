@@ -25,18 +25,51 @@ typedef enum {
   kNumber
 } TokenType;
 
+// A token is a span of the source it was read from. Tokens are kept by value in one
+// array, so tokenizing allocates nothing per token and copies no text.
 typedef struct {
-  char * value;
+  size_t offset;
+  size_t length;
   TokenType type;
 } Token;
 
+// Current is the end of the tokens while tokenizing, and the source must outlive
+// the list.
 typedef struct {
-  Token ** tokens;
-  Token ** current;
+  char * source;
+  Token * tokens;
+  Token * current;
   size_t size;
 } TokenList;
 
+#define token_text(token_list, token) ((token_list)->source + (token)->offset)
+
 TokenList * tokenize(char * code);
-void print_token(Token * token);
+TokenList * tokenize_source(char * source, size_t length);
+void free_token_list(TokenList * token_list);
+void print_token(TokenList * token_list, Token * token);
+
+// Reads a file a datum at a time, or standard input if the filename is "-". A regular
+// file is mapped whole; anything else is read into a buffer that only holds the
+// datum being read and what has been read past it, so that forms from a pipe can be
+// evaluated as they come.
+typedef struct {
+  int fd;
+  char * buffer;
+  size_t length;
+  size_t position;
+  size_t capacity;
+  bool at_end;
+  TokenList * tokens;
+} Reader;
+
+#define READER_BUFFER_SIZE 65536
+
+Reader * open_reader(char * filename);
+void close_reader(Reader * reader);
+
+// Tokenizes the next datum into the reader's tokens, replacing those of the last.
+// Returns false at the end of the input.
+bool tokenize_next_datum(Reader * reader);
 
 #endif // TOKENIZER_H
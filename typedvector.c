@@ -0,0 +1,141 @@
+// The kernels are only vectorized at -O3, and the build scripts don't optimize, so
+// this file is optimized on its own. Strict aliasing stays off, as it is at -O0,
+// since values are read through the structs of their types.
+#pragma GCC optimize("O3", "no-strict-aliasing")
+
+#include "./helper.h"
+#include "./constructor.h"
+#include "./typedvector.h"
+#include <string.h>
+
+// The kernels for one element type. Elements are added and multiplied as unsigned
+// numbers, so that they wrap around instead of overflowing.
+#define TYPED_VECTOR_KERNELS(suffix, type, unsigned_type) \
+    static void fill_##suffix(type * to, type value, size_t length) { \
+        for ( size_t i = 0 ; i < length ; i++ ) \
+            to[i] = value; \
+    } \
+    static void add_##suffix(type * to, type * from, size_t length) { \
+        for ( size_t i = 0 ; i < length ; i++ ) \
+            to[i] = (type)((unsigned_type)to[i] + (unsigned_type)from[i]); \
+    } \
+    static void mul_##suffix(type * to, type * from, size_t length) { \
+        for ( size_t i = 0 ; i < length ; i++ ) \
+            to[i] = (type)((unsigned_type)to[i] * (unsigned_type)from[i]); \
+    } \
+    static int64_t dot_##suffix(type * a, type * b, size_t length) { \
+        uint64_t result = 0; \
+        for ( size_t i = 0 ; i < length ; i++ ) \
+            result += (uint64_t)(int64_t)a[i] * (uint64_t)(int64_t)b[i]; \
+        return (int64_t)result; \
+    } \
+    static int64_t sum_##suffix(type * elements, size_t length) { \
+        uint64_t result = 0; \
+        for ( size_t i = 0 ; i < length ; i++ ) \
+            result += (uint64_t)(int64_t)elements[i]; \
+        return (int64_t)result; \
+    } \
+    static int64_t min_##suffix(type * elements, size_t length) { \
+        type result = elements[0]; \
+        for ( size_t i = 1 ; i < length ; i++ ) \
+            result = elements[i] < result ? elements[i] : result; \
+        return result; \
+    } \
+    static int64_t max_##suffix(type * elements, size_t length) { \
+        type result = elements[0]; \
+        for ( size_t i = 1 ; i < length ; i++ ) \
+            result = elements[i] > result ? elements[i] : result; \
+        return result; \
+    }
+
+TYPED_VECTOR_KERNELS(u8, uint8_t, uint8_t)
+TYPED_VECTOR_KERNELS(s32, int32_t, uint32_t)
+TYPED_VECTOR_KERNELS(s64, int64_t, uint64_t)
+
+// Calls the kernel for the element type of the vector, returning its result when
+// action is return.
+#define DISPATCH_KERNEL(action, vec, kernel, ...) \
+    switch ( (vec)->kind ) { \
+        case kU8Vector: \
+            action kernel##_u8(__VA_ARGS__); \
+            break; \
+        case kS32Vector: \
+            action kernel##_s32(__VA_ARGS__); \
+            break; \
+        default: \
+            action kernel##_s64(__VA_ARGS__); \
+            break; \
+    }
+
+bool typed_vector_fits(TypedVectorKind kind, int64_t value) {
+    switch ( kind ) {
+        case kU8Vector:
+            return value >= 0 && value <= UINT8_MAX;
+        case kS32Vector:
+            return value >= INT32_MIN && value <= INT32_MAX;
+        default:
+            return true;
+    }
+}
+
+int64_t typed_vector_ref(LispTypedVector * vec, size_t index) {
+    switch ( vec->kind ) {
+        case kU8Vector:
+            return ((uint8_t *)vec->value)[index];
+        case kS32Vector:
+            return ((int32_t *)vec->value)[index];
+        default:
+            return ((int64_t *)vec->value)[index];
+    }
+}
+
+void typed_vector_set(LispTypedVector * vec, size_t index, int64_t value) {
+    switch ( vec->kind ) {
+        case kU8Vector:
+            ((uint8_t *)vec->value)[index] = value;
+            break;
+        case kS32Vector:
+            ((int32_t *)vec->value)[index] = value;
+            break;
+        default:
+            ((int64_t *)vec->value)[index] = value;
+            break;
+    }
+}
+
+void typed_vector_fill(LispTypedVector * vec, int64_t value) {
+    DISPATCH_KERNEL(, vec, fill, vec->value, value, vec->length)
+}
+
+// The vectors may be the same one.
+void typed_vector_copy(LispTypedVector * to, LispTypedVector * from) {
+    memmove(to->value, from->value, from->length * typed_vector_element_size(from->kind));
+}
+
+void typed_vector_add(LispTypedVector * to, LispTypedVector * from) {
+    DISPATCH_KERNEL(, to, add, to->value, from->value, to->length)
+}
+
+void typed_vector_mul(LispTypedVector * to, LispTypedVector * from) {
+    DISPATCH_KERNEL(, to, mul, to->value, from->value, to->length)
+}
+
+bool typed_vector_equal(LispTypedVector * a, LispTypedVector * b) {
+    return memcmp(a->value, b->value, a->length * typed_vector_element_size(a->kind)) == 0;
+}
+
+int64_t typed_vector_dot(LispTypedVector * a, LispTypedVector * b) {
+    DISPATCH_KERNEL(return, a, dot, a->value, b->value, a->length)
+}
+
+int64_t typed_vector_sum(LispTypedVector * vec) {
+    DISPATCH_KERNEL(return, vec, sum, vec->value, vec->length)
+}
+
+int64_t typed_vector_min(LispTypedVector * vec) {
+    DISPATCH_KERNEL(return, vec, min, vec->value, vec->length)
+}
+
+int64_t typed_vector_max(LispTypedVector * vec) {
+    DISPATCH_KERNEL(return, vec, max, vec->value, vec->length)
+}
@@ -0,0 +1,28 @@
+#ifndef TYPEDVECTOR_H
+#define TYPEDVECTOR_H
+
+#include "./constructor.h"
+
+// Element access and bulk operations on typed vectors. Elements are read and written
+// as 64-bit integers; the caller checks that a value fits the element type first.
+// The bulk operations are plain loops over the elements, which the compiler can
+// vectorize. Arithmetic wraps around at the width of the elements, and sums and
+// dot products at 64 bits.
+bool typed_vector_fits(TypedVectorKind kind, int64_t value);
+int64_t typed_vector_ref(LispTypedVector * vec, size_t index);
+void typed_vector_set(LispTypedVector * vec, size_t index, int64_t value);
+
+// Operations on two vectors expect them to be of the same kind and length.
+void typed_vector_fill(LispTypedVector * vec, int64_t value);
+void typed_vector_copy(LispTypedVector * to, LispTypedVector * from);
+void typed_vector_add(LispTypedVector * to, LispTypedVector * from);
+void typed_vector_mul(LispTypedVector * to, LispTypedVector * from);
+bool typed_vector_equal(LispTypedVector * a, LispTypedVector * b);
+int64_t typed_vector_dot(LispTypedVector * a, LispTypedVector * b);
+int64_t typed_vector_sum(LispTypedVector * vec);
+
+// These expect the vector not to be empty.
+int64_t typed_vector_min(LispTypedVector * vec);
+int64_t typed_vector_max(LispTypedVector * vec);
+
+#endif // TYPEDVECTOR_H
@@ -0,0 +1,406 @@
+#include "./helper.h"
+#include "./constructor.h"
+#include "./context.h"
+#include "./interpreter.h"
+#include "./vm.h"
+
+bool vm_enabled = false;
+
+// Slots on the operand stack. Calls between compiled lambdas don't use the C stack,
+// so this bounds how deep they can recurse.
+#define VM_STACK_SIZE (1024 * 1024)
+
+// A call saves the caller's bytecode, pc, frame, frame stack mark and stack base.
+#define VM_CALL_RECORD_SIZE 5
+
+static LispValue ** vm_stack = NULL;
+static size_t vm_top = 0;
+
+void vm_init() {
+    vm_stack = malloc(sizeof(LispValue *) * VM_STACK_SIZE);
+    if ( !vm_stack )
+        exit_message("Error while allocating the VM stack.", -1);
+    gc_register_root_array((void **)vm_stack, &vm_top);
+}
+
+// The compiler runs twice over a body: once to count the constants and code words
+// and find the deepest the stack gets, and again to emit them into the bytecode
+// object, which is allocated in between. Nothing allocates during the second pass.
+typedef struct Compiler {
+    LispBytecode * bytecode;
+    size_t const_count;
+    size_t code_length;
+    size_t depth;
+    size_t max_depth;
+} Compiler;
+
+static void emit(Compiler * compiler, int word) {
+    if ( compiler->bytecode )
+        bytecode_code(compiler->bytecode)[compiler->code_length] = word;
+    compiler->code_length++;
+}
+
+static int add_const(Compiler * compiler, LispValue * value) {
+    if ( compiler->bytecode ) {
+        compiler->bytecode->consts[compiler->const_count] = value;
+        gc_write_barrier(compiler->bytecode, value);
+    }
+    return compiler->const_count++;
+}
+
+static void adjust_depth(Compiler * compiler, int change) {
+    compiler->depth += change;
+    if ( compiler->depth > compiler->max_depth )
+        compiler->max_depth = compiler->depth;
+}
+
+static void emit_with_const(Compiler * compiler, Opcode op, LispValue * value) {
+    emit(compiler, op);
+    emit(compiler, add_const(compiler, value));
+}
+
+// Emits a jump and returns the position of its target operand, to be patched.
+static size_t emit_jump(Compiler * compiler, Opcode op) {
+    emit(compiler, op);
+    emit(compiler, 0);
+    return compiler->code_length - 1;
+}
+
+static void patch_jump(Compiler * compiler, size_t operand) {
+    if ( compiler->bytecode )
+        bytecode_code(compiler->bytecode)[operand] = compiler->code_length;
+}
+
+// Calls whose head is a global bound to a primitive or macro are left to eval, since
+// primitives and macros take their arguments unevaluated.
+static bool is_special_call(LispCallNode * node) {
+    if ( value_type(node->head) != kGlobalRefValue )
+        return false;
+    SymbolTableEntry * global = symbol_entry_of(((LispGlobalRef *)node->head)->symbol->value);
+    if ( !global->bound )
+        return false;
+    ValueType head_type = value_type(global->value);
+    return head_type == kPrimitiveValue || head_type == kMacroValue;
+}
+
+static void compile_form(Compiler * compiler, LispValue * form, bool tail);
+
+static void compile_call(Compiler * compiler, LispCallNode * node, bool tail) {
+    compile_form(compiler, node->head, false);
+    int arg_count = 0;
+    for ( LispCell * arg = node->args ; arg ; arg = arg->tail ) {
+        compile_form(compiler, arg->head, false);
+        arg_count++;
+    }
+    emit(compiler, tail ? kOpTailCall : kOpCall);
+    emit(compiler, arg_count);
+    adjust_depth(compiler, -arg_count);
+}
+
+static void compile_if(Compiler * compiler, LispIfNode * node, bool tail) {
+    compile_form(compiler, node->test, false);
+    size_t to_alternative = emit_jump(compiler, kOpJumpIfFalse);
+    adjust_depth(compiler, -1);
+    size_t depth = compiler->depth;
+    compile_form(compiler, node->consequent, tail);
+    size_t to_end = 0;
+    if ( !tail )
+        to_end = emit_jump(compiler, kOpJump);
+    compiler->depth = depth;
+    patch_jump(compiler, to_alternative);
+    compile_form(compiler, node->alternative, tail);
+    if ( !tail )
+        patch_jump(compiler, to_end);
+}
+
+// Compiles a form that leaves its value on the stack or, in tail position, returns it.
+static void compile_form(Compiler * compiler, LispValue * form, bool tail) {
+    switch ( value_type(form) ) {
+        case kIfNodeValue:
+            compile_if(compiler, form, tail);
+            return;
+        case kCallNodeValue:
+            if ( !is_special_call(form) ) {
+                compile_call(compiler, form, tail);
+                return;
+            }
+            // Fall through.
+        case kCellValue:
+            if ( tail ) {
+                emit_with_const(compiler, kOpTailEvalForm, form);
+                adjust_depth(compiler, 1);
+                return;
+            }
+            emit_with_const(compiler, kOpEvalForm, form);
+            break;
+        case kLexicalRefValue:
+            emit_with_const(compiler, kOpLoadLocal, form);
+            break;
+        case kGlobalRefValue:
+            emit_with_const(compiler, kOpLoadGlobal, ((LispGlobalRef *)form)->symbol);
+            break;
+        case kSymbolValue:
+            emit_with_const(compiler, kOpLoadName, form);
+            break;
+        case kLambdaNodeValue:
+            emit_with_const(compiler, kOpMakeClosure, ((LispLambdaNode *)form)->info);
+            break;
+        case kConstantValue:
+            emit_with_const(compiler, kOpPushConst, ((LispConstant *)form)->value);
+            break;
+        default:
+            emit_with_const(compiler, kOpPushConst, form);
+            break;
+    }
+    adjust_depth(compiler, 1);
+    if ( tail ) {
+        emit(compiler, kOpReturn);
+        adjust_depth(compiler, -1);
+    }
+}
+
+static void compile_body(Compiler * compiler, LispCell * body) {
+    if ( !body ) {
+        compile_form(compiler, NULL, true);
+        return;
+    }
+    for ( LispCell * current_cell = body ; current_cell ; current_cell = current_cell->tail ) {
+        if ( !current_cell->tail ) {
+            compile_form(compiler, current_cell->head, true);
+        } else {
+            compile_form(compiler, current_cell->head, false);
+            emit(compiler, kOpPop);
+            adjust_depth(compiler, -1);
+        }
+    }
+}
+
+// Compiles the lambda's resolved body. Returns NULL if the body wasn't resolved,
+// e.g. because the lambda takes all its arguments as one list.
+LispBytecode * compile_lambda(LispLambda * lambda) {
+    LispCell * params = lambda->value->params;
+    if ( params && value_type(params) != kCellValue )
+        return NULL;
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    Compiler compiler = { NULL, 0, 0, 0, 0 };
+    compile_body(&compiler, lambda->value->code);
+    LispBytecode * bytecode = gc_alloc_old(kGCBytecode, sizeof(LispBytecode) + sizeof(LispValue *) * compiler.const_count + sizeof(int) * compiler.code_length);
+    bytecode->const_count = compiler.const_count;
+    bytecode->code_length = compiler.code_length;
+    bytecode->max_stack = compiler.max_depth;
+    compiler = (Compiler){ bytecode, 0, 0, 0, 0 };
+    compile_body(&compiler, lambda->value->code);
+    gc_restore_roots(roots);
+    return bytecode;
+}
+
+// Binds the lambda's parameters in the frame to the arguments on the stack.
+static void bind_stack_args(LispContext * frame, LispCell * params, size_t first_arg, size_t arg_count) {
+    size_t roots = gc_save_roots();
+    LispCell * current_param = params;
+    LispCell * rest_args = NULL;
+    gc_protect(frame);
+    gc_protect(current_param);
+    gc_protect(rest_args);
+    size_t arg_index = 0;
+    for ( ; current_param ; current_param = current_param->tail ) {
+        if ( value_type(current_param) != kCellValue ) {
+            for ( size_t i = arg_count ; i > arg_index ; i-- )
+                rest_args = new_lisp_cell(vm_stack[first_arg + i - 1], rest_args);
+            insert_context_entry(frame, ((LispSymbol *)current_param)->value, rest_args);
+            arg_index = arg_count;
+            break;
+        }
+        if ( value_type(current_param->head) != kSymbolValue )
+            exit_message("Encountered non-symbol value in parameter list.", -1);
+        LispValue * arg_value = arg_index < arg_count ? vm_stack[first_arg + arg_index++] : NULL;
+        insert_context_entry(frame, ((LispSymbol *)current_param->head)->value, arg_value);
+    }
+    if ( arg_index < arg_count )
+        exit_message("Too many arguments passed to lambda.", -1);
+    gc_restore_roots(roots);
+}
+
+// Creates the frame for a call of a lambda with arguments on the stack.
+static LispContext * new_stack_args_frame(LispLambda * lambda, size_t first_arg, size_t arg_count) {
+    size_t roots = gc_save_roots();
+    gc_protect(lambda);
+    LispContext * frame = new_lambda_frame(lambda);
+    gc_protect(frame);
+    bind_stack_args(frame, lambda->value->params, first_arg, arg_count);
+    gc_restore_roots(roots);
+    return frame;
+}
+
+// Calls something other than a compiled lambda with arguments on the stack. A native
+// or an interpreted lambda takes them where they are, while a primitive is passed them
+// as constants, so that evaluating them gives back the values.
+static LispValue * call_from_stack(LispValue * callee, size_t first_arg, size_t arg_count, LispContext * ctx) {
+    if ( value_type(callee) == kNativeValue )
+        return call_native(callee, vm_stack + first_arg, arg_count);
+    if ( value_type(callee) == kLambdaValue )
+        return call_lambda(callee, vm_stack + first_arg, arg_count);
+    size_t roots = gc_save_roots();
+    LispCell * args = NULL;
+    gc_protect(callee);
+    gc_protect(ctx);
+    gc_protect(args);
+    for ( size_t i = arg_count ; i > 0 ; i-- ) {
+        LispValue * arg = vm_stack[first_arg + i - 1];
+        args = new_lisp_cell(new_lisp_constant(arg), args);
+    }
+    LispValue * result = NULL;
+    if ( value_type(callee) == kPrimitiveValue ) {
+        PrimitiveFunPtr prim_ptr = callee->value;
+        result = (*prim_ptr)(args, ctx);
+        if ( result == TAIL_CALL )
+            result = run_pending_tail_call();
+    } else {
+        exit_message("Encountered value other than lambda or primitive called from compiled code.", -1);
+    }
+    gc_restore_roots(roots);
+    return result;
+}
+
+#define push(value) (vm_stack[vm_top++] = (value))
+#define pop() (vm_stack[--vm_top])
+
+// Runs the compiled body of the lambda whose frame is given, until it returns. Calls
+// from one compiled lambda to another, tail calls or not, stay within this loop.
+// Returns TAIL_CALL, like a special form, when the body ends in one that does.
+LispValue * vm_run(LispContext * frame) {
+    static void * dispatch[] = {
+        &&op_push_const, &&op_load_local, &&op_load_global, &&op_load_name,
+        &&op_make_closure, &&op_eval_form, &&op_tail_eval_form, &&op_pop, &&op_jump, &&op_jump_if_false,
+        &&op_call, &&op_tail_call, &&op_return
+    };
+    size_t roots = gc_save_roots();
+    LispContext * ctx = frame;
+    LispBytecode * bytecode = ctx->parent_lambda->value->bytecode;
+    LispValue * value = NULL;
+    gc_protect(ctx);
+    gc_protect(bytecode);
+    gc_protect(value);
+    int * code = bytecode_code(bytecode);
+    size_t pc = 0;
+    size_t entry_base = vm_top;
+    size_t base = vm_top;
+    size_t frame_mark = gc_frame_mark();
+    if ( vm_top + bytecode->max_stack > VM_STACK_SIZE )
+        exit_message("VM stack overflow.", -1);
+
+    #define next() goto *dispatch[code[pc++]]
+    next();
+
+    op_push_const:
+        push(bytecode->consts[code[pc++]]);
+        next();
+    op_load_local: {
+        LispLexicalRef * ref = bytecode->consts[code[pc++]];
+        LispContext * ref_frame = lexical_ref_frame(ref, ctx);
+        push(ref_frame ? context_value(ref_frame, ref->slot) : lookup_symbol(ref->symbol, ctx));
+        next();
+    }
+    op_load_global: {
+        LispSymbol * symbol = bytecode->consts[code[pc++]];
+        SymbolTableEntry * global = symbol_entry_of(symbol->value);
+        push(global->bound ? global->value : lookup_symbol(symbol, ctx));
+        next();
+    }
+    op_load_name:
+        push(lookup_symbol(bytecode->consts[code[pc++]], ctx));
+        next();
+    op_make_closure:
+        value = new_lisp_closure(bytecode->consts[code[pc++]], ctx);
+        push(value);
+        next();
+    op_eval_form:
+        value = eval(bytecode->consts[code[pc++]], ctx);
+        push(value);
+        next();
+    op_tail_eval_form:
+        // The outermost body hands the evaluation back to the trampoline that
+        // called the VM, so loops through special forms run in constant C stack.
+        if ( base == entry_base ) {
+            value = tail_eval(bytecode->consts[code[pc++]], ctx);
+            vm_top = entry_base;
+            gc_restore_roots(roots);
+            return value;
+        }
+        value = eval(bytecode->consts[code[pc++]], ctx);
+        push(value);
+        goto op_return;
+    op_pop:
+        vm_top--;
+        next();
+    op_jump:
+        pc = code[pc];
+        next();
+    op_jump_if_false:
+        if ( boolify_value(pop()) )
+            pc++;
+        else
+            pc = code[pc];
+        next();
+    op_call:
+    op_tail_call: {
+        bool tail = code[pc - 1] == kOpTailCall;
+        size_t arg_count = code[pc++];
+        size_t first_arg = vm_top - arg_count;
+        LispLambda * callee = vm_stack[first_arg - 1];
+        if ( value_type(callee) == kLambdaValue ) {
+            resolve_lambda(callee);
+            callee = vm_stack[first_arg - 1];
+        }
+        if ( value_type(callee) != kLambdaValue || !callee->value->bytecode ) {
+            value = call_from_stack(callee, first_arg, arg_count, ctx);
+            vm_top = first_arg - 1;
+            push(value);
+            if ( tail )
+                goto op_return;
+            next();
+        }
+        size_t callee_mark = gc_frame_mark();
+        LispContext * callee_frame = new_stack_args_frame(callee, first_arg, arg_count);
+        callee = vm_stack[first_arg - 1];
+        if ( tail ) {
+            ctx = replace_frames(callee_frame, frame_mark);
+            vm_top = base;
+        } else {
+            vm_top = first_arg - 1;
+            push(bytecode);
+            push(make_fixnum(pc));
+            push(ctx);
+            push(make_fixnum(frame_mark));
+            push(make_fixnum(base));
+            base = vm_top;
+            ctx = callee_frame;
+            frame_mark = callee_mark;
+        }
+        bytecode = callee->value->bytecode;
+        code = bytecode_code(bytecode);
+        pc = 0;
+        if ( vm_top + bytecode->max_stack + VM_CALL_RECORD_SIZE > VM_STACK_SIZE )
+            exit_message("VM stack overflow.", -1);
+        next();
+    }
+    op_return:
+        value = pop();
+        if ( base == entry_base ) {
+            vm_top = entry_base;
+            gc_restore_roots(roots);
+            return value;
+        }
+        gc_pop_frames(frame_mark);
+        vm_top = base;
+        base = fixnum_value(pop());
+        frame_mark = fixnum_value(pop());
+        ctx = (LispContext *)pop();
+        pc = fixnum_value(pop());
+        bytecode = (LispBytecode *)pop();
+        code = bytecode_code(bytecode);
+        push(value);
+        next();
+    #undef next
+}
@@ -0,0 +1,43 @@
+#ifndef VM_H
+#define VM_H
+
+#include "./constructor.h"
+#include "./context.h"
+
+// A lambda body compiled for the VM. The constants the code refers to by index come
+// first, followed by the code itself: each instruction is an opcode followed by its
+// operands. Bytecode is allocated old, so the code never moves while it runs.
+typedef struct LispBytecode {
+    unsigned int const_count;
+    unsigned int code_length;
+    unsigned int max_stack;
+    LispValue * consts[];
+} LispBytecode;
+
+#define bytecode_code(bytecode) ((int *)((bytecode)->consts + (bytecode)->const_count))
+
+typedef enum Opcode {
+    kOpPushConst,
+    kOpLoadLocal,
+    kOpLoadGlobal,
+    kOpLoadName,
+    kOpMakeClosure,
+    kOpEvalForm,
+    kOpTailEvalForm,
+    kOpPop,
+    kOpJump,
+    kOpJumpIfFalse,
+    kOpCall,
+    kOpTailCall,
+    kOpReturn
+} Opcode;
+
+// When set, lambdas are compiled to bytecode on their first call and run on the VM
+// instead of being walked by eval. Chosen once at startup with --vm.
+extern bool vm_enabled;
+
+void vm_init();
+LispBytecode * compile_lambda(LispLambda * lambda);
+LispValue * vm_run(LispContext * frame);
+
+#endif // VM_H